@@ -21,7 +21,11 @@ Evaluator::Settings::Settings(int argc, char *argv[], bool &ok)
         return;
     }
 
-    parseSettings(cmdLineParser);
+    if (!parseSettings(cmdLineParser))
+    {
+        ok = false;
+        return;
+    }
 
     ok = true;
 }
@@ -56,8 +60,9 @@ Face::Biometrics::Evaluation Evaluator::evaluate(const Settings &settings)
     if (settings.alignType == Settings::AlignType::ICP)
     {
         Face::FaceData::FaceAlignerIcp aligner;
+        settings.icp.configure(aligner);
         Face::LinAlg::Loader::loadMeshes(settings.evalDir, aligner, ids, meshes,
-                                         settings.ICPiters, settings.smoothIters, settings.smoothCoef, "-");
+                                         settings.icp.settings, settings.smoothIters, settings.smoothCoef, "-");
     }
     else if (settings.alignType == Settings::AlignType::Landmark)
     {
@@ -19,8 +19,11 @@ Processor::Settings::Settings(int argc, char *argv[], bool &ok)
     inputDir = cmdLineParser.getParamValue("--inputDir", ok); if (!ok) return;
     outputDir = cmdLineParser.getParamValue("--outputDir", ok); if (!ok) return;
 
-    ICPiters = cmdLineParser.getParamValueInt("--ICPiters", ok);
-    if (!ok) ICPiters = 100;
+    if (!icp.parse(cmdLineParser))
+    {
+        ok = false;
+        return;
+    }
 
     smoothCoef = cmdLineParser.getParamValueFloat("--smoothCoef", ok);
     if (!ok) smoothCoef = 0.01;
@@ -40,7 +43,7 @@ void Processor::Settings::printHelp()
     std::cout << "  --inputDir /path/to/dir1/" << std::endl;
     std::cout << "  --outputDir /path/to/dir2/" << std::endl;
     std::cout << " optional parameters (with default values):" << std::endl;
-    std::cout << "  --ICPiters 100" << std::endl;
+    IcpOptions::printHelp();
     std::cout << "  --smoothCoef 0.01" << std::endl;
     std::cout << "  --smoothIters 10" << std::endl;
 }
@@ -52,7 +55,7 @@ void Processor::Settings::printSettings()
     std::cout << "  --preAlignTemplate " << preAlignTemplate << std::endl;
     std::cout << "  --inputDir " << inputDir << std::endl;
     std::cout << "  --outputDir " << outputDir << std::endl;
-    std::cout << "  --ICPiters " << ICPiters << std::endl;
+    icp.printSettings();
     std::cout << "  --smoothCoef " << smoothCoef << std::endl;
     std::cout << "  --smoothIters " << smoothIters << std::endl;
 }
@@ -61,10 +64,11 @@ void Processor::process(const Settings &settings)
 {
 	Face::FaceData::FaceAlignerIcp aligner(
                 Face::FaceData::Mesh::fromFile(settings.meanFaceForAlign), settings.preAlignTemplate);
+    settings.icp.configure(aligner);
 
     std::vector<int> ids;
     std::vector<Face::FaceData::Mesh> meshes;
-    Face::LinAlg::Loader::loadMeshes(settings.inputDir, aligner, ids, meshes, settings.ICPiters,
+    Face::LinAlg::Loader::loadMeshes(settings.inputDir, aligner, ids, meshes, settings.icp.settings,
                        settings.smoothIters, settings.smoothCoef, "-");
 
     // create directory if it doesn't exist
@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "settingsbase.h"
+
 namespace Face
 {
 namespace AutoTrainer
@@ -21,7 +23,7 @@ public:
         std::string preAlignTemplate;
         std::string inputDir;
         std::string outputDir;
-        int ICPiters;
+        IcpOptions icp;
         float smoothCoef;
         int smoothIters;
 
@@ -4,17 +4,98 @@
 
 #include "faceCommon/helpers/cmdlineargsparser.h"
 #include "faceCommon/settings/settings.h"
+#include "faceCommon/facedata/facealigner.h"
 
 namespace Face {
 namespace AutoTrainer {
 
+/**
+ * ICP options of all the commands that align meshes: FaceAlignerIcp::IcpSettings of the
+ * iterations, the minimized metric and the direction of the correspondences search
+ */
+class IcpOptions
+{
+public:
+    Face::FaceData::FaceAlignerIcp::IcpSettings settings;
+    Face::FaceData::FaceAlignerIcp::Metric metric;
+    bool matchToReference;
+
+    IcpOptions() : metric(Face::FaceData::FaceAlignerIcp::PointToPoint), matchToReference(false) {}
+
+    static void printHelp()
+    {
+        Face::FaceData::FaceAlignerIcp::IcpSettings defaults;
+        std::cout << "  --ICPiters " << defaults.maxIterations << std::endl;
+        std::cout << "  --ICPtolerance " << defaults.tolerance << std::endl;
+        std::cout << "  --ICPsubsampleLevels " << defaults.subsampleLevels << std::endl;
+        std::cout << "  --ICPsubsampleStep " << defaults.subsampleStep << std::endl;
+        std::cout << "  --ICPtrimRatio " << defaults.trimRatio << std::endl;
+        std::cout << "  --ICPmaxDistance " << defaults.maxDistance << " (0 for unlimited)" << std::endl;
+        std::cout << "  --ICPmetric [point|plane] (point)" << std::endl;
+        std::cout << "  --ICPmatchToReference (off)" << std::endl;
+    }
+
+    void printSettings() const
+    {
+        std::cout << "  --ICPiters " << settings.maxIterations << std::endl;
+        std::cout << "  --ICPtolerance " << settings.tolerance << std::endl;
+        std::cout << "  --ICPsubsampleLevels " << settings.subsampleLevels << std::endl;
+        std::cout << "  --ICPsubsampleStep " << settings.subsampleStep << std::endl;
+        std::cout << "  --ICPtrimRatio " << settings.trimRatio << std::endl;
+        std::cout << "  --ICPmaxDistance " << settings.maxDistance << std::endl;
+        std::cout << "  --ICPmetric " << (metric == Face::FaceData::FaceAlignerIcp::PointToPlane ? "plane" : "point") << std::endl;
+        if (matchToReference) std::cout << "  --ICPmatchToReference" << std::endl;
+    }
+
+    // false for an unknown metric
+    bool parse(Face::Helpers::CmdLineArgsParser &cmdLineParser)
+    {
+        bool ok;
+
+        int maxIterations = cmdLineParser.getParamValueInt("--ICPiters", ok);
+        if (ok) settings.maxIterations = maxIterations;
+
+        double tolerance = cmdLineParser.getParamValueFloat("--ICPtolerance", ok);
+        if (ok) settings.tolerance = tolerance;
+
+        int subsampleLevels = cmdLineParser.getParamValueInt("--ICPsubsampleLevels", ok);
+        if (ok) settings.subsampleLevels = subsampleLevels;
+
+        int subsampleStep = cmdLineParser.getParamValueInt("--ICPsubsampleStep", ok);
+        if (ok) settings.subsampleStep = subsampleStep;
+
+        double trimRatio = cmdLineParser.getParamValueFloat("--ICPtrimRatio", ok);
+        if (ok) settings.trimRatio = trimRatio;
+
+        double maxDistance = cmdLineParser.getParamValueFloat("--ICPmaxDistance", ok);
+        if (ok) settings.maxDistance = maxDistance;
+
+        std::string metricS = cmdLineParser.getParamValue("--ICPmetric", ok);
+        if (!ok || metricS.compare("point") == 0)
+            metric = Face::FaceData::FaceAlignerIcp::PointToPoint;
+        else if (metricS.compare("plane") == 0)
+            metric = Face::FaceData::FaceAlignerIcp::PointToPlane;
+        else
+            return false;
+
+        matchToReference = cmdLineParser.hasParam("--ICPmatchToReference");
+        return true;
+    }
+
+    void configure(Face::FaceData::FaceAlignerIcp &aligner) const
+    {
+        aligner.setMetric(metric);
+        aligner.setMatchToReference(matchToReference);
+    }
+};
+
 class SettingsBase
 {
 public:
     enum class AlignType { None, ICP, Landmark };
     AlignType alignType;
 
-    int ICPiters;
+    IcpOptions icp;
     float smoothCoef;
     int smoothIters;
 
@@ -38,7 +119,7 @@ public:
         std::cout << "  --landmarks landmarks.yml" << std::endl;
         std::cout << "  --meanFaceForAlign model.obj" << std::endl;
         std::cout << "  --preAlignTemplate template.yml" << std::endl;
-        std::cout << "  --ICPiters 100" << std::endl;
+        IcpOptions::printHelp();
         std::cout << "  --smoothCoef 0.01" << std::endl;
         std::cout << "  --smoothIters 10" << std::endl;
     }
@@ -52,7 +133,7 @@ public:
         {
             std::cout << "  --meanFaceForAlign " << s.settingsMap[s.MeanFaceModelPathKey].convert<std::string>() << std::endl;
             std::cout << "  --preAlignTemplate " << s.settingsMap[s.PreAlignTemplatePathKey].convert<std::string>() << std::endl;
-            std::cout << "  --ICPiters " << ICPiters << std::endl;
+            icp.printSettings();
         }
         else if (alignType == AlignType::Landmark)
         {
@@ -82,7 +163,7 @@ protected:
         return true;
     }
 
-    void parseIcpSettings(Face::Helpers::CmdLineArgsParser &cmdLineParser)
+    bool parseIcpSettings(Face::Helpers::CmdLineArgsParser &cmdLineParser)
     {
         Face::Settings &s = Face::Settings::instance();
         bool ok;
@@ -93,8 +174,7 @@ protected:
         std::string preAlignTemplate = cmdLineParser.getParamValue("--preAlignTemplate", ok);
         if (ok) s.settingsMap[s.PreAlignTemplatePathKey] = preAlignTemplate;
 
-        ICPiters = cmdLineParser.getParamValueInt("--ICPiters", ok);
-        if (!ok) ICPiters = 100;
+        return icp.parse(cmdLineParser);
     }
 
     void parseLandmarkSettings(Face::Helpers::CmdLineArgsParser &cmdLineParser)
@@ -117,11 +197,12 @@ protected:
         if (!ok) smoothIters = 10;
     }
 
-    void parseSettings(Face::Helpers::CmdLineArgsParser &cmdLineParser)
+    bool parseSettings(Face::Helpers::CmdLineArgsParser &cmdLineParser)
     {
-        parseIcpSettings(cmdLineParser);
+        if (!parseIcpSettings(cmdLineParser)) return false;
         parseLandmarkSettings(cmdLineParser);
         parseSmoothSettings(cmdLineParser);
+        return true;
     }
 };
 
@@ -20,8 +20,11 @@ TemplateExtractor::Settings::Settings(int argc, char *argv[], bool &ok)
     meanFaceForAlign = cmdLineParser.getParamValue("--meanFaceForAlign", ok); if (!ok) return;
     preAlignTemplate = cmdLineParser.getParamValue("--preAlignTemplate", ok); if (!ok) return;
 
-    ICPiters = cmdLineParser.getParamValueInt("--ICPiters", ok);
-    if (!ok) ICPiters = 100;
+    if (!icp.parse(cmdLineParser))
+    {
+        ok = false;
+        return;
+    }
 
     smoothCoef = cmdLineParser.getParamValueFloat("--smoothCoef", ok);
     if (!ok) smoothCoef = 0.01;
@@ -45,7 +48,7 @@ void TemplateExtractor::Settings::printHelp()
     std::cout << "  --meanFaceForAlign path/to/mean/face.obj" << std::endl;
     std::cout << "  --preAlignTemplate path/to/mean/template.yml" << std::endl;
     std::cout << " optional parameters (with default values):" << std::endl;
-    std::cout << "  --ICPiters 100" << std::endl;
+    IcpOptions::printHelp();
     std::cout << "  --smoothCoef 0.01" << std::endl;
     std::cout << "  --smoothIters 10" << std::endl;
     std::cout << "  --templateVersion 1" << std::endl;
@@ -59,7 +62,7 @@ void TemplateExtractor::Settings::printSettings()
     std::cout << "  --resultPath " << resultPath << std::endl;
     std::cout << "  --meanFaceForAlign " << meanFaceForAlign << std::endl;
     std::cout << "  --preAlignTemplate " << preAlignTemplate << std::endl;
-    std::cout << "  --ICPiters " << ICPiters << std::endl;
+    icp.printSettings();
     std::cout << "  --smoothCoef " << smoothCoef << std::endl;
     std::cout << "  --smoothIters " << smoothIters << std::endl;
     std::cout << "  --templateVersion " << templateVersion << std::endl;
@@ -70,10 +73,11 @@ void TemplateExtractor::extract(const Settings &settings)
     Face::Biometrics::MultiExtractor extractor(settings.extractorPath);
 	Face::FaceData::FaceAlignerIcp aligner(
                 Face::FaceData::Mesh::fromFile(settings.meanFaceForAlign), settings.preAlignTemplate);
+    settings.icp.configure(aligner);
 
     std::vector<int> ids;
     std::vector<Face::FaceData::Mesh> meshes;
-    Face::LinAlg::Loader::loadMeshes(settings.inputPath, aligner, ids, meshes, settings.ICPiters,
+    Face::LinAlg::Loader::loadMeshes(settings.inputPath, aligner, ids, meshes, settings.icp.settings,
                        settings.smoothIters, settings.smoothCoef,  "-");
 
     // create directory if it doesn't exist
@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "settingsbase.h"
+
 namespace Face {
 namespace AutoTrainer {
 
@@ -20,7 +22,7 @@ public:
         std::string resultPath;
         std::string meanFaceForAlign;
         std::string preAlignTemplate;
-        int ICPiters;
+        IcpOptions icp;
         float smoothCoef;
         int smoothIters;
         int templateVersion;
@@ -22,6 +22,21 @@ Trainer::Settings::Settings(int argc, char *argv[], bool &ok)
     frgcSamples = cmdLineParser.getParamValueInt("--frgcSamples", ok);
     if (!ok) frgcSamples = 300;
 
+    imageDataCache = cmdLineParser.getParamValue("--imageDataCache", ok);
+    if (!ok) imageDataCache = "";
+
+    std::string quantizer = cmdLineParser.getParamValue("--quantizer", ok);
+    if (!ok) quantizer = "none";
+    try
+    {
+        quantizerType = Face::LinAlg::Quantizer::parseType(quantizer);
+    }
+    catch (std::exception &)
+    {
+        ok = false;
+        return;
+    }
+
     noWrapper = cmdLineParser.hasParam("--noWrapper");
 
     if (!parseAlignType(cmdLineParser))
@@ -30,7 +45,11 @@ Trainer::Settings::Settings(int argc, char *argv[], bool &ok)
         return;
     }
 
-    parseSettings(cmdLineParser);
+    if (!parseSettings(cmdLineParser))
+    {
+        ok = false;
+        return;
+    }
 
     ok = true;
 }
@@ -48,6 +67,8 @@ void Trainer::Settings::printHelp()
     std::cout << " optional parameters (with default values):" << std::endl;
     SettingsBase::printHelp();
     std::cout << "  --noWrapper" << std::endl;
+    std::cout << "  --imageDataCache /path/to/cache/dir/" << std::endl;
+    std::cout << "  --quantizer [none|int8|float16] (none)" << std::endl;
 }
 
 void Trainer::Settings::printSettings()
@@ -62,6 +83,8 @@ void Trainer::Settings::printSettings()
     std::cout << "  --frgcSamples " << frgcSamples << std::endl;
     SettingsBase::printSettings();
     std::cout << "  --noWrapper " << noWrapper << std::endl;
+    std::cout << "  --imageDataCache " << imageDataCache << std::endl;
+    std::cout << "  --quantizer " << Face::LinAlg::Quantizer::typeName(quantizerType) << std::endl;
 }
 
 Face::Biometrics::MultiExtractor::Ptr Trainer::train(const Settings &settings)
@@ -69,7 +92,7 @@ Face::Biometrics::MultiExtractor::Ptr Trainer::train(const Settings &settings)
     std::cout << "FRGC training data" << std::endl;
     Face::Biometrics::MultiBiomertricsAutoTuner::Input frgcData =
             Face::Biometrics::MultiBiomertricsAutoTuner::Input::fromDirectoryWithAlignedMeshes(
-                settings.frgcDir, "d", settings.frgcSamples);
+                settings.frgcDir, "d", settings.frgcSamples, 0, settings.imageDataCache);
     std::cout << "loaded " << frgcData.ids.size() << " scans" << std::endl;
 
     std::cout << "fusion training data" << std::endl;
@@ -79,8 +102,9 @@ Face::Biometrics::MultiExtractor::Ptr Trainer::train(const Settings &settings)
     if (settings.alignType == Settings::AlignType::ICP)
     {
         Face::FaceData::FaceAlignerIcp aligner;
+        settings.icp.configure(aligner);
         Face::LinAlg::Loader::loadMeshes(settings.trainDir, aligner, ids, meshes,
-                                         settings.ICPiters, settings.smoothIters, settings.smoothCoef, "-");
+                                         settings.icp.settings, settings.smoothIters, settings.smoothCoef, "-");
     }
     else if (settings.alignType == Settings::AlignType::Landmark)
     {
@@ -97,6 +121,7 @@ Face::Biometrics::MultiExtractor::Ptr Trainer::train(const Settings &settings)
     std::cout << "loaded " << trainData.ids.size() << " scans" << std::endl;
 
     Face::Biometrics::MultiBiomertricsAutoTuner::Settings autoTunerSettings(settings.fusionName, settings.unitsFile);
+    autoTunerSettings.quantizerType = settings.quantizerType;
     Face::Biometrics::MultiExtractor::Ptr extractor = settings.noWrapper ?
                 Face::Biometrics::MultiBiomertricsAutoTuner::trainAllUnits(frgcData, trainData, autoTunerSettings) :
                 Face::Biometrics::MultiBiomertricsAutoTuner::trainWithWrapper(frgcData, trainData, autoTunerSettings);
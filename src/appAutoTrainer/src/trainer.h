@@ -21,6 +21,8 @@ public:
         std::string fusionName;
         std::string frgcDir;
         std::string trainDir;
+        std::string imageDataCache;
+        Face::LinAlg::Quantizer::Type quantizerType;
         bool noWrapper;
         int frgcSamples;
 
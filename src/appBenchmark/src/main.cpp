@@ -4,6 +4,117 @@
 #include "faceCommon/facedata/facealigner.h"
 #include "faceCommon/facedata/surfaceprocessor.h"
 #include "faceCommon/biometrics/multiextractor.h"
+#include "faceCommon/biometrics/gallery.h"
+
+// recall@K and latency of the indexed identification against the exhaustive one on a synthetic
+// gallery of noisy copies of the template
+void benchmarkIdentification(const Face::Biometrics::MultiExtractor &extractor,
+                             const Face::Biometrics::MultiTemplate &t, int gallerySize, int indexUnit)
+{
+    const int topK = 10;
+    const int probeCount = 100;
+    cv::RNG rng(42);
+
+    auto noisyCopy = [&](int id, double sigma) -> Face::Biometrics::MultiTemplate
+    {
+        Face::Biometrics::MultiTemplate copy = t;
+        copy.id = id;
+        for (Face::LinAlg::Vector &v : copy.featureVectors)
+        {
+            cv::Scalar mean, stdDev;
+            cv::meanStdDev(v, mean, stdDev);
+            Matrix noise(v.rows, 1);
+            rng.fill(noise, cv::RNG::NORMAL, 0.0, sigma * stdDev[0]);
+            v = Face::LinAlg::Vector(Matrix(v + noise));
+        }
+        return copy;
+    };
+
+    std::vector<Face::Biometrics::MultiTemplate> references;
+    for (int i = 0; i < gallerySize; i++) references.push_back(noisyCopy(i, 0.5));
+    std::vector<Face::Biometrics::MultiTemplate> probes;
+    for (int i = 0; i < probeCount; i++)
+    {
+        Face::Biometrics::MultiTemplate probe = references[rng.uniform(0, gallerySize)];
+        for (Face::LinAlg::Vector &v : probe.featureVectors)
+        {
+            Matrix noise(v.rows, 1);
+            rng.fill(noise, cv::RNG::NORMAL, 0.0, 0.01);
+            v = Face::LinAlg::Vector(Matrix(v + noise));
+        }
+        probes.push_back(probe);
+    }
+
+    Face::Biometrics::Gallery gallery(extractor);
+    gallery.add(references);
+
+    Poco::Timestamp start;
+    gallery.buildIndex(indexUnit);
+    std::cout << "indexBuilding: " << (start.elapsed()/1000) << std::endl;
+
+    start.update();
+    std::vector<std::vector<Face::Biometrics::Gallery::Candidate> > exact;
+    for (const Face::Biometrics::MultiTemplate &probe : probes) exact.push_back(gallery.identify(probe, topK));
+    std::cout << "exhaustive: " << (start.elapsed()/1000.0/probeCount) << " ms/probe" << std::endl;
+
+    int shortlists[] = { 10, 20, 50, 100, 200, 500 };
+    for (int shortlist : shortlists)
+    {
+        int hits = 0;
+        start.update();
+        for (int p = 0; p < probeCount; p++)
+        {
+            for (const Face::Biometrics::Gallery::Candidate &c : gallery.identifyApproximate(probes[p], topK, shortlist))
+            {
+                for (const Face::Biometrics::Gallery::Candidate &e : exact[p])
+                {
+                    if (e.index == c.index) hits++;
+                }
+            }
+        }
+        double ms = start.elapsed()/1000.0/probeCount;
+        std::cout << "shortlist " << shortlist << ": " << ms << " ms/probe, recall@" << topK << " "
+                  << ((double)hits / (probeCount * std::min(topK, gallerySize))) << std::endl;
+    }
+}
+
+// time of the closed-form calculateCurvatures() against the cv::PCA reference and the largest differences
+// of their maps, on the smoothed depth map that is used by MultiExtractor::ImageData
+void benchmarkCurvatures(const Face::FaceData::Mesh &mesh)
+{
+    const int repeats = 20;
+
+    Face::FaceData::MapConverter converter;
+    Face::FaceData::Map depthmap = Face::FaceData::SurfaceProcessor::depthmap(mesh, converter, cv::Point2d(-75, -75),
+                                                                              cv::Point2d(75, 75), 1,
+                                                                              Face::FaceData::SurfaceProcessor::ZCoord);
+    depthmap.bandPass(-70, 10, false, false);
+    depthmap.applyCvGaussBlur(7, 3);
+
+    Face::FaceData::CurvatureStruct reference, current;
+    Poco::Timestamp start;
+    for (int i = 0; i < repeats; i++) reference = Face::FaceData::SurfaceProcessor::calculateCurvaturesReference(depthmap);
+    double timeReference = start.elapsed()/1000.0/repeats;
+
+    start.update();
+    for (int i = 0; i < repeats; i++) current = Face::FaceData::SurfaceProcessor::calculateCurvatures(depthmap);
+    double timeCurrent = start.elapsed()/1000.0/repeats;
+
+    auto maxDifference = [](const Face::FaceData::Map &a, const Face::FaceData::Map &b) -> double
+    {
+        if (cv::countNonZero(a.flags != b.flags) > 0) return INFINITY;
+        return cv::norm(a.values, b.values, cv::NORM_INF);
+    };
+
+    std::cout << "curvatures reference: " << timeReference << " ms" << std::endl;
+    std::cout << "curvatures: " << timeCurrent << " ms" << std::endl;
+    std::cout << "max difference k1: " << maxDifference(reference.curvatureK1, current.curvatureK1)
+              << " k2: " << maxDifference(reference.curvatureK2, current.curvatureK2)
+              << " mean: " << maxDifference(reference.curvatureMean, current.curvatureMean)
+              << " gauss: " << maxDifference(reference.curvatureGauss, current.curvatureGauss)
+              << " index: " << maxDifference(reference.curvatureIndex, current.curvatureIndex)
+              << " pcl: " << maxDifference(reference.curvaturePcl, current.curvaturePcl) << std::endl;
+}
 
 void printHelpAndExit(char *appName)
 {
@@ -13,6 +124,8 @@ void printHelpAndExit(char *appName)
     std::cout << "  --landmarks path/to/landmarks" << std::endl;
     std::cout << "  --landmarksModel path/to/landmarksModel" << std::endl;
     std::cout << "  [--threadPool]" << std::endl;
+    std::cout << "  [--gallerySize n] [--indexUnit u]" << std::endl;
+    std::cout << "  [--curvatures]" << std::endl;
     exit(0);
 }
 
@@ -73,4 +186,16 @@ int main(int argc, char *argv[])
     std::cout << "timeMeshAligning: " << timeMeshAligning << std::endl;
     std::cout << "timeFeatureExtraction: " << timeFeatureExtraction << std::endl;
     std::cout << "timeComparison: " << timeComparison << std::endl;
+
+    int gallerySize = cmdLineParser.getParamValueInt("--gallerySize", ok);
+    if (ok && gallerySize > 0)
+    {
+        int indexUnit = cmdLineParser.getParamValueInt("--indexUnit", ok);
+        benchmarkIdentification(extractor, featureVector, gallerySize, ok ? indexUnit : 0);
+    }
+
+    if (cmdLineParser.hasParam("--curvatures"))
+    {
+        benchmarkCurvatures(inputMesh);
+    }
 }
@@ -140,6 +140,7 @@ void DlgEnroll::on_buttonBox_accepted()
     foreach (const Face::Biometrics::MultiTemplate &t, templates)
     {
         database.scans[id].push_back(t);
+        database.gallery->add(t);
     }
 
     qDebug() << "Added" << id << name << "scans: " << database.scans[id].size();
@@ -26,6 +26,8 @@ FrmKinectMain::FrmKinectMain(QWidget *parent) :
     {
         sensor = launchProps.getSensor();
         extractor = new Face::Biometrics::MultiExtractor(Face::Settings::instance().settingsMap[Face::Settings::MultiExtractorPathKey].convert<std::string>());
+        database.gallery = new Face::Biometrics::GalleryStore(*extractor,
+            Face::Settings::instance().settingsMap[Face::Settings::GalleryPathKey].convert<std::string>());
 		aligner = new Face::FaceData::FaceAlignerLandmark();
 		processor = new Face::FaceData::FaceProcessor(aligner, 0, 0);
 	}
@@ -34,6 +36,16 @@ FrmKinectMain::FrmKinectMain(QWidget *parent) :
         exit(0);
     }
 
+    // references persisted in the gallery store; their scans and names are not stored
+    for (int id : database.gallery->ids())
+    {
+        QString name = QString::number(id);
+        database.mapIdToName[id] = name;
+        database.mapNameToId[name] = id;
+        database.scans[id];
+    }
+    refreshList();
+
     ui->sliderRaw->setValue(0);
 	//importDirectory("C:\\data\\face\\realsense\\eval");
 }
@@ -74,6 +86,7 @@ void FrmKinectMain::importDirectory(const QString &dirPath)
 		database.mapIdToName[id] = name;
 		database.mapNameToId[name] = id;
 		database.scans[id].push_back(templates[i]);
+		database.gallery->add(templates[i]);
 	}
     refreshList();
 }
@@ -113,6 +126,7 @@ void FrmKinectMain::on_btnDelete_clicked()
         database.mapIdToName.erase(id);
         database.mapNameToId.erase(name);
         database.scans.erase(id);
+        database.gallery->remove(id);
         qDeleteAll(ui->listDatabase->selectedItems());
         setMainButtonsState();
     }
@@ -127,12 +141,13 @@ void FrmKinectMain::on_btnIdentify_clicked()
 
     Face::Biometrics::MultiTemplate probe = extractor->extract(m, 0, 0);
 
+    // candidates come sorted by score, so the first one of each id is its best match
     QMap<int, Face::Biometrics::MultiExtractor::ComparisonResult> result;
-    for (const auto &dbEntry : database.scans)
+    for (const auto &candidate : database.gallery->identify(probe, -1))
     {
-        int id = dbEntry.first;
-        const auto &reference = dbEntry.second;
-        result[id] = extractor->compare(reference, probe, 1);
+        Face::Biometrics::MultiExtractor::ComparisonResult &r = result[candidate.id];
+        if (r.perReferenceResults.empty()) r.distance = candidate.result.score;
+        r.perReferenceResults.push_back(candidate.result);
     }
 
     DlgIdentifyResult dlg(result, database, ui->sbRaw->value(), this);
@@ -158,7 +173,20 @@ void FrmKinectMain::on_btnVerify_clicked()
 
     int id = database.mapNameToId[name];
 
-    double score = extractor->compare(database.scans[id], probe, 1).distance;
+    double score = std::numeric_limits<double>::max();
+    if (!database.scans[id].empty())
+    {
+        score = extractor->compare(database.scans[id], probe, 1).distance;
+    }
+    else
+    {
+        for (const auto &candidate : database.gallery->identify(probe, -1))
+        {
+            if (candidate.id != id) continue;
+            score = candidate.result.score;
+            break;
+        }
+    }
     bool accepted = (score < ui->sliderRaw->value());
     QString result =  accepted ? "User " + name + " accepted" : "User " + name + " rejected";
     result.append(". Comparison score: " + QString::number(score));
@@ -6,6 +6,7 @@
 #include <QMap>
 
 #include "faceCommon/biometrics/multiextractor.h"
+#include "faceCommon/biometrics/gallerystore.h"
 #include "faceCommon/facedata/facealigner.h"
 #include "faceCommon/facedata/faceprocessor.h"
 #include "faceSensors/isensor.h"
@@ -24,6 +25,7 @@ public:
         std::map<int, QString> mapIdToName;
         std::map<QString, int> mapNameToId;
         std::map<int, std::vector<Face::Biometrics::MultiTemplate>> scans;
+        Face::Biometrics::GalleryStore::Ptr gallery;
     };
 
     explicit FrmKinectMain(QWidget *parent = 0);
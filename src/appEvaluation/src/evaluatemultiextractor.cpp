@@ -29,23 +29,37 @@ void EvaluateMultiExtractor::evaluateFRGCextractor()
     std::vector<std::string> files = Face::LinAlg::Loader::listFiles(frgcPath, "*.binz", Face::LinAlg::Loader::Filename);
     MultiExtractor extractor("../../test/frgcExtractor-master");
 
+    // parts 3..5 are the folds; scans of all of them are loaded in one parallel loop
+    std::vector<std::pair<int, int> > scans; // (fold, index in the fold)
+    std::vector<std::vector<MultiTemplate> > folds;
     for (int part = 3; part <= 5; part++)
     {
-        std::vector<MultiTemplate> testTemplates(FRGCUtils::Spring2004::partSize(part));
-
         int n = FRGCUtils::Spring2004::partSize(part);
-        int start = FRGCUtils::Spring2004::partStart(part);
-
-        #pragma omp parallel for
         for (int i = 0; i < n; i++)
         {
-            int id = Poco::NumberParser::parse(Poco::StringTokenizer(files[i + start], "d")[0]);
-            auto mesh = Mesh::fromFile(frgcPath + files[i + start]);
-            testTemplates[i] = extractor.extract(mesh, 1, id);
+            scans.push_back(std::make_pair((int)folds.size(), i));
         }
-        auto evaluationResult = extractor.evaluate(testTemplates);
-        evaluationResult.printStats();
+        folds.push_back(std::vector<MultiTemplate>(n));
+    }
+
+    int scanCount = scans.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < scanCount; s++)
+    {
+        int fold = scans[s].first;
+        int i = scans[s].second;
+        int fileIndex = FRGCUtils::Spring2004::partStart(fold + 3) + i;
+        int id = Poco::NumberParser::parse(Poco::StringTokenizer(files[fileIndex], "d")[0]);
+        auto mesh = Mesh::fromFile(frgcPath + files[fileIndex]);
+        folds[fold][i] = extractor.extract(mesh, 1, id);
+    }
+
+    BatchEvaluationResult evaluationResult = extractor.evaluate(folds);
+    for (const Evaluation &e : evaluationResult.results)
+    {
+        e.printStats();
     }
+    std::cout << "mean EER: " << evaluationResult.meanEER << "; std. dev.: " << evaluationResult.stdDevOfEER << std::endl;
 }
 
 void EvaluateMultiExtractor::evaluateFRGCUnits()
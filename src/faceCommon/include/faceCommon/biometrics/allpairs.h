@@ -0,0 +1,222 @@
+#ifndef ALLPAIRS_H
+#define ALLPAIRS_H
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include "faceCommon/linalg/common.h"
+#include "faceCommon/biometrics/scorehistogram.h"
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * Multithreaded all-pairs scoring of n templates with given subject ids.
+ *
+ * The upper triangle of the score matrix is split into square tiles that are scored in
+ * parallel. Every pair (i < j) has a fixed slot in the preallocated genuine or impostor
+ * array, equal to its position in the serial i-j loop, so the output doesn't depend on
+ * the thread scheduling.
+ */
+class FACECOMMON_EXPORTS AllPairs
+{
+public:
+    AllPairs(const std::vector<int> &ids, int tileSize = 64);
+
+    int size() const { return ids.size(); }
+    long long genuineCount() const { return genuineTotal; }
+    long long impostorCount() const { return impostorTotal; }
+
+    bool isGenuine(int i, int j) const { return ids[i] == ids[j]; }
+
+    // slot of pair i < j in the genuine or impostor array
+    long long index(int i, int j) const;
+
+    /**
+     * Calls score(i, j) for every pair i < j and stores the results.
+     * An exception thrown by the score function is rethrown after all threads finish.
+     */
+    template <class ScoreFunction>
+    void compute(ScoreFunction score, std::vector<double> &genuineScores, std::vector<double> &impostorScores) const
+    {
+        computeBlocks([&](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+        {
+            for (int i = iStart; i < iEnd; i++)
+            {
+                for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+                {
+                    scores(i - iStart, j - jStart) = score(i, j);
+                }
+            }
+        }, genuineScores, impostorScores);
+    }
+
+    /**
+     * Like compute(), but block(iStart, iEnd, jStart, jEnd, scores) scores a whole tile at once
+     * into the preallocated (iEnd-iStart) x (jEnd-jStart) matrix; only entries with j > i are used.
+     */
+    template <class BlockFunction>
+    void computeBlocks(BlockFunction block, std::vector<double> &genuineScores, std::vector<double> &impostorScores) const
+    {
+        genuineScores.assign(genuineTotal, 0.0);
+        impostorScores.assign(impostorTotal, 0.0);
+
+        int tileCount = tilePairs.size();
+        std::string error;
+        #pragma omp parallel for schedule(dynamic)
+        for (int t = 0; t < tileCount; t++)
+        {
+            try
+            {
+                computeTile(t, block, genuineScores, impostorScores);
+            }
+            catch (std::exception &e)
+            {
+                #pragma omp critical
+                error = e.what();
+            }
+        }
+
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    /**
+     * Like compute(), but the scores are only counted in the genuine and impostor histograms,
+     * so the memory doesn't grow with the number of pairs
+     */
+    template <class ScoreFunction>
+    void accumulate(ScoreFunction score, ScoreHistogram &genuine, ScoreHistogram &impostor) const
+    {
+        accumulateBlocks([&](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+        {
+            for (int i = iStart; i < iEnd; i++)
+            {
+                for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+                {
+                    scores(i - iStart, j - jStart) = score(i, j);
+                }
+            }
+        }, genuine, impostor);
+    }
+
+    /**
+     * Like computeBlocks(), but the scores are only counted in the genuine and impostor histograms.
+     * Every thread fills its own histograms that are merged at the end.
+     */
+    template <class BlockFunction>
+    void accumulateBlocks(BlockFunction block, ScoreHistogram &genuine, ScoreHistogram &impostor) const
+    {
+        int tileCount = tilePairs.size();
+        std::string error;
+        #pragma omp parallel
+        {
+            ScoreHistogram threadGenuine;
+            ScoreHistogram threadImpostor;
+
+            #pragma omp for schedule(dynamic)
+            for (int t = 0; t < tileCount; t++)
+            {
+                try
+                {
+                    accumulateTile(t, block, threadGenuine, threadImpostor);
+                }
+                catch (std::exception &e)
+                {
+                    #pragma omp critical
+                    error = e.what();
+                }
+            }
+
+            #pragma omp critical
+            {
+                genuine.merge(threadGenuine);
+                impostor.merge(threadImpostor);
+            }
+        }
+
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    // tiles scored by computeBlocks() and accumulateBlocks()
+    int tileCount() const { return tilePairs.size(); }
+
+    // scores of the given tile stored in their slots of the arrays sized by computeBlocks()
+    template <class BlockFunction>
+    void computeTile(int tile, BlockFunction block, std::vector<double> &genuineScores, std::vector<double> &impostorScores) const
+    {
+        int n = ids.size();
+        int iStart = tilePairs[tile].first * tileSize;
+        int iEnd = std::min(n, iStart + tileSize);
+        int jStart = tilePairs[tile].second * tileSize;
+        int jEnd = std::min(n, jStart + tileSize);
+
+        Matrix scores(iEnd - iStart, jEnd - jStart);
+        block(iStart, iEnd, jStart, jEnd, scores);
+
+        for (int i = iStart; i < iEnd; i++)
+        {
+            int j = std::max(jStart, i + 1);
+            if (j >= jEnd) continue;
+
+            long long genuine = genuineRowStart[i] + sameIdBefore(i, j);
+            long long impostor = impostorRowStart[i] + (j - i - 1) - sameIdBefore(i, j);
+            for (; j < jEnd; j++)
+            {
+                double s = scores(i - iStart, j - jStart);
+                if (ids[i] == ids[j])
+                    genuineScores[genuine++] = s;
+                else
+                    impostorScores[impostor++] = s;
+            }
+        }
+    }
+
+    // scores of the given tile counted in the histograms
+    template <class BlockFunction>
+    void accumulateTile(int tile, BlockFunction block, ScoreHistogram &genuine, ScoreHistogram &impostor) const
+    {
+        int n = ids.size();
+        int iStart = tilePairs[tile].first * tileSize;
+        int iEnd = std::min(n, iStart + tileSize);
+        int jStart = tilePairs[tile].second * tileSize;
+        int jEnd = std::min(n, jStart + tileSize);
+
+        Matrix scores(iEnd - iStart, jEnd - jStart);
+        block(iStart, iEnd, jStart, jEnd, scores);
+
+        for (int i = iStart; i < iEnd; i++)
+        {
+            for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+            {
+                double s = scores(i - iStart, j - jStart);
+                if (ids[i] == ids[j])
+                    genuine.add(s);
+                else
+                    impostor.add(s);
+            }
+        }
+    }
+
+private:
+    std::vector<int> ids;
+    int tileSize;
+    std::vector<std::pair<int, int> > tilePairs; // tiles (a, b), a <= b, of the upper triangle
+
+    std::vector<int> rank;                        // position of the template among templates of the same subject
+    std::vector<std::vector<int> > subjectIndexes; // template indexes of each subject, indexed by subjectSlot
+    std::vector<int> subjectSlot;
+    std::vector<long long> genuineRowStart;
+    std::vector<long long> impostorRowStart;
+    long long genuineTotal;
+    long long impostorTotal;
+
+    // number of templates of the same subject as i with index in (i, j)
+    int sameIdBefore(int i, int j) const;
+};
+
+}
+}
+
+#endif // ALLPAIRS_H
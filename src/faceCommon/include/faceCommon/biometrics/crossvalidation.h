@@ -0,0 +1,49 @@
+#ifndef CROSSVALIDATION_H
+#define CROSSVALIDATION_H
+
+#include <functional>
+
+#include "faceCommon/biometrics/allpairs.h"
+#include "faceCommon/biometrics/evaluation.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * Evaluation of several cross-validation folds at once.
+ *
+ * The all-pairs tiles of all folds are scored by one parallel loop, so the folds share the
+ * OpenMP threads (OMP_NUM_THREADS) and a small fold doesn't leave them idle. Scores of a fold
+ * are kept for the exact evaluation unless the fold has more than exactPairLimit pairs; those
+ * are streamed into histograms instead, see ScoreHistogram.
+ */
+class FACECOMMON_EXPORTS CrossValidation
+{
+public:
+    // block(iStart, iEnd, jStart, jEnd, scores) as in AllPairs::computeBlocks()
+    typedef std::function<void(int, int, int, int, Matrix &)> BlockFunction;
+
+    void addFold(const std::vector<int> &ids, BlockFunction block, int tileSize = 64);
+
+    int foldCount() const { return folds.size(); }
+
+    // exactPairLimit 0 streams the scores of all folds
+    BatchEvaluationResult evaluate(long long exactPairLimit = Evaluation::defaultExactPairLimit) const;
+
+private:
+    struct Fold
+    {
+        Fold(const std::vector<int> &ids, BlockFunction block, int tileSize) : pairs(ids, tileSize), block(block) {}
+
+        AllPairs pairs;
+        BlockFunction block;
+    };
+
+    std::vector<Fold> folds;
+};
+
+}
+}
+
+#endif // CROSSVALIDATION_H
@@ -4,6 +4,7 @@
 #include <map>
 
 #include "faceCommon/linalg/metrics.h"
+#include "faceCommon/biometrics/scorehistogram.h"
 #include "faceCommon/faceCommon.h"
 
 namespace Face {
@@ -21,6 +22,21 @@ private:
     void commonTemplatesEvaluation(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics);
     void commonInit();
     void commonInitOfScores();
+    void commonInitOfRanges();
+    void histogramEvaluation();
+
+    // scores sorted in ascending order of distance (similarities are negated)
+    std::vector<double> sortedGenuineScores;
+    std::vector<double> sortedImpostorScores;
+    double orientation() const { return scoreType == SCORE_SIMILARITY ? -1.0 : 1.0; }
+
+    // streamed scores, used when the score lists are not available
+    ScoreHistogram genuineHistogram;
+    ScoreHistogram impostorHistogram;
+    std::vector<int> histogramEdges() const;
+    void histogramRates(long long genuineBelow, long long impostorBelow, double &outFnmr, double &outFmr) const;
+
+    bool hasScores() const;
 
 public:
     enum SCORE_TYPE { SCORE_UNKNOWN, SCORE_DISTANCE, SCORE_SIMILARITY};
@@ -38,6 +54,7 @@ public:
     std::vector<double> genuineScores;
     std::vector<double> impostorScores;
 
+    // DET curve sampled at evenly spaced thresholds for plotting, see sampleDET()
     std::vector<double> fmr;
     std::vector<double> fnmr;
     std::vector<double> distances;
@@ -45,6 +62,9 @@ public:
     double eer;
     double eerScore;
 
+    // bound of the absolute error of eer; 0 unless evaluated from histograms
+    double eerErrorBound;
+
     Evaluation();
 
     Evaluation(const std::vector<double> &genuineScores, const std::vector<double> &impostorScores);
@@ -53,12 +73,32 @@ public:
 
     Evaluation(std::map<std::pair<int, int>, std::vector<double> > &distances);
 
+    /**
+     * Evaluation of streamed scores; the score lists stay empty and the error rates are
+     * evaluated at the bucket edges of the histograms
+     */
+    Evaluation(const ScoreHistogram &genuineHistogram, const ScoreHistogram &impostorHistogram);
+
     Evaluation(const std::vector<Face::LinAlg::Vector> &rawData, const std::vector<int> &classes,
                const Face::Biometrics::FeatureExtractor &extractor, const Face::LinAlg::Metrics &metric);
 
 
+    /**
+     * Exact error rates; a distance is accepted if it is below the threshold distance,
+     * a similarity if it is above it. Evaluations of histograms round the threshold distance
+     * down to a bucket edge, see ScoreHistogram.
+     */
     void fnmrAndFmrAtDistance(const double inDistance, double &outFnmr, double &outFmr) const;
     void fnmrAtFmr(const double inFmr, double &outFnmr, double &outDistance) const;
+
+    // outErrorBound bounds the absolute error of outFnmr; it is 0 unless evaluated from histograms
+    void fnmrAtFmr(const double inFmr, double &outFnmr, double &outDistance, double &outErrorBound) const;
+
+    /**
+     * Fills fmr, fnmr and distances with the exact error rates at given number of thresholds
+     * evenly spaced between minScore and maxScore
+     */
+    void sampleDET(int points);
     void printStats() const;
 
     void outputResults(const std::string &path, int histogramBins) const;
@@ -70,10 +110,26 @@ public:
     void outputResultsFMR(const std::string &path) const;
     void outputResultsFNMR(const std::string &path) const;
 
-    static BatchEvaluationResult batch(std::vector<std::vector<Template> > &templates, const Face::LinAlg::Metrics &metrics, int startIndex = 0);
+    /**
+     * Counts the scores of all template pairs in the histograms without storing them;
+     * histograms of several runs can be merged and evaluated at once
+     */
+    static void accumulate(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics,
+                           ScoreHistogram &genuineHistogram, ScoreHistogram &impostorHistogram);
+
+    // folds with more scores are evaluated from histograms by batch(), 200 MB of scores per fold
+    static const long long defaultExactPairLimit = 25000000;
+
+    /**
+     * Exact evaluation of every fold; folds with more than exactPairLimit template pairs
+     * (0 for all of them) are evaluated from streamed histograms, see CrossValidation
+     */
+    static BatchEvaluationResult batch(std::vector<std::vector<Template> > &templates, const Face::LinAlg::Metrics &metrics, int startIndex = 0,
+                                       long long exactPairLimit = defaultExactPairLimit);
 
     static BatchEvaluationResult batch(std::vector<std::vector<Face::LinAlg::Vector> > &images, std::vector<std::vector<int> > &classes,
-                                       const Face::Biometrics::FeatureExtractor &extractor, const Face::LinAlg::Metrics &metrics, int startIndex = 0);
+                                       const Face::Biometrics::FeatureExtractor &extractor, const Face::LinAlg::Metrics &metrics, int startIndex = 0,
+                                       long long exactPairLimit = defaultExactPairLimit);
 };
 
 class BatchEvaluationResult
@@ -0,0 +1,155 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+#include <limits>
+#include <cstdint>
+
+#include "faceCommon/linalg/common.h"
+#include "faceCommon/linalg/hnswindex.h"
+#include "faceCommon/biometrics/multiextractor.h"
+#include "faceCommon/biometrics/multitemplate.h"
+#include "faceCommon/biometrics/scorelevefusion.h"
+
+namespace Poco {
+class SharedMemory;
+}
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * Enrolled reference templates of a MultiExtractor stored for fast 1:N identification.
+ * Feature vectors of each unit are stacked into one contiguous matrix (one row per
+ * template, row stride padded to a multiple of 4 values), so the probe is compared
+ * with the whole gallery unit by unit without per-template allocations. Rows are kept
+ * in the form prepared by the unit metrics (see Metrics::prepare). Units with a quantizer
+ * keep the rows as int8 or float16 codes instead (see Face::LinAlg::Quantizer).
+ */
+class FACECOMMON_EXPORTS Gallery
+{
+public:
+    typedef cv::Ptr<Gallery> Ptr;
+
+    struct Candidate
+    {
+        Candidate() : index(-1), id(-1) {}
+        int index;
+        int id;
+        ScoreLevelFusionBase::Result result;
+    };
+
+    Gallery(const MultiExtractor &extractor);
+    ~Gallery();
+
+    void add(const MultiTemplate &reference);
+    void add(const std::vector<MultiTemplate> &references);
+    int remove(int id);
+
+    // throws if add() would refuse the template
+    void checkTemplate(const MultiTemplate &t) const;
+
+    void clear();
+
+    int size() const { return count; }
+    int id(int index) const { return ids[index]; }
+    float depthCoverage(int index) const { return depthCoverages[index]; }
+
+    /**
+     * Versioned binary gallery file (see gallery.cpp for the layout). deserialize() maps the
+     * file read-only and uses the feature blocks in place, without parsing or copying them;
+     * the rows are copied into memory only when the gallery is modified. The stored rows are
+     * in the prepared form, so the file can be loaded only with the same extractor.
+     * The sequence number is stored in the header as is and returned by deserialize(),
+     * GalleryStore keeps there the last log record the snapshot contains.
+     */
+    void serialize(const std::string &path, int64_t sequence = 0) const;
+    int64_t deserialize(const std::string &path);
+
+    // converts MultiTemplate files (cv::FileStorage YAML/XML) to a binary gallery file
+    static void convertTemplates(const MultiExtractor &extractor, const std::vector<std::string> &templatePaths,
+                                 const std::string &galleryPath);
+
+    /**
+     * Per-unit distances of the probe to every enrolled template (size() x units matrix)
+     */
+    Matrix score(const MultiTemplate &probe) const;
+
+    /**
+     * score() of several probes at once; units with dot-decomposable metrics (see
+     * Metrics::isDotDecomposable) are scored by a single matrix multiplication
+     */
+    std::vector<Matrix> score(const std::vector<MultiTemplate> &probes) const;
+
+    /**
+     * topK best matching templates sorted by fused score, best first; topK <= 0 returns all
+     */
+    std::vector<Candidate> identify(const MultiTemplate &probe, int topK = 1) const;
+    std::vector<std::vector<Candidate> > identify(const std::vector<MultiTemplate> &probes, int topK = 1) const;
+
+    /**
+     * Same candidates as identify() with fused score <= threshold, but the units are evaluated
+     * one by one and a template is dropped as soon as its fused score can't reach the top-K or
+     * the threshold. Needs a fusion with linear form (weighted sum, sum, LDA), other fusions
+     * fall back to identify().
+     */
+    std::vector<Candidate> identifyCascade(const MultiTemplate &probe, int topK = 1,
+                                           double threshold = std::numeric_limits<double>::max()) const;
+
+    /**
+     * Approximate nearest neighbour index (see Face::LinAlg::HnswIndex) over the prepared vectors
+     * of one unit. Once built, it is kept up to date by add() and remove().
+     */
+    void buildIndex(int unit, int m = 16, int efConstruction = 200);
+    bool hasIndex() const { return !index.empty(); }
+
+    // index file stored in the given directory, e.g. next to the serialized extractor
+    void serializeIndex(std::string directoryPath) const;
+    void deserializeIndex(std::string directoryPath);
+
+    /**
+     * identify() restricted to the shortlist of the nearest templates in the indexed unit,
+     * which is re-ranked with the full fusion. Falls back to identify() without the index.
+     */
+    std::vector<Candidate> identifyApproximate(const MultiTemplate &probe, int topK = 1, int shortlist = 100) const;
+
+private:
+    struct PreparedProbe
+    {
+        std::vector<std::vector<double> > values;
+        std::vector<std::vector<unsigned char> > codes; // quantized units only
+    };
+
+    const MultiExtractor &extractor;
+    std::vector<Matrix> blocks;
+    std::vector<cv::Mat> codes;                            // rows of the quantized units
+    std::vector<Face::LinAlg::Quantizer::Ptr> quantizers;  // empty for units stored as doubles
+    std::vector<int> lengths;
+    std::vector<int> strides;
+    std::vector<std::vector<double> > squaredNorms; // squared norms of the prepared rows of each unit
+    std::vector<int> ids;
+    std::vector<int> serials;                            // enrollment order numbers, labels of the index
+    std::vector<float> depthCoverages;
+    cv::Ptr<Poco::SharedMemory> mapping;                 // gallery file the blocks point into
+    Face::LinAlg::HnswIndex::Ptr index;
+    int indexUnit;
+    int nextSerial;
+    int capacity;
+    int count;
+    int version;
+
+    bool isQuantized(int unit) const { return !quantizers[unit].empty(); }
+    int maxLength() const;
+    std::vector<double> preparedRow(int unit, int row) const;
+
+    void reserve(int newCapacity);
+    void detach();
+    PreparedProbe prepareProbe(const MultiTemplate &probe) const;
+    double distance(int unit, const PreparedProbe &probe, int index, double *buffer) const;
+    std::vector<Candidate> best(const Matrix &scores, int topK) const;
+    Candidate candidate(const PreparedProbe &preparedProbe, int index) const;
+};
+
+}
+}
+
+#endif // GALLERY_H
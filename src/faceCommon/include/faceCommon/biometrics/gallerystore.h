@@ -0,0 +1,98 @@
+#ifndef GALLERYSTORE_H
+#define GALLERYSTORE_H
+
+#include <cstdio>
+#include <atomic>
+#include <Poco/Mutex.h>
+#include <Poco/RWLock.h>
+#include <Poco/Thread.h>
+#include <Poco/RunnableAdapter.h>
+
+#include "faceCommon/biometrics/gallery.h"
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * Persistent gallery in a directory: the binary snapshot "gallery" (see Gallery::serialize)
+ * and the append-only log "gallery.log" of enrollments and tombstones written after it.
+ * Every change is checked, appended to the log and only then applied to the in-memory gallery,
+ * the snapshot itself is rewritten only by compaction. Opening the store loads the snapshot and
+ * replays the log; a torn record at the end of the log (crash during the write) is dropped.
+ *
+ * Log records are numbered from the epoch in the log header, the snapshot stores the number of
+ * the last record it contains. Records the snapshot already has (a crash between writing the
+ * snapshot and truncating the log) are skipped on replay.
+ *
+ * Identification runs concurrently with compaction; add() and remove() wait for it.
+ */
+class FACECOMMON_EXPORTS GalleryStore
+{
+public:
+    typedef cv::Ptr<GalleryStore> Ptr;
+
+    /**
+     * Sync waits until every record and snapshot reaches the disk (fsync), so the changes
+     * survive a power loss. Flush only hands the records to the operating system, which
+     * keeps them on a crash of the process but not of the machine.
+     */
+    enum Durability { Flush, Sync };
+
+    GalleryStore(const MultiExtractor &extractor, std::string directoryPath, int compactionThreshold = 10000,
+                 Durability durability = Sync);
+    ~GalleryStore();
+
+    void add(const MultiTemplate &reference);
+    int remove(int id);
+
+    int size() const;
+    std::vector<int> ids() const;
+    int logRecords() const { return records; }
+
+    std::vector<Gallery::Candidate> identify(const MultiTemplate &probe, int topK = 1) const;
+    std::vector<Gallery::Candidate> identifyCascade(const MultiTemplate &probe, int topK = 1,
+                                                    double threshold = std::numeric_limits<double>::max()) const;
+
+    /**
+     * Writes the current gallery as a new snapshot and truncates the log. compactAsync() runs it
+     * in a background thread; it is started automatically once the log has compactionThreshold
+     * records (0 disables that).
+     */
+    void compact();
+    void compactAsync();
+    void waitForCompaction();
+
+private:
+    enum RecordType { RecordAdd = 1, RecordRemove = 2 };
+
+    const MultiExtractor &extractor;
+    std::string snapshotPath;
+    std::string logPath;
+    int compactionThreshold;
+    Durability durability;
+    std::atomic<int> records;       // records in the log file
+    int64_t sequence;               // number of the last change applied to the gallery
+
+    Gallery gallery;
+    FILE *log;
+
+    mutable Poco::RWLock galleryLock;   // gallery content
+    Poco::FastMutex writeMutex;         // log file and the order of changes
+    Poco::FastMutex compactionMutex;    // start and join of the compaction thread
+    Poco::Thread compactionThread;
+    Poco::RunnableAdapter<GalleryStore> compactionRunnable;
+    std::string compactionError;
+    bool compactionStarted;             // started and not joined yet
+
+    void replayLog(int64_t snapshotSequence);
+    void openLog(bool truncate);
+    void closeLog();
+    void appendRecord(int type, int id, const std::vector<char> &payload);
+    void runCompaction();
+    void joinCompaction();              // with compactionMutex locked
+};
+
+}
+}
+
+#endif // GALLERYSTORE_H
@@ -0,0 +1,39 @@
+#ifndef IMAGEDATACACHE_H
+#define IMAGEDATACACHE_H
+
+#include "faceCommon/biometrics/multiextractor.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * On-disk cache of MultiExtractor::ImageData computed from mesh files.
+ *
+ * An entry is keyed by the hash of the mesh file content and of ImageData::parameters(), so a changed
+ * mesh or changed preprocessing simply misses the cache. Entries are binary files in host byte order
+ * holding typeDict, largeDepth and depthConverter; unreadable entries are recomputed and rewritten.
+ * It is safe to use the cache from several threads or processes at once.
+ */
+class FACECOMMON_EXPORTS ImageDataCache
+{
+public:
+    ImageDataCache(const std::string &directory);
+
+    // ImageData of the mesh file, computed and stored if it is not cached yet
+    MultiExtractor::ImageData get(const std::string &meshPath) const;
+
+    static unsigned long long key(const std::string &meshPath);
+
+private:
+    std::string directory;
+
+    std::string entryPath(unsigned long long key) const;
+    bool load(unsigned long long key, MultiExtractor::ImageData &data) const;
+    void store(unsigned long long key, const MultiExtractor::ImageData &data) const;
+};
+
+}
+}
+
+#endif // IMAGEDATACACHE_H
@@ -27,6 +27,7 @@ class ImageDataThreadPool : public Poco::ThreadPool
     class DepthAndCurvatureThread : public Poco::Runnable
     {
         const Face::FaceData::Mesh *mesh;
+        const std::set<std::string> *types;
 
     public:
         Matrix depth;
@@ -35,7 +36,7 @@ class ImageDataThreadPool : public Poco::ThreadPool
         Matrix index;
         Matrix eigencur;
 
-        void setUp(const Face::FaceData::Mesh *mesh);
+        void setUp(const Face::FaceData::Mesh *mesh, const std::set<std::string> *types);
         void run();
     };
 
@@ -57,7 +58,8 @@ class ImageDataThreadPool : public Poco::ThreadPool
 
 public:
 
-    MultiExtractor::ImageData process(const FaceData::Mesh *mesh);
+    // only the given types are computed, see MultiExtractor::ImageData
+    MultiExtractor::ImageData process(const FaceData::Mesh *mesh, const std::set<std::string> &types);
 
 };
 
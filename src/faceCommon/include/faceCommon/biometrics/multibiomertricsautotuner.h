@@ -29,8 +29,10 @@ public:
         std::vector<int> ids;
 
         static Input fromAlignedMeshes(const std::vector<int> &ids, const std::vector<FaceData::Mesh> meshes);
+        // image data are taken from/stored to the ImageDataCache in cacheDirectory if it is given
         static Input fromDirectoryWithAlignedMeshes(const std::string &path, const std::string &idAndScanSeparator,
-                                                    int maxCount = -1, int startIndex = 0);
+                                                    int maxCount = -1, int startIndex = 0,
+                                                    const std::string &cacheDirectory = std::string());
 
         static Input fromDirectoryWithTextureImages(const std::string &path, const std::string& idAndScanSeparator,
                                                     int maxCount = -1, int startIndex = 0);
@@ -41,10 +43,22 @@ public:
         std::string fusionType;
         std::vector<std::string> params;
 
+        // if not None, quantizers of the trained units are learned and verified, see quantize()
+        Face::LinAlg::Quantizer::Type quantizerType;
+
         Settings();
         Settings(const std::string &fusionType, const std::string &unitsParametersFile);
     };
 
+    struct FACECOMMON_EXPORTS QuantizationResult
+    {
+        std::string unit;
+        double baselineEer;
+        double quantizedEer;
+        int bytes;          // size of the feature vector as doubles
+        int quantizedBytes;
+    };
+
     static void fillEvaluations(const Input &sourceDatabaseTrainData, const Input &targetDatabaseTrainData,
                                 const Settings &settings, std::vector<Evaluation> &evaluations);
 
@@ -60,6 +74,13 @@ public:
                                                const Input &targetDatabaseTrainData, std::vector<Evaluation> &evaluations,
                                                int index);
 
+    /**
+     * Learns a quantizer of every unit from the prepared feature vectors of the training data
+     * and verifies it: the EER of each unit is measured with the double and the quantized vectors
+     */
+    static std::vector<QuantizationResult> quantize(MultiExtractor &extractor, const Input &trainData,
+                                                    Face::LinAlg::Quantizer::Type type);
+
 
 
 };
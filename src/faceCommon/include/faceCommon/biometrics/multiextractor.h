@@ -1,9 +1,12 @@
 #ifndef MULTIEXTRACTOR_H
 #define MULTIEXTRACTOR_H
 
+#include <set>
+
 #include "faceCommon/linalg/common.h"
 #include "faceCommon/linalg/vector.h"
 #include "faceCommon/linalg/imagefilter.h"
+#include "faceCommon/linalg/quantizer.h"
 #include "faceCommon/facedata/mesh.h"
 #include "faceCommon/facedata/surfaceprocessor.h"
 #include "faceCommon/biometrics/filterfeatureextractor.h"
@@ -36,11 +39,22 @@ public:
         Face::FaceData::Map largeDepth;
         Face::FaceData::MapConverter depthConverter;
 
+        // name of largeDepth and depthConverter in the sets of types
+        static const std::string largeDepthType;
+
         ImageData() { }
         ImageData(const FaceData::Mesh &mesh);
+
+        // only the given types are computed, e.g. MultiExtractor::requiredTypes()
+        ImageData(const FaceData::Mesh &mesh, const std::set<std::string> &types);
         ImageData(const ImageGrayscale &textureImage);
 
         static std::vector<std::string> getTypes();
+        static std::set<std::string> getAllTypes();
+
+        // version and values of the preprocessing done by ImageData(mesh), part of the ImageDataCache
+        // key; a changed preprocessing invalidates the cached entries
+        static std::string parameters();
     };
 
 	class FACECOMMON_EXPORTS Unit
@@ -52,10 +66,16 @@ public:
         Face::LinAlg::Metrics::Ptr metrics;
         FeatureExtractor::Ptr featureExtractor;
 
+        // optional compact storage of the prepared feature vectors in the Gallery
+        Face::LinAlg::Quantizer::Ptr quantizer;
+
         static Unit::Ptr parse(const std::string &params);
         virtual std::string writeParams() const = 0;
         virtual void train(const std::vector<int> &ids, const std::vector<ImageData> &imageData) = 0;
         virtual Face::LinAlg::Vector extract(const ImageData &data) const = 0;
+
+        // ImageData type the unit extracts from
+        virtual std::string requiredType() const = 0;
         double compare(const Face::LinAlg::Vector &first, const Face::LinAlg::Vector &second);
     };
 
@@ -69,6 +89,7 @@ public:
         std::string writeParams() const;
         void train(const std::vector<int> &ids, const std::vector<ImageData> &imageData);
         Face::LinAlg::Vector extract(const ImageData &data) const;
+        std::string requiredType() const { return type; }
     };
 
     class CurveUnit : public Unit
@@ -82,6 +103,7 @@ public:
         std::string writeParams() const;
         void train(const std::vector<int> &ids, const std::vector<ImageData> &imageData);
         Face::LinAlg::Vector extract(const ImageData &data) const;
+        std::string requiredType() const { return ImageData::largeDepthType; }
     };
 
     struct ComparisonResult
@@ -103,6 +125,9 @@ public:
 
     void serialize(std::string directoryPath) const;
 
+    // ImageData types used by the units; depth is always included for the depth coverage of templates
+    std::set<std::string> requiredTypes() const;
+
     MultiTemplate extract(const ImageData &data, int version, int id) const;
     MultiTemplate extract(const FaceData::Mesh &mesh, int version, int id) const;
     std::vector<MultiTemplate> extract(const std::vector<FaceData::Mesh> &meshes, const std::vector<int> &ids, int version) const;
@@ -112,6 +137,11 @@ public:
     ComparisonResult compare(const std::vector<MultiTemplate> &reference, const MultiTemplate &probe, int count = -1) const;
 
     Evaluation evaluate(const std::vector<MultiTemplate> &templates) const;
+
+    // all folds evaluated at once, see CrossValidation
+    BatchEvaluationResult evaluate(const std::vector<std::vector<MultiTemplate> > &folds,
+                                   long long exactPairLimit = Evaluation::defaultExactPairLimit) const;
+
     double rankOneIdentification(const std::vector<MultiTemplate> &templates) const;
     void createPerSubjectScoreCharts(const std::vector<MultiTemplate> &templates, const std::string &pathPrefix) const;
 };
@@ -0,0 +1,60 @@
+#ifndef SCOREHISTOGRAM_H
+#define SCOREHISTOGRAM_H
+
+#include <vector>
+
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace Biometrics {
+
+/**
+ * Streaming histogram of scores with bounded memory.
+ *
+ * A score is counted in the bucket given by its sign, exponent and the highest mantissaBits
+ * bits of its mantissa, so the buckets keep the order of the scores and every bucket edge is
+ * within a relative distance of 2^-mantissaBits from the scores in the bucket, whatever the
+ * score range is. Buckets are allocated in pages of one exponent when first used.
+ *
+ * Adding scores is not thread safe; threads fill their own histograms which are merged.
+ */
+class FACECOMMON_EXPORTS ScoreHistogram
+{
+public:
+    enum { mantissaBits = 10, pageSize = 1 << mantissaBits, pageCount = 1 << 12 };
+
+    ScoreHistogram();
+
+    void add(double score);
+    void merge(const ScoreHistogram &other);
+
+    long long count() const { return total; }
+    double minValue() const { return minScore; }
+    double maxValue() const { return maxScore; }
+    double meanValue() const { return total > 0 ? sum / total : 0.0; }
+
+    // buckets are numbered in the ascending order of the scores
+    static int bucket(double score);
+    static double lowerEdge(int bucket);
+
+    long long bucketCount(int bucket) const;
+
+    // number of scores in buckets before the given one, i.e. below its lower edge
+    long long countBelow(int bucket) const;
+
+    // non-empty buckets in ascending order
+    std::vector<int> buckets() const;
+
+private:
+    std::vector<std::vector<long long> > pages;
+    std::vector<long long> pageTotals;
+    long long total;
+    double minScore;
+    double maxScore;
+    double sum;
+};
+
+}
+}
+
+#endif // SCOREHISTOGRAM_H
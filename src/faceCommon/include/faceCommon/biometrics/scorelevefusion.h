@@ -26,6 +26,9 @@ protected:
 
     virtual void learnImplementation() = 0;
 
+    // fuseBatch() of fusions with a linear form
+    std::vector<double> fuseLinear(const Matrix &scores) const;
+
     ScoreLevelFusionBase() : scoreNormalizer(new ScoreNormalizerPass()) { learned = false; }
 
 public:
@@ -47,6 +50,17 @@ public:
 
     virtual Result fuse(const std::vector<double> &scores) const = 0;
 
+    /**
+     * Fused score of every row of the pairs x units score matrix, equal to fuse(row).score
+     */
+    virtual std::vector<double> fuseBatch(const Matrix &scores) const = 0;
+
+    /**
+     * Fills the fused score of count components as bias + sum(weights[i] * normalized[i]).
+     * Returns false if the fusion has no such linear form.
+     */
+    virtual bool linearForm(unsigned int /*count*/, std::vector<double> &/*weights*/, double &/*bias*/) const { return false; }
+
     virtual void serialize(const std::string &path) const = 0;
 
     virtual void deserialize(const std::string &path) = 0;
@@ -79,6 +93,8 @@ private:
 public:
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
+    bool linearForm(unsigned int count, std::vector<double> &weights, double &bias) const;
     void serialize(const std::string &path) const;
     void deserialize(const std::string &path);
 
@@ -94,6 +110,7 @@ private:
 public:
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
     void serialize(const std::string &path) const;
     void deserialize(const std::string &path);
 
@@ -110,6 +127,8 @@ private:
 public:
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
+    bool linearForm(unsigned int count, std::vector<double> &weights, double &bias) const;
 
     void serialize(const std::string &path) const;
     void deserialize(const std::string &path);
@@ -123,6 +142,8 @@ class FACECOMMON_EXPORTS ScoreSumFusion : public ScoreLevelFusionBase
 public:
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
+    bool linearForm(unsigned int count, std::vector<double> &weights, double &bias) const;
 
     void serialize(const std::string &path) const;
     void deserialize(const std::string &path);
@@ -137,6 +158,7 @@ class FACECOMMON_EXPORTS ScoreProductFusion : public ScoreLevelFusionBase
 public:
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
     void serialize(const std::string &path) const;
     void deserialize(const std::string &path);
 
@@ -158,6 +180,7 @@ private:
 public:   
     void learnImplementation();
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
 
     ScoreSVMFusion();
 
@@ -183,6 +206,7 @@ public:
     void learnImplementation();
 
     Result fuse(const std::vector<double> &scores) const;
+    std::vector<double> fuseBatch(const Matrix &scores) const;
 
     static std::string name() { return "gmmFusion"; }
     std::string writeName() const { return name() + "-" + scoreNormalizer->writeParams(); }
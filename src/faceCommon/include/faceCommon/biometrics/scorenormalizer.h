@@ -15,6 +15,13 @@ public:
 
     virtual void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations) = 0;
     virtual std::vector<double> normalize(const std::vector<double> &inputScores) const = 0;
+
+    // normalization of every row of the pairs x units score matrix
+    virtual Matrix normalize(const Matrix &inputScores) const = 0;
+
+    // normalization of a single component score; it is monotonic in the score
+    virtual double normalizeComponent(unsigned int component, double score) const = 0;
+
     virtual std::string writeParams() const = 0;
 };
 
@@ -29,6 +36,8 @@ class FACECOMMON_EXPORTS ScoreNormalizerPass : public ScoreNormalizerBase
 public:
     void learn(const std::vector<Face::Biometrics::Evaluation> &/*evaluations*/) {}
     std::vector<double> normalize(const std::vector<double> &inputScores) const { return inputScores; }
+    Matrix normalize(const Matrix &inputScores) const { return inputScores; }
+    double normalizeComponent(unsigned int /*component*/, double score) const { return score; }
     static std::string name() { return "pass"; }
     std::string writeParams() const { return name(); }
     void serialize(cv::FileStorage &/*storage*/) const {}
@@ -44,6 +53,8 @@ private:
 public:
     void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations);
     std::vector<double> normalize(const std::vector<double> &inputScores) const;
+    Matrix normalize(const Matrix &inputScores) const;
+    double normalizeComponent(unsigned int component, double score) const;
     static std::string name() { return "mean"; }
     std::string writeParams() const { return name(); }
     void serialize(cv::FileStorage &storage) const;
@@ -60,6 +71,8 @@ private:
 public:
     void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations);
     std::vector<double> normalize(const std::vector<double> &inputScores) const;
+    Matrix normalize(const Matrix &inputScores) const;
+    double normalizeComponent(unsigned int component, double score) const;
     static std::string name() { return "median"; }
     std::string writeParams() const { return name(); }
     void serialize(cv::FileStorage &storage) const;
@@ -78,6 +91,8 @@ public:
 
     void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations);
     std::vector<double> normalize(const std::vector<double> &inputScores) const;
+    Matrix normalize(const Matrix &inputScores) const;
+    double normalizeComponent(unsigned int component, double score) const;
     static std::string name() { return "zscore"; }
     std::string writeParams() const { return compensateGenImpCount ? name()+"Comp" : name(); }
     void serialize(cv::FileStorage &storage) const;
@@ -96,6 +111,8 @@ public:
 
     void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations);
     std::vector<double> normalize(const std::vector<double> &inputScores) const;
+    Matrix normalize(const Matrix &inputScores) const;
+    double normalizeComponent(unsigned int component, double score) const;
     static std::string name() { return "mad"; }
     std::string writeParams() const { return compensateGenImpCount ? name()+"Comp" : name(); }
     void serialize(cv::FileStorage &storage) const;
@@ -114,6 +131,8 @@ public:
 
     void learn(const std::vector<Face::Biometrics::Evaluation> &evaluations);
     std::vector<double> normalize(const std::vector<double> &inputScores) const;
+    Matrix normalize(const Matrix &inputScores) const;
+    double normalizeComponent(unsigned int component, double score) const;
     static std::string name() { return "tanh"; }
     std::string writeParams() const { return compensateGenImpCount ? name()+"Comp" : name(); }
     void serialize(cv::FileStorage &storage) const;
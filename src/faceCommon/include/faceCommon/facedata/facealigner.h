@@ -3,6 +3,7 @@
 #include "faceCommon/facedata/mesh.h"
 #include "faceCommon/facedata/landmarks.h"
 #include "faceCommon/linalg/procrustes.h"
+#include "faceCommon/linalg/kdtree.h"
 #include "faceCommon/linalg/iserializable.h"
 #include "faceCommon/settings/settings.h"
 
@@ -60,6 +61,42 @@ public:
 		CVTemplateMatching = 5
 	};
 
+	/**
+	 * Convergence-driven ICP. The iterations start on every subsampleStep^(subsampleLevels-1)-th
+	 * point and move to a finer level whenever the current one converges, i.e. when the RMS residual
+	 * changes by at most tolerance or the correspondences move by at most tolerance (RMS) in one
+	 * iteration. The finest level uses all points. Only the trimRatio fraction of the closest
+	 * correspondences is used, and only those within maxDistance if it is positive.
+	 */
+	struct IcpSettings
+	{
+		IcpSettings() : maxIterations(100), tolerance(0.01), subsampleLevels(3), subsampleStep(4),
+			trimRatio(0.9), maxDistance(0) {}
+
+		int maxIterations;
+		double tolerance;
+		int subsampleLevels;
+		int subsampleStep;
+		double trimRatio;
+		double maxDistance;
+	};
+
+	struct IcpResult
+	{
+		IcpResult() : iterations(0), rms(0), converged(false) {}
+
+		int iterations;
+		double rms; // residual (in the metric) of the correspondences used in the last iteration
+		bool converged;
+	};
+
+	/**
+	 * Error minimized by an ICP iteration. PointToPoint is the SVD (Procrustes) solution for the
+	 * distances of the correspondences, PointToPlane a linearized 6-DoF least squares solution for
+	 * the distances of the points to the tangent planes of the reference (given by its vertex normals).
+	 */
+	enum Metric { PointToPoint, PointToPlane };
+
 	CVTemplateMatchingSettings cvTemplateMatchingSettings;
 
 	FaceAlignerIcp(const Mesh &referenceFace = Mesh::fromFile(Face::Settings::instance().settingsMap[Face::Settings::MeanFaceModelPathKey]),
@@ -69,12 +106,32 @@ public:
 
 	void setEnableThreadPool(bool enable);
 
+	/**
+	 * By default every reference point is matched to the nearest point of the aligned face, which
+	 * needs a k-d tree of the face in every align(). If enabled, every point of the aligned face is
+	 * matched to the nearest reference point instead, using the k-d tree built in the constructor.
+	 */
+	void setMatchToReference(bool enable) { matchToReference = enable; }
+
+	// PointToPlane computes the vertex normals of the reference on the first use
+	void setMetric(Metric metric);
+
+	// exactly maxIterations iterations using all points
 	void align(Mesh &face, int maxIterations, PreAlignTransform preAlignTransform) const;
 
+	IcpResult align(Mesh &face, const IcpSettings &settings, PreAlignTransform preAlignTransform) const;
+
 private:
 	const Mesh referenceFace;
 	NearestPointsThreadPool *threadPool;
 	const Face::FaceData::Landmarks referenceLandmarks;
+	const Face::LinAlg::KdTree referenceIndex;
+	Matrix referenceNormals; // empty until PointToPlane is set
+	bool matchToReference;
+	Metric metric;
+
+	void getNearestPoints(const Matrix &points, const Face::LinAlg::KdTree &index, const Matrix &query, Matrix &output,
+						  std::vector<int> *indices = 0) const;
 
 	void preAlign(Mesh &face, PreAlignTransform preAlignTransform) const;
 	void alignMaxZ(Mesh &face) const;
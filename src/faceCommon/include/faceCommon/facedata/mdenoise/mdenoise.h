@@ -29,10 +29,10 @@ private:
     void ScalingBox(void);
     void V3Normalize(FVECTOR3 v);
     void ComputeNormal(bool bProduced);
-    void ComputeVRing1V(void);
-    void ComputeVRing1T(void);
-    void ComputeTRing1TCV(void);
-    void ComputeTRing1TCE(void);
+    void ComputeVRing1V(const MeshTopology& topology);
+    void ComputeVRing1T(const MeshTopology& topology);
+    void ComputeTRing1TCV(const MeshTopology& topology);
+    void ComputeTRing1TCE(const MeshTopology& topology);
     void VertexUpdate(int** tRing, int nVIterations);
 
 private:
@@ -6,6 +6,7 @@
 
 #include "faceCommon/faceCommon.h"
 #include "faceCommon/linalg/common.h"
+#include "faceCommon/facedata/meshtopology.h"
 
 namespace Face {
 namespace FaceData {
@@ -35,6 +36,12 @@ public:
     double minx, maxx, miny, maxy, minz, maxz;
 	void clear();
     void calculateTriangles();
+
+    // connectivity of the triangles, built on the first call; changes of triangles made
+    // outside of Mesh methods have to be followed by invalidateTopology()
+    const MeshTopology &topology();
+    void invalidateTopology();
+
     void recalculateMinMax();
     cv::Point3d centralize();
     void translate(cv::Point3d translationVector);
@@ -72,6 +79,8 @@ public:
     static Mesh fromPointcloud(const VectorOfPoints &pointcloud, bool centralizeLoadedMesh = false, bool calculateTriangles = true);
 
 private:
+    MeshTopology::Ptr cachedTopology;
+
     static void fromDataStream(Poco::BinaryReader &stream, Mesh &mesh);
     void writeToDataStream(Poco::BinaryWriter &stream) const;
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace FaceData {
+
+/**
+ * Connectivity of a triangle mesh in compressed sparse row form.
+ *
+ * neighbours(v) are the vertices sharing a triangle with v (ascending), vertexTriangles(v) the
+ * triangles containing v (ascending). Every edge a < b is stored once with the (at most two)
+ * triangles it belongs to; triangleEdges(t)[i] is the edge opposite to the i-th vertex of t.
+ * The topology doesn't change with the vertex positions, see Mesh::topology().
+ */
+class FACECOMMON_EXPORTS MeshTopology
+{
+public:
+    typedef cv::Ptr<MeshTopology> Ptr;
+
+    struct Edge
+    {
+        int a;
+        int b;
+        int triangles[2]; // -1 if the edge has only one triangle
+    };
+
+    MeshTopology(int vertexCount, const std::vector<cv::Vec3i> &triangles);
+
+    int vertexCount() const { return neighbourOffsets.size() - 1; }
+    int triangleCount() const { return edgesOfTriangles.size(); }
+    int edgeCount() const { return edges.size(); }
+
+    int neighbourCount(int v) const { return neighbourOffsets[v + 1] - neighbourOffsets[v]; }
+    const int *neighbours(int v) const { return neighbourIndices.data() + neighbourOffsets[v]; }
+
+    int vertexTriangleCount(int v) const { return triangleOffsets[v + 1] - triangleOffsets[v]; }
+    const int *vertexTriangles(int v) const { return triangleIndices.data() + triangleOffsets[v]; }
+
+    const Edge &edge(int e) const { return edges[e]; }
+    const cv::Vec3i &triangleEdges(int t) const { return edgesOfTriangles[t]; }
+
+    // index of the edge between the vertices, -1 if there is none
+    int edgeIndex(int a, int b) const;
+
+private:
+    std::vector<int> neighbourOffsets;
+    std::vector<int> neighbourIndices;
+    std::vector<int> triangleOffsets;
+    std::vector<int> triangleIndices;
+
+    // edges of vertex a to its neighbours b > a start at edgeOffsets[a]
+    std::vector<int> edgeOffsets;
+    std::vector<Edge> edges;
+    std::vector<cv::Vec3i> edgesOfTriangles;
+};
+
+}
+}
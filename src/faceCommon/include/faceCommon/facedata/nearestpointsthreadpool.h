@@ -1,9 +1,8 @@
 #pragma once
 
 #include <Poco/ThreadPool.h>
-#include <opencv2/flann/flann.hpp>
-
 #include "faceCommon/linalg/common.h"
+#include "faceCommon/linalg/kdtree.h"
 
 namespace Face {
 namespace FaceData {
@@ -14,13 +13,15 @@ class NearestPointsThreadPool : public Poco::ThreadPool
     {
         int startRow;
         int endRow;
-        cv::flann::Index *index;
+        const Face::LinAlg::KdTree *index;
         const Matrix *input;
         const Matrix *pointsMat;
         Matrix *output;
+        std::vector<int> *indices;
 
     public:
-        void setUp(int startRow, int endRow, const Matrix *pointsMat, const Matrix *input, cv::flann::Index *index, Matrix *output);
+        void setUp(int startRow, int endRow, const Matrix *pointsMat, const Matrix *input,
+                   const Face::LinAlg::KdTree *index, Matrix *output, std::vector<int> *indices);
 
         void run();
     };
@@ -30,7 +31,10 @@ class NearestPointsThreadPool : public Poco::ThreadPool
 public:
     NearestPointsThreadPool();
 
-    void getNearestPoints(const Matrix *pointsMat, const Matrix *input, cv::flann::Index *index, Matrix *output);
+    // output rows are the rows of pointsMat nearest to the input rows, index is built on pointsMat;
+    // indices of those rows are stored too if indices is given
+    void getNearestPoints(const Matrix *pointsMat, const Matrix *input, const Face::LinAlg::KdTree *index, Matrix *output,
+                          std::vector<int> *indices = 0);
 };
 
 }
@@ -10,6 +10,7 @@ namespace FaceData {
 
 class CurvatureStruct;
 class MapConverter;
+class DepthmapTarget;
 class Mesh;
 
 class FACECOMMON_EXPORTS SurfaceProcessor
@@ -48,11 +49,39 @@ public:
      */
     static void mdenoising(Mesh &mesh, float sigma, int normalIterations, int vertexIterations);
 
-    static CurvatureStruct calculateCurvatures(Map &depthmap, bool pcl = true);
+    enum CurvatureOutput
+    {
+        CurvatureK = 1,         // curvatureK1, curvatureK2
+        CurvatureMean = 2,
+        CurvatureGauss = 4,
+        CurvatureIndex = 8,
+        CurvaturePcl = 16,
+        CurvatureFeatures = 32, // peaks, pits, saddles, valleys
+        AllCurvatures = 63
+    };
+
+    static CurvatureStruct calculateCurvatures(const Map &depthmap, bool pcl = true);
+
+    /**
+     * Only the maps selected by the CurvatureOutput flags are allocated and computed, the others stay empty.
+     * The rows are processed in parallel and the PCL curvature is evaluated in closed form.
+     */
+    static CurvatureStruct calculateCurvatures(const Map &depthmap, int outputs);
+
+    // original implementation with cv::PCA for every pixel, kept as a reference for calculateCurvatures()
+    static CurvatureStruct calculateCurvaturesReference(Map &depthmap, bool pcl = true);
 
     static Map depthmap(const Mesh &mesh, MapConverter &converter, double scaleCoef, SurfaceDataToProcess dataToProcess);
     static Map depthmap(const Mesh &mesh, MapConverter &converter, cv::Point2d meshStart, cv::Point2d meshEnd, double scaleCoef, SurfaceDataToProcess dataToProcess);
 
+    /**
+     * All targets are rasterized together. Triangles are binned into 64x64 pixel tiles that are drawn
+     * in parallel, each tile with its own part of the z-buffer; the output is the same for any count of
+     * threads. Plane equations of a triangle are computed once per target and all channels of a target
+     * share its z-buffer.
+     */
+    static void depthmaps(const Mesh &mesh, std::vector<DepthmapTarget> &targets);
+
     static std::vector<cv::Point3d> isoGeodeticCurve(const Map &map, const MapConverter &converter, const cv::Point3d center,
                                                  double distance, int samples, double mapScaleFactor);
 
@@ -61,8 +90,6 @@ public:
 
     static std::vector<double> isoGeodeticCurveToEuclDistance(const std::vector<cv::Point3d> &isoCuvre, cv::Point3d center);
 
-private:
-    static void depthmap(const Mesh &f, Map &map, cv::Point2d meshStart, cv::Point2d meshEnd, SurfaceDataToProcess dataToProcess);
 };
 
 class CurvatureStruct
@@ -135,6 +162,26 @@ public:
         return cv::Point3d(x, y, z);
     }
 };
+/**
+ * Area of the mesh rasterized by SurfaceProcessor::depthmaps() in the given resolution,
+ * maps[i] holds the data of channels[i]
+ */
+class FACECOMMON_EXPORTS DepthmapTarget
+{
+public:
+    MapConverter converter;
+    std::vector<SurfaceProcessor::SurfaceDataToProcess> channels;
+    std::vector<Map> maps;
+
+    DepthmapTarget(cv::Point2d meshStart, cv::Point2d meshEnd, double scaleCoef,
+                   const std::vector<SurfaceProcessor::SurfaceDataToProcess> &channels);
+
+    // whole extent of the mesh
+    DepthmapTarget(const Mesh &mesh, double scaleCoef,
+                   const std::vector<SurfaceProcessor::SurfaceDataToProcess> &channels);
+
+    const Map &map(SurfaceProcessor::SurfaceDataToProcess channel) const;
+};
 
 }
 }
@@ -47,6 +47,9 @@ public:
 
     static double median(std::vector<double> &values);
 
+    // ascending sort; chunks of large inputs are sorted in parallel and merged
+    static void parallelSort(std::vector<double> &values);
+
     template <class T>
     static std::vector<T> balanceSizesAndJoin(const std::vector<T> &first, const std::vector<T> &second)
     {
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace LinAlg {
+
+/**
+ * Vectorized kernels on contiguous float64 / float32 arrays used by the Metrics.
+ * The implementation (AVX2, SSE2 or scalar) is selected at runtime according to the CPU.
+ * Weights w are optional (nullptr means no weighting).
+ */
+class FACECOMMON_EXPORTS DistanceKernels
+{
+public:
+    struct Products
+    {
+        double xy;
+        double xx;
+        double yy;
+    };
+
+    // sum(w*x)
+    static double sum(const double *x, const double *w, int n);
+    static double sum(const float *x, const float *w, int n);
+
+    // sum(x*y)
+    static double dot(const double *x, const double *y, int n);
+    static double dot(const float *x, const float *y, int n);
+
+    // sum((w*(x-y))^2)
+    static double ssd(const double *x, const double *y, const double *w, int n);
+    static double ssd(const float *x, const float *y, const float *w, int n);
+
+    // sum(w*|x-y|)
+    static double cityblock(const double *x, const double *y, const double *w, int n);
+    static double cityblock(const float *x, const float *y, const float *w, int n);
+
+    // sums of products of centered values x' = w*x - meanX and y' = w*y - meanY
+    static Products products(const double *x, const double *y, const double *w, double meanX, double meanY, int n);
+    static Products products(const float *x, const float *y, const float *w, double meanX, double meanY, int n);
+
+    // ssd and cityblock of int8 codes (see Quantizer), w are the per-dimension scales
+    static double ssd(const signed char *x, const signed char *y, const float *w, int n);
+    static double cityblock(const signed char *x, const signed char *y, const float *w, int n);
+
+    // "avx2", "sse2" or "scalar"
+    static std::string implementation();
+};
+
+}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+#include "vector.h"
+#include "metrics.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace LinAlg {
+
+/**
+ * Distances between two sets of prepared vectors (see Metrics::prepare) stacked as matrix rows.
+ * For dot-decomposable metrics (euclidean, SSD, cosine, correlation and their weighted
+ * variants) all dot products are computed with a single cv::gemm call; other metrics
+ * fall back to pairwise distances.
+ */
+class FACECOMMON_EXPORTS DistanceMatrix
+{
+public:
+    static Matrix prepareRows(const Metrics &metrics, const std::vector<Vector> &vectors);
+
+    static std::vector<double> squaredNorms(const Matrix &rows);
+
+    // a.rows x b.rows matrix of distances between the rows of a and b
+    static Matrix compute(const Metrics &metrics, const Matrix &a, const Matrix &b);
+
+    static Matrix compute(const Metrics &metrics, const Matrix &a, const std::vector<double> &aSquaredNorms,
+                          const Matrix &b, const std::vector<double> &bSquaredNorms);
+};
+
+}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <map>
+#include <Poco/Mutex.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "iserializable.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace LinAlg {
+
+/**
+ * Approximate nearest neighbour index (hierarchical navigable small world graph) of prepared
+ * vectors (see Metrics::prepare) compared by rawPreparedDistance() of the given metrics.
+ * Every vector carries an integer label. Removed vectors stay in the graph as routing nodes
+ * but are never returned, rebuild() drops them. Searches may run concurrently with each other,
+ * but not with insert(), remove(), relabel() or rebuild().
+ */
+class FACECOMMON_EXPORTS HnswIndex : public ISerializable
+{
+public:
+    typedef cv::Ptr<HnswIndex> Ptr;
+    typedef std::pair<double, int> Neighbour;
+
+    HnswIndex(const Metrics::Ptr &metrics, int dimension = 0, int m = 16, int efConstruction = 200);
+
+    int size() const { return liveCount; }
+    int removedCount() const { return labels.size() - liveCount; }
+    int getDimension() const { return dimension; }
+
+    void insert(int label, const double *vector);
+    bool remove(int label);
+    bool contains(int label) const;
+    void rebuild();
+
+    // replaces the labels of the vectors, every label of the index has to be in the mapping
+    void relabel(const std::map<int, int> &mapping);
+
+    /**
+     * k nearest vectors as (distance, label) pairs, nearest first. ef >= k is the size of
+     * the candidate list; larger ef gives better recall for longer search time. The candidate
+     * list grows while removed vectors leave fewer than k results.
+     */
+    std::vector<Neighbour> search(const double *query, int k, int ef) const;
+
+    void serialize(cv::FileStorage &storage) const;
+    void deserialize(cv::FileStorage &storage);
+
+private:
+    Metrics::Ptr metrics;
+    int dimension;
+    int m;
+    int efConstruction;
+    double levelFactor;
+    cv::RNG rng;
+
+    std::vector<double> data;
+    std::vector<int> labels;
+    std::vector<int> levels;
+    std::vector<std::vector<std::vector<int> > > links; // links[node][level]
+    std::vector<unsigned char> removed;
+    std::map<int, int> nodes;                           // label -> node
+    int entryPoint;
+    int maxLevel;
+    int liveCount;
+
+    // nodes visited by one search are marked with its epoch, so the marks are never cleared;
+    // every running search takes its own list from the pool
+    struct VisitedList
+    {
+        std::vector<unsigned int> marks;
+        unsigned int epoch;
+    };
+    mutable std::vector<cv::Ptr<VisitedList> > visitedPool;
+    mutable Poco::FastMutex visitedMutex;
+    cv::Ptr<VisitedList> acquireVisited() const;
+    void releaseVisited(const cv::Ptr<VisitedList> &visited) const;
+
+    const double *nodeVector(int node) const { return data.data() + (size_t)node * dimension; }
+    double distance(const double *query, int node) const;
+    int randomLevel();
+    int maxLinks(int level) const { return level == 0 ? 2*m : m; }
+
+    int greedySearch(const double *query, int node, int level) const;
+    std::vector<Neighbour> searchLevel(const double *query, int entry, int ef, int level) const;
+    std::vector<int> selectNeighbours(const std::vector<Neighbour> &candidates, int count) const;
+    void connect(int node, int neighbour, int level);
+};
+
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "faceCommon/faceCommon.h"
+
+namespace Face {
+namespace LinAlg {
+
+/**
+ * Exact nearest neighbour search among 3D points (rows of an n x 3 matrix).
+ * The tree is built once and then only read, so it can be shared and searched
+ * from several threads at once.
+ */
+class FACECOMMON_EXPORTS KdTree
+{
+public:
+    KdTree() {}
+    KdTree(const Matrix &points);
+
+    int size() const { return indices.size(); }
+
+    // row of the nearest point; squared distance to it is stored if squaredDistance is given
+    int nearest(const cv::Point3d &p, double *squaredDistance = 0) const;
+
+private:
+    enum { leafSize = 8 };
+
+    // points in the order of the tree, node of the range [begin, end) splits at its middle element
+    std::vector<cv::Point3d> points;
+    std::vector<int> indices;
+    std::vector<unsigned char> axes;
+
+    void build(int begin, int end);
+    void search(int begin, int end, const cv::Point3d &p, int &best, double &bestDistance) const;
+};
+
+}
+}
@@ -51,6 +51,13 @@ public:
                            std::vector<int> &ids, std::vector<Face::FaceData::Mesh> &meshes, int icpIterations,
                            int smoothIterations, float smoothCoef, const std::string &idSeparator);
 
+    // convergence-driven ICP, see FaceAlignerIcp::IcpSettings; maxIterations 0 skips the alignment,
+    // otherwise a summary of the IcpResults (iterations, rms, not converged) is printed
+    static void loadMeshes(const std::string &dir, const Face::FaceData::FaceAlignerIcp &aligner,
+                           std::vector<int> &ids, std::vector<Face::FaceData::Mesh> &meshes,
+                           const Face::FaceData::FaceAlignerIcp::IcpSettings &icpSettings,
+                           int smoothIterations, float smoothCoef, const std::string &idSeparator);
+
     static void loadMeshes(const std::string &dir, const Face::FaceData::FaceAlignerLandmark &aligner,
                            std::vector<int> &ids, std::vector<Face::FaceData::Mesh> &meshes,
                            int smoothIterations, float smoothCoef, const std::string &idSeparator);
@@ -27,6 +27,9 @@ public:
     Matrix createDesignMatrix(const std::vector<Vector> &data) const;
 
     double classify(const Vector &x) const;
+
+    // classification of every row of the data matrix
+    std::vector<double> classify(const Matrix &data) const;
 };
 
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cmath>
+#include <limits>
 
 #include "vector.h"
+#include "distancekernels.h"
+#include "quantizer.h"
 
 namespace Face {
 namespace LinAlg {
@@ -16,9 +19,102 @@ public:
 
     virtual double distance(const Vector &v1, const Vector &v2) const = 0;
 
+    /**
+     * Distance of two contiguous arrays of n values. The gallery uses it to compare
+     * a probe with the rows of stacked reference matrices without wrapping every row
+     * into a Vector. Metrics that don't override it fall back to distance(Vector, Vector).
+     */
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return distance(Vector(Matrix(n, 1, const_cast<double *>(v1))), Vector(Matrix(n, 1, const_cast<double *>(v2))));
+    }
+
+    /**
+     * Bounds of the distance values, used to bound partial fused scores of the cascaded identification
+     */
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = -std::numeric_limits<double>::infinity();
+        upper = std::numeric_limits<double>::infinity();
+    }
+
+    /**
+     * Enrollment-time form of a vector. Metrics that can fold the weights and the
+     * per-vector statistics (mean, deviation, norm) into the stored values override
+     * rawPrepare() and rawPreparedDistance(); by default the values are kept as they are.
+     */
+    Vector prepare(const Vector &v) const
+    {
+        Vector result(v.rows);
+        rawPrepare(values(v), v.rows, result.ptr<double>());
+        return result;
+    }
+
+    double preparedDistance(const Vector &p1, const Vector &p2) const
+    {
+        int n = p1.rows;
+        if (n != p2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+        return rawPreparedDistance(values(p1), values(p2), n);
+    }
+
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = v[i];
+        }
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        return rawDistance(p1, p2, n);
+    }
+
+    /**
+     * Metrics whose prepared distance depends only on the dot product and the squared norms
+     * of the prepared vectors return true, many distances can then be computed at once with
+     * a matrix multiplication (see DistanceMatrix)
+     */
+    virtual bool isDotDecomposable() const { return false; }
+
+    virtual double distanceFromDot(double /*dot*/, double /*squaredNorm1*/, double /*squaredNorm2*/, int /*n*/) const
+    {
+        throw FACELIB_EXCEPTION("distance can't be computed from the dot product");
+    }
+
+    /**
+     * Distance of two prepared vectors stored as codes of the quantizer q. By default both are
+     * decoded into buffer (2n values); difference based metrics compare the int8 codes directly.
+     */
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        q.decode(c1, n, buffer);
+        q.decode(c2, n, buffer + n);
+        return rawPreparedDistance(buffer, buffer + n, n);
+    }
+
+    /**
+     * Distances of the prepared probe to count prepared rows of n values placed stride values apart
+     */
+    virtual void batchDistance(const double *probe, const double *rows, int count, int stride, int n, double *out) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            out[i] = rawPreparedDistance(probe, rows + i*stride, n);
+        }
+    }
+
     virtual ~Metrics() {}
 
     virtual std::string writeParams() const = 0;
+
+protected:
+    static const double *values(const Vector &v)
+    {
+        if (!v.isContinuous()) throw FACELIB_EXCEPTION("vector data are not continuous");
+        return v.ptr<double>();
+    }
 };
 
 class MetricsFactory
@@ -59,6 +155,18 @@ public:
         for (int i = 0; i < n; i++)
             w(i) = w(i)/sum*n;
     }
+
+protected:
+    void applyWeights(const double *v, int n, double *out) const
+    {
+        if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
+
+        const double *wp = values(w);
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = wp[i] * v[i];
+        }
+    }
 };
 
 class EuclideanMetric : public Metrics
@@ -71,14 +179,32 @@ public:
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            double v = (v1(i, 0) - v2(i, 0));
-            sum += v*v;
-        }
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return sqrt(DistanceKernels::ssd(v1, v2, nullptr, n));
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double squaredNorm1, double squaredNorm2, int /*n*/) const
+    {
+        double ssd = squaredNorm1 + squaredNorm2 - 2.0*dot;
+        return ssd > 0.0 ? sqrt(ssd) : 0.0;
+    }
 
-        return sqrt(sum);
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        if (q.getType() != Quantizer::Int8) return Metrics::rawQuantizedDistance(q, c1, c2, n, buffer);
+        return sqrt(DistanceKernels::ssd((const signed char *)c1, (const signed char *)c2, q.scales(), n));
     }
 
     std::string writeParams() const { return name(); }
@@ -93,16 +219,45 @@ public:
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
         if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            double v = w(i) * (v1(i) - v2(i));
-            sum += v*v;
-        }
+        return sqrt(DistanceKernels::ssd(v1, v2, values(w), n));
+    }
+
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        applyWeights(v, n, out);
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        return sqrt(DistanceKernels::ssd(p1, p2, nullptr, n));
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
 
-        return sqrt(sum);
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double squaredNorm1, double squaredNorm2, int /*n*/) const
+    {
+        double ssd = squaredNorm1 + squaredNorm2 - 2.0*dot;
+        return ssd > 0.0 ? sqrt(ssd) : 0.0;
+    }
+
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        if (q.getType() != Quantizer::Int8) return Metrics::rawQuantizedDistance(q, c1, c2, n, buffer);
+        return sqrt(DistanceKernels::ssd((const signed char *)c1, (const signed char *)c2, q.scales(), n));
     }
 
     std::string writeParams() const { return name(); }
@@ -118,13 +273,24 @@ public:
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            sum += fabs(v1(i, 0) - v2(i, 0));
-        }
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return DistanceKernels::cityblock(v1, v2, nullptr, n);
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
 
-        return sum;
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        if (q.getType() != Quantizer::Int8) return Metrics::rawQuantizedDistance(q, c1, c2, n, buffer);
+        return DistanceKernels::cityblock((const signed char *)c1, (const signed char *)c2, q.scales(), n);
     }
 
     std::string writeParams() const { return name(); }
@@ -140,12 +306,17 @@ public:
         int n = vec1.rows;
         if (n != vec2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
+        return rawDistance(values(vec1), values(vec2), n);
+    }
+
+    virtual double rawDistance(const double *vec1, const double *vec2, int n) const
+    {
         double sum = 0.0;
         int nans = 0;
         for (int i = 0; i < n; i++)
         {
-            double v1 = vec1(i);
-            double v2 = vec2(i);
+            double v1 = vec1[i];
+            double v2 = vec2[i];
             if (v1 != v1 || v2 != v2)
             {
                 nans++;
@@ -174,15 +345,23 @@ public:
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
         if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            sum += w(i) * fabs(v1(i, 0) - v2(i, 0));
-        }
+        return DistanceKernels::cityblock(v1, v2, values(w), n);
+    }
 
-        return sum;
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        double minWeight = 0.0;
+        if (!w.empty()) cv::minMaxIdx(w, &minWeight);
+        lower = minWeight >= 0.0 ? 0.0 : -std::numeric_limits<double>::infinity();
+        upper = std::numeric_limits<double>::infinity();
     }
 
     std::string writeParams() const { return name(); }
@@ -198,24 +377,65 @@ public:
         return 1.0 - correlation(v1, v2);
     }
 
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return 1.0 - correlation(v1, v2, n);
+    }
+
     static double correlation(const Vector &v1, const Vector &v2)
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
-        double mean1 = v1.meanValue();
-        double mean2 = v2.meanValue();
-        double std1 = v1.stdDeviation();
-        double std2 = v2.stdDeviation();
+        return correlation(values(v1), values(v2), n);
+    }
 
-        double sum = 0.0;
+    static double correlation(const double *v1, const double *v2, int n, const double *w = nullptr)
+    {
+        double mean1 = DistanceKernels::sum(v1, w, n)/n;
+        double mean2 = DistanceKernels::sum(v2, w, n)/n;
+        DistanceKernels::Products p = DistanceKernels::products(v1, v2, w, mean1, mean2, n);
+        double std1 = sqrt(p.xx/n);
+        double std2 = sqrt(p.yy/n);
+
+        return (1.0/(n-1.0)) * p.xy/(std1*std2);
+        //return sum/n;
+    }
+
+    // prepared form is the z-score, correlation of two of them is a single dot product
+    static void standardize(const double *v, int n, double *out)
+    {
+        double mean = DistanceKernels::sum(v, nullptr, n)/n;
+        double stdDev = sqrt(DistanceKernels::products(v, v, nullptr, mean, mean, n).xx/n);
         for (int i = 0; i < n; i++)
         {
-            sum += ((v1(i) - mean1)/std1)*((v2(i) - mean2)/std2);
+            out[i] = (v[i] - mean)/stdDev;
         }
+    }
 
-        return (1.0/(n-1.0)) * sum;
-        //return sum/n;
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        standardize(v, n, out);
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        return 1.0 - DistanceKernels::dot(p1, p2, n)/(n-1.0);
+    }
+
+    // z-scores use the population deviation (norm^2 = n) while the dot is divided by n-1,
+    // so |r| <= n/(n-1) <= 2 for any n >= 2
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = -1.0;
+        upper = 3.0;
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double /*squaredNorm1*/, double /*squaredNorm2*/, int n) const
+    {
+        return 1.0 - dot/(n-1.0);
     }
 
     std::string writeParams() const { return name(); }
@@ -231,27 +451,49 @@ public:
         return 1.0 - correlation(v1, v2);
     }
 
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return 1.0 - correlation(v1, v2, n);
+    }
+
     double correlation(const Vector &v1, const Vector &v2) const
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+        return correlation(values(v1), values(v2), n);
+    }
+
+    double correlation(const double *v1, const double *v2, int n) const
+    {
         if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
 
-        Vector v1w = v1.mul(w);
-        Vector v2w = v2.mul(w);
+        return CorrelationMetric::correlation(v1, v2, n, values(w));
+    }
 
-        double mean1 = v1w.meanValue();
-        double mean2 = v2w.meanValue();
-        double std1 = v1w.stdDeviation();
-        double std2 = v2w.stdDeviation();
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        applyWeights(v, n, out);
+        CorrelationMetric::standardize(out, n, out);
+    }
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            sum += ((v1w(i) - mean1)/std1)*((v2w(i) - mean2)/std2);
-        }
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        return 1.0 - DistanceKernels::dot(p1, p2, n)/(n-1.0);
+    }
+
+    // see CorrelationMetric::distanceRange()
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = -1.0;
+        upper = 3.0;
+    }
 
-        return (1.0/(n-1.0)) * sum;
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double /*squaredNorm1*/, double /*squaredNorm2*/, int n) const
+    {
+        return 1.0 - dot/(n-1.0);
     }
 
     std::string writeParams() const { return name(); }
@@ -267,8 +509,13 @@ public:
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
-        Matrix mul = (v1.t()*v2);
-        double dist = 1.0 - (mul(0))/(v1.magnitude() * v2.magnitude());
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        DistanceKernels::Products p = DistanceKernels::products(v1, v2, nullptr, 0.0, 0.0, n);
+        double dist = 1.0 - p.xy/(sqrt(p.xx) * sqrt(p.yy));
 
         if(dist < 0.0)
         {
@@ -279,6 +526,41 @@ public:
         return dist;
     }
 
+    // prepared form is the unit vector
+    static void normalize(const double *v, int n, double *out)
+    {
+        double norm = sqrt(DistanceKernels::dot(v, v, n));
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = v[i]/norm;
+        }
+    }
+
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        normalize(v, n, out);
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        double dist = 1.0 - DistanceKernels::dot(p1, p2, n);
+        return dist < 0.0 ? 0.0 : dist;
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = 2.0;
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double /*squaredNorm1*/, double /*squaredNorm2*/, int /*n*/) const
+    {
+        double dist = 1.0 - dot;
+        return dist < 0.0 ? 0.0 : dist;
+    }
+
     std::string writeParams() const { return name(); }
 };
 
@@ -291,13 +573,16 @@ public:
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
-        if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
 
-        Vector v1w = v1.mul(w);
-        Vector v2w = v2.mul(w);
+        return rawDistance(values(v1), values(v2), n);
+    }
 
-        Matrix mul = (v1w.t()*v2w);
-        double dist = 1.0 - (mul(0))/(v1w.magnitude() * v2w.magnitude());
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
+
+        DistanceKernels::Products p = DistanceKernels::products(v1, v2, values(w), 0.0, 0.0, n);
+        double dist = 1.0 - p.xy/(sqrt(p.xx) * sqrt(p.yy));
 
         if(dist < 0.0)
         {
@@ -309,6 +594,32 @@ public:
         return dist;
     }
 
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        applyWeights(v, n, out);
+        CosineMetric::normalize(out, n, out);
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        double dist = 1.0 - DistanceKernels::dot(p1, p2, n);
+        return dist < 0.0 ? 0.0 : dist;
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = 2.0;
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double /*squaredNorm1*/, double /*squaredNorm2*/, int /*n*/) const
+    {
+        double dist = 1.0 - dot;
+        return dist < 0.0 ? 0.0 : dist;
+    }
+
     std::string writeParams() const { return name(); }
 };
 
@@ -386,13 +697,32 @@ public:
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n;i++)
-        {
-            double d = (v1(i) - v2(i));
-            sum += d*d;
-        }
-        return sum;
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    double rawDistance(const double *v1, const double *v2, int n) const
+    {
+        return DistanceKernels::ssd(v1, v2, nullptr, n);
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double squaredNorm1, double squaredNorm2, int /*n*/) const
+    {
+        double ssd = squaredNorm1 + squaredNorm2 - 2.0*dot;
+        return ssd > 0.0 ? ssd : 0.0;
+    }
+
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        if (q.getType() != Quantizer::Int8) return Metrics::rawQuantizedDistance(q, c1, c2, n, buffer);
+        return DistanceKernels::ssd((const signed char *)c1, (const signed char *)c2, q.scales(), n);
     }
 
     std::string writeParams() const { return name(); }
@@ -407,16 +737,45 @@ public:
     {
         int n = v1.rows;
         if (n != v2.rows) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+        return rawDistance(values(v1), values(v2), n);
+    }
+
+    virtual double rawDistance(const double *v1, const double *v2, int n) const
+    {
         if (w.rows < n) throw FACELIB_EXCEPTION("weights size mismatch");
 
-        double sum = 0.0;
-        for (int i = 0; i < n; i++)
-        {
-            double v = w(i) * (v1(i) - v2(i));
-            sum += v*v;
-        }
+        return DistanceKernels::ssd(v1, v2, values(w), n);
+    }
 
-        return sum;
+    virtual void rawPrepare(const double *v, int n, double *out) const
+    {
+        applyWeights(v, n, out);
+    }
+
+    virtual double rawPreparedDistance(const double *p1, const double *p2, int n) const
+    {
+        return DistanceKernels::ssd(p1, p2, nullptr, n);
+    }
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
+
+    virtual bool isDotDecomposable() const { return true; }
+
+    virtual double distanceFromDot(double dot, double squaredNorm1, double squaredNorm2, int /*n*/) const
+    {
+        double ssd = squaredNorm1 + squaredNorm2 - 2.0*dot;
+        return ssd > 0.0 ? ssd : 0.0;
+    }
+
+    virtual double rawQuantizedDistance(const Quantizer &q, const void *c1, const void *c2, int n, double *buffer) const
+    {
+        if (q.getType() != Quantizer::Int8) return Metrics::rawQuantizedDistance(q, c1, c2, n, buffer);
+        return DistanceKernels::ssd((const signed char *)c1, (const signed char *)c2, q.scales(), n);
     }
 
     std::string writeParams() const { return name(); }
@@ -429,6 +788,14 @@ public:
 
     virtual double distance(const Vector &v1, const Vector &v2) const;
 
+    virtual double rawDistance(const double *v1, const double *v2, int n) const;
+
+    virtual void distanceRange(double &lower, double &upper) const
+    {
+        lower = 0.0;
+        upper = std::numeric_limits<double>::infinity();
+    }
+
     std::string writeParams() const { return name(); }
 };
 
@@ -439,6 +806,8 @@ public:
 
     virtual double distance(const Vector &v1, const Vector &v2) const;
 
+    virtual double rawDistance(const double *v1, const double *v2, int n) const;
+
     std::string writeParams() const { return name(); }
 };
 
@@ -449,6 +818,8 @@ public:
 
     virtual double distance(const Vector &v1, const Vector &v2) const;
 
+    virtual double rawDistance(const double *v1, const double *v2, int n) const;
+
     std::string writeParams() const { return name(); }
 };
 
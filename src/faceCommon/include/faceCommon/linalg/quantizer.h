@@ -0,0 +1,56 @@
+#pragma once
+
+#include "vector.h"
+#include "common.h"
+#include "iserializable.h"
+
+namespace Face {
+namespace LinAlg {
+
+/**
+ * Compact storage of feature vectors. Int8 keeps each value as a signed byte q with learned
+ * per-dimension scale and offset (value = offset + scale*q), Float16 as an IEEE half float.
+ */
+class FACECOMMON_EXPORTS Quantizer : public ISerializable
+{
+public:
+    typedef cv::Ptr<Quantizer> Ptr;
+
+    enum Type { None, Int8, Float16 };
+
+    Quantizer(Type type = None) : type(type) {}
+    Quantizer(Type type, const std::vector<Vector> &vectors);
+
+    Type getType() const { return type; }
+
+    // bytes used by one value
+    int valueSize() const;
+
+    // per-dimension scale and offset learned from the value ranges of the training vectors (Int8 only)
+    void learn(const std::vector<Vector> &vectors);
+
+    const float *scales() const { return scale.empty() ? nullptr : scale.data(); }
+
+    void encode(const double *v, int n, void *out) const;
+    void decode(const void *in, int n, double *out) const;
+
+    // vector after the encoding and decoding, used to measure the quantization loss
+    Vector roundTrip(const Vector &v) const;
+
+    static unsigned short toHalf(float value);
+    static float fromHalf(unsigned short value);
+
+    static std::string typeName(Type type);
+    static Type parseType(const std::string &name);
+
+    void serialize(cv::FileStorage &storage) const;
+    void deserialize(cv::FileStorage &storage);
+
+private:
+    Type type;
+    std::vector<float> scale;
+    std::vector<double> offset;
+};
+
+}
+}
@@ -25,6 +25,7 @@ namespace Face {
             static const std::string MeanFaceModelLandmarksPathKey;
             static const std::string PreAlignTemplatePathKey;
             static const std::string MultiExtractorPathKey;
+            static const std::string GalleryPathKey;
 
 			static Settings& instance();
 
@@ -0,0 +1,69 @@
+#include "faceCommon/biometrics/allpairs.h"
+
+#include <map>
+
+using namespace Face::Biometrics;
+
+AllPairs::AllPairs(const std::vector<int> &ids, int tileSize) :
+    ids(ids),
+    tileSize(tileSize > 0 ? tileSize : 64)
+{
+    int n = ids.size();
+
+    std::map<int, int> slots;
+    rank.resize(n);
+    subjectSlot.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        auto it = slots.find(ids[i]);
+        if (it == slots.end())
+        {
+            it = slots.insert(std::make_pair(ids[i], (int)subjectIndexes.size())).first;
+            subjectIndexes.push_back(std::vector<int>());
+        }
+        subjectSlot[i] = it->second;
+        rank[i] = subjectIndexes[it->second].size();
+        subjectIndexes[it->second].push_back(i);
+    }
+
+    genuineRowStart.resize(n);
+    impostorRowStart.resize(n);
+    genuineTotal = 0;
+    impostorTotal = 0;
+    for (int i = 0; i < n; i++)
+    {
+        genuineRowStart[i] = genuineTotal;
+        impostorRowStart[i] = impostorTotal;
+
+        long long genuineInRow = subjectIndexes[subjectSlot[i]].size() - rank[i] - 1;
+        genuineTotal += genuineInRow;
+        impostorTotal += (n - i - 1) - genuineInRow;
+    }
+
+    int tiles = (n + this->tileSize - 1) / this->tileSize;
+    for (int a = 0; a < tiles; a++)
+    {
+        for (int b = a; b < tiles; b++)
+        {
+            tilePairs.push_back(std::make_pair(a, b));
+        }
+    }
+}
+
+int AllPairs::sameIdBefore(int i, int j) const
+{
+    const std::vector<int> &same = subjectIndexes[subjectSlot[i]];
+    int before = std::lower_bound(same.begin(), same.end(), j) - same.begin();
+    return before - rank[i] - 1;
+}
+
+long long AllPairs::index(int i, int j) const
+{
+    if (i >= j) throw FACELIB_EXCEPTION("pair indexes should be ordered");
+
+    int same = sameIdBefore(i, j);
+    if (ids[i] == ids[j])
+        return genuineRowStart[i] + same;
+    else
+        return impostorRowStart[i] + (j - i - 1) - same;
+}
@@ -0,0 +1,94 @@
+#include "faceCommon/biometrics/crossvalidation.h"
+
+using namespace Face::Biometrics;
+
+void CrossValidation::addFold(const std::vector<int> &ids, BlockFunction block, int tileSize)
+{
+    folds.push_back(Fold(ids, block, tileSize));
+}
+
+BatchEvaluationResult CrossValidation::evaluate(long long exactPairLimit) const
+{
+    int foldsCount = folds.size();
+
+    // scores of the exact folds have fixed slots, see AllPairs::computeBlocks()
+    std::vector<unsigned char> exact(foldsCount);
+    std::vector<std::vector<double> > genuineScores(foldsCount);
+    std::vector<std::vector<double> > impostorScores(foldsCount);
+    for (int f = 0; f < foldsCount; f++)
+    {
+        const AllPairs &pairs = folds[f].pairs;
+        exact[f] = pairs.genuineCount() + pairs.impostorCount() <= exactPairLimit;
+        if (!exact[f]) continue;
+
+        genuineScores[f].assign(pairs.genuineCount(), 0.0);
+        impostorScores[f].assign(pairs.impostorCount(), 0.0);
+    }
+
+    // (fold, tile) tasks of all folds
+    std::vector<std::pair<int, int> > tasks;
+    for (int f = 0; f < foldsCount; f++)
+    {
+        for (int t = 0; t < folds[f].pairs.tileCount(); t++)
+        {
+            tasks.push_back(std::make_pair(f, t));
+        }
+    }
+
+    std::vector<ScoreHistogram> genuine(foldsCount);
+    std::vector<ScoreHistogram> impostor(foldsCount);
+    int taskCount = tasks.size();
+    std::string error;
+    #pragma omp parallel
+    {
+        std::vector<ScoreHistogram> threadGenuine(foldsCount);
+        std::vector<ScoreHistogram> threadImpostor(foldsCount);
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < taskCount; i++)
+        {
+            int f = tasks[i].first;
+            const Fold &fold = folds[f];
+            try
+            {
+                if (exact[f])
+                    fold.pairs.computeTile(tasks[i].second, fold.block, genuineScores[f], impostorScores[f]);
+                else
+                    fold.pairs.accumulateTile(tasks[i].second, fold.block, threadGenuine[f], threadImpostor[f]);
+            }
+            catch (std::exception &e)
+            {
+                #pragma omp critical
+                error = e.what();
+            }
+        }
+
+        #pragma omp critical
+        {
+            for (int f = 0; f < foldsCount; f++)
+            {
+                genuine[f].merge(threadGenuine[f]);
+                impostor[f].merge(threadImpostor[f]);
+            }
+        }
+    }
+
+    if (!error.empty()) throw std::runtime_error(error);
+
+    BatchEvaluationResult result;
+    std::vector<double> eer;
+    for (int f = 0; f < foldsCount; f++)
+    {
+        if (exact[f])
+            result.results.push_back(Evaluation(genuineScores[f], impostorScores[f]));
+        else
+            result.results.push_back(Evaluation(genuine[f], impostor[f]));
+        eer.push_back(result.results.back().eer);
+    }
+
+    Face::LinAlg::Vector eerVec = Face::LinAlg::Vector(eer);
+    result.meanEER = eerVec.meanValue();
+    result.stdDevOfEER = eerVec.stdDeviation();
+
+    return result;
+}
@@ -1,17 +1,92 @@
 #include "faceCommon/biometrics/evaluation.h"
 
+#include <algorithm>
 #include <fstream>
 #include <cmath>
+#include <iterator>
 
 #include "faceCommon/linalg/histogram.h"
 #include "faceCommon/biometrics/template.h"
+#include "faceCommon/biometrics/allpairs.h"
+#include "faceCommon/biometrics/crossvalidation.h"
+#include "faceCommon/linalg/distancematrix.h"
 
 using namespace Face::Biometrics;
 
+namespace {
+
+// scores tiles of all template pairs
+class TemplateScorer
+{
+public:
+    std::vector<int> ids;
+
+    TemplateScorer(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics) :
+        metrics(metrics)
+    {
+        int n = templates.size();
+        ids.resize(n);
+        prepared.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            if (Face::LinAlg::Common::matrixContainsNan(templates[i].featureVector))
+                throw FACELIB_EXCEPTION("feature vector contains NaN");
+
+            ids[i] = templates[i].subjectID;
+            prepared[i] = metrics.prepare(templates[i].featureVector);
+        }
+
+        if (metrics.isDotDecomposable() && n > 0)
+        {
+            rows = Matrix(n, prepared[0].rows);
+            for (int i = 0; i < n; i++)
+            {
+                if (prepared[i].rows != rows.cols) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+                Matrix(prepared[i].t()).copyTo(rows.row(i));
+            }
+            norms = Face::LinAlg::DistanceMatrix::squaredNorms(rows);
+        }
+    }
+
+    // dot decomposable metrics score large tiles by one matrix multiplication
+    int tileSize() const { return rows.empty() ? 64 : 256; }
+
+    void block(int iStart, int iEnd, int jStart, int jEnd, Matrix &scores) const
+    {
+        if (!rows.empty())
+        {
+            std::vector<double> iNorms(norms.begin() + iStart, norms.begin() + iEnd);
+            std::vector<double> jNorms(norms.begin() + jStart, norms.begin() + jEnd);
+            scores = Face::LinAlg::DistanceMatrix::compute(metrics, rows.rowRange(iStart, iEnd), iNorms,
+                                                           rows.rowRange(jStart, jEnd), jNorms);
+        }
+
+        for (int i = iStart; i < iEnd; i++)
+        {
+            for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+            {
+                double d = rows.empty() ? metrics.preparedDistance(prepared[i], prepared[j]) : scores(i - iStart, j - jStart);
+                if (d != d)
+                    throw FACELIB_EXCEPTION("NaN");
+                scores(i - iStart, j - jStart) = d;
+            }
+        }
+    }
+
+private:
+    const Face::LinAlg::Metrics &metrics;
+    std::vector<Face::LinAlg::Vector> prepared;
+    Matrix rows;
+    std::vector<double> norms;
+};
+
+}
+
 void Evaluation::commonInit()
 {
     eer = 1.0;
     eerScore = 0.0;
+    eerErrorBound = 0.0;
 
     minGenuineScore = 1e300;
     minImpostorScore = 1e300;
@@ -38,6 +113,11 @@ void Evaluation::commonInitOfScores()
     maxImpostorScore = impVec.maxValue();
     meanImpostorScore = impVec.meanValue();
 
+    commonInitOfRanges();
+}
+
+void Evaluation::commonInitOfRanges()
+{
     minScore = minGenuineScore < minImpostorScore ? minGenuineScore : minImpostorScore;
     maxScore = maxImpostorScore > maxGenuineScore ? maxImpostorScore : maxGenuineScore;
 
@@ -87,6 +167,24 @@ Evaluation::Evaluation(std::map<std::pair<int, int>, std::vector<double> > &dist
     commonEvaluation();
 }
 
+Evaluation::Evaluation(const ScoreHistogram &genuineHistogram, const ScoreHistogram &impostorHistogram) :
+    genuineHistogram(genuineHistogram), impostorHistogram(impostorHistogram)
+{
+    commonInit();
+    if (genuineHistogram.count() == 0 || impostorHistogram.count() == 0) return;
+
+    minGenuineScore = genuineHistogram.minValue();
+    maxGenuineScore = genuineHistogram.maxValue();
+    meanGenuineScore = genuineHistogram.meanValue();
+    minImpostorScore = impostorHistogram.minValue();
+    maxImpostorScore = impostorHistogram.maxValue();
+    meanImpostorScore = impostorHistogram.meanValue();
+    commonInitOfRanges();
+
+    histogramEvaluation();
+    sampleDET(1000);
+}
+
 Evaluation::Evaluation(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics)
 {
     commonInit();
@@ -107,84 +205,239 @@ Evaluation::Evaluation(const std::vector<Face::LinAlg::Vector> &rawData, const s
 
 void Evaluation::commonEvaluation()
 {
-    // DET, EER
-    double delta = maxScore - minScore;
-    double step = delta/1000.0;
-    if (step == 0) return;
+    int genuineCount = genuineScores.size();
+    int impostorCount = impostorScores.size();
+    if (genuineCount == 0 || impostorCount == 0) return;
+
+    double sign = orientation();
+    sortedGenuineScores.resize(genuineCount);
+    for (int i = 0; i < genuineCount; i++) sortedGenuineScores[i] = sign * genuineScores[i];
+    sortedImpostorScores.resize(impostorCount);
+    for (int i = 0; i < impostorCount; i++) sortedImpostorScores[i] = sign * impostorScores[i];
+
+    Face::LinAlg::Common::parallelSort(sortedGenuineScores);
+    Face::LinAlg::Common::parallelSort(sortedImpostorScores);
+
+    // EER: merge walk over every distinct threshold t, scores below t are accepted.
+    // FNMR falls and FMR rises with t; at the lowest score FNMR = 1 and FMR = 0,
+    // above the highest one FNMR = 0 and FMR = 1.
+    const std::vector<double> &gen = sortedGenuineScores;
+    const std::vector<double> &imp = sortedImpostorScores;
+    double last = std::max(gen.back(), imp.back());
+    int g = 0;
+    int i = 0;
+    double prevT = 0.0, prevFnmr = 1.0, prevFmr = 0.0;
+    while (true)
+    {
+        double t;
+        if (g < genuineCount && i < impostorCount) t = std::min(gen[g], imp[i]);
+        else if (g < genuineCount) t = gen[g];
+        else if (i < impostorCount) t = imp[i];
+        else t = std::nextafter(last, HUGE_VAL);
+
+        double currentFnmr = double(genuineCount - g) / genuineCount;
+        double currentFmr = double(i) / impostorCount;
+        if (currentFnmr <= currentFmr)
+        {
+            // the curves cross between the previous and the current threshold
+            double prevDiff = prevFnmr - prevFmr;
+            double alpha = prevDiff / (prevDiff - (currentFnmr - currentFmr));
+            eer = prevFnmr + alpha * (currentFnmr - prevFnmr);
+            eerScore = sign * (prevT + alpha * (t - prevT));
+            break;
+        }
+
+        prevT = t;
+        prevFnmr = currentFnmr;
+        prevFmr = currentFmr;
+        while (g < genuineCount && gen[g] == t) g++;
+        while (i < impostorCount && imp[i] == t) i++;
+    }
+
+    sampleDET(1000);
+}
 
-    double minDiff = 1e300;
+std::vector<int> Evaluation::histogramEdges() const
+{
+    // lower edges of all non-empty buckets and the upper edge of the last one
+    std::vector<int> genuineBuckets = genuineHistogram.buckets();
+    std::vector<int> impostorBuckets = impostorHistogram.buckets();
+    std::vector<int> edges;
+    std::set_union(genuineBuckets.begin(), genuineBuckets.end(), impostorBuckets.begin(), impostorBuckets.end(),
+                   std::back_inserter(edges));
+    if (!edges.empty()) edges.push_back(edges.back() + 1);
+    return edges;
+}
 
-    for (double t = minScore; t <= maxScore; t += step)
+void Evaluation::histogramRates(long long genuineBelow, long long impostorBelow, double &outFnmr, double &outFmr) const
+{
+    long long genuineCount = genuineHistogram.count();
+    long long impostorCount = impostorHistogram.count();
+    if (scoreType == SCORE_SIMILARITY)
     {
-        distances.push_back(t);
+        outFnmr = double(genuineBelow) / genuineCount;
+        outFmr = double(impostorCount - impostorBelow) / impostorCount;
+    }
+    else
+    {
+        outFnmr = double(genuineCount - genuineBelow) / genuineCount;
+        outFmr = double(impostorBelow) / impostorCount;
+    }
+}
 
-        // FNMR
-        double sameMismatchCount = 0.0;
-        for (unsigned int i = 0; i < genuineScores.size(); i++)
-        {
-            if ((scoreType == SCORE_DISTANCE) && (genuineScores[i] > t)) sameMismatchCount+=1.0;
-            if ((scoreType == SCORE_SIMILARITY) && (genuineScores[i] < t)) sameMismatchCount+=1.0;
-        }
-        sameMismatchCount /= genuineScores.size();
-        fnmr.push_back(sameMismatchCount);
+void Evaluation::histogramEvaluation()
+{
+    // the same walk as in commonEvaluation(), over the bucket edges; the true EER lies
+    // between the error rates at the edges around the crossing
+    bool similarity = scoreType == SCORE_SIMILARITY;
+    std::vector<int> edges = histogramEdges();
+    long long genuineBelow = 0;
+    long long impostorBelow = 0;
+    double prevT = 0.0, prevFnmr = 0.0, prevFmr = 0.0;
+    for (unsigned int k = 0; k < edges.size(); k++)
+    {
+        double t = ScoreHistogram::lowerEdge(edges[k]);
+        double currentFnmr, currentFmr;
+        histogramRates(genuineBelow, impostorBelow, currentFnmr, currentFmr);
 
-        // FMR
-        double differentMatchCount = 0.0;
-        for (unsigned int i = 0; i < impostorScores.size(); i++)
+        // falls along the edges, from 1 at the first one to -1 at the last one
+        double diff = similarity ? currentFmr - currentFnmr : currentFnmr - currentFmr;
+        if (diff <= 0)
         {
-            if ((scoreType == SCORE_DISTANCE) && (impostorScores[i] < t)) differentMatchCount+=1.0;
-            if ((scoreType == SCORE_SIMILARITY) && (impostorScores[i] > t)) differentMatchCount+=1.0;
+            double prevDiff = similarity ? prevFmr - prevFnmr : prevFnmr - prevFmr;
+            double alpha = prevDiff / (prevDiff - diff);
+            eer = prevFnmr + alpha * (currentFnmr - prevFnmr);
+            eerScore = prevT + alpha * (t - prevT);
+            eerErrorBound = std::max(fabs(currentFnmr - prevFnmr), fabs(currentFmr - prevFmr));
+            break;
         }
-        differentMatchCount /= impostorScores.size();
-        fmr.push_back(differentMatchCount);
 
-        // EER
-        double diff = fabs(sameMismatchCount - differentMatchCount);
-        if (diff < minDiff)
-        {
-            minDiff = diff;
-            eer = (sameMismatchCount+differentMatchCount)/2;
-            eerScore = t;
-        }
+        prevT = t;
+        prevFnmr = currentFnmr;
+        prevFmr = currentFmr;
+        genuineBelow += genuineHistogram.bucketCount(edges[k]);
+        impostorBelow += impostorHistogram.bucketCount(edges[k]);
+    }
+}
+
+bool Evaluation::hasScores() const
+{
+    if (!sortedGenuineScores.empty() && !sortedImpostorScores.empty()) return true;
+    return genuineHistogram.count() > 0 && impostorHistogram.count() > 0;
+}
+
+void Evaluation::sampleDET(int points)
+{
+    fmr.clear();
+    fnmr.clear();
+    distances.clear();
+
+    double delta = maxScore - minScore;
+    if (points < 2 || delta == 0 || !hasScores()) return;
+
+    double step = delta / (points - 1);
+    for (int k = 0; k < points; k++)
+    {
+        double t = minScore + k * step;
+        double currentFnmr, currentFmr;
+        fnmrAndFmrAtDistance(t, currentFnmr, currentFmr);
+
+        distances.push_back(t);
+        fnmr.push_back(currentFnmr);
+        fmr.push_back(currentFmr);
     }
 }
 
 void Evaluation::fnmrAndFmrAtDistance(const double inDistance, double &outFnmr, double &outFmr) const
 {
-    int n = fmr.size();
-    double minDiff = 1e300;
-    for (int i = 0; i < n; i++)
+    outFnmr = 1.0;
+    outFmr = 0.0;
+    if (!hasScores()) return;
+
+    if (sortedGenuineScores.empty())
     {
-        double diff = fabs(distances[i]-inDistance);
-        if (diff < minDiff)
-        {
-            minDiff = diff;
-            outFnmr = fnmr[i];
-            outFmr = fmr[i];
-        }
+        int bucket = ScoreHistogram::bucket(inDistance);
+        histogramRates(genuineHistogram.countBelow(bucket), impostorHistogram.countBelow(bucket), outFnmr, outFmr);
+        return;
     }
+
+    double t = orientation() * inDistance;
+    long long acceptedGenuines = std::lower_bound(sortedGenuineScores.begin(), sortedGenuineScores.end(), t) - sortedGenuineScores.begin();
+    long long acceptedImpostors = std::lower_bound(sortedImpostorScores.begin(), sortedImpostorScores.end(), t) - sortedImpostorScores.begin();
+
+    outFnmr = double(sortedGenuineScores.size() - acceptedGenuines) / sortedGenuineScores.size();
+    outFmr = double(acceptedImpostors) / sortedImpostorScores.size();
 }
 
 void Evaluation::fnmrAtFmr(const double inFmr, double &outFnmr, double &outDistance) const
 {
-    int n = fmr.size();
-	double minDiff = 1e300;
+    double errorBound;
+    fnmrAtFmr(inFmr, outFnmr, outDistance, errorBound);
+}
+
+void Evaluation::fnmrAtFmr(const double inFmr, double &outFnmr, double &outDistance, double &outErrorBound) const
+{
     outFnmr = 1.0;
-	for (int i = 0; i < n; i++)
-	{
-        double diff = fabs(fmr[i]-inFmr);
-		if (diff < minDiff)
-		{
-			minDiff = diff;
-            outFnmr = fnmr[i];
-            outDistance = distances[i];
-		}
-	}
+    outErrorBound = 0.0;
+    if (!hasScores()) return;
+
+    if (sortedGenuineScores.empty())
+    {
+        // the best bucket edge with FMR <= inFmr; the optimal threshold may lie inside
+        // the neighbouring bucket, where FNMR is only known to lie between its edges
+        bool similarity = scoreType == SCORE_SIMILARITY;
+        std::vector<int> edges = histogramEdges();
+        long long genuineBelow = 0;
+        long long impostorBelow = 0;
+        double prevFnmr = 0.0;
+        for (unsigned int k = 0; k < edges.size(); k++)
+        {
+            double currentFnmr, currentFmr;
+            histogramRates(genuineBelow, impostorBelow, currentFnmr, currentFmr);
+            if (!similarity)
+            {
+                if (currentFmr > inFmr)
+                {
+                    outErrorBound = outFnmr - currentFnmr;
+                    break;
+                }
+                outFnmr = currentFnmr;
+                outDistance = ScoreHistogram::lowerEdge(edges[k]);
+            }
+            else if (currentFmr <= inFmr)
+            {
+                outFnmr = currentFnmr;
+                outDistance = ScoreHistogram::lowerEdge(edges[k]);
+                outErrorBound = k > 0 ? currentFnmr - prevFnmr : 0.0;
+                break;
+            }
+
+            prevFnmr = currentFnmr;
+            genuineBelow += genuineHistogram.bucketCount(edges[k]);
+            impostorBelow += impostorHistogram.bucketCount(edges[k]);
+        }
+        return;
+    }
+
+    // the highest threshold with at most inFmr * impostorCount accepted impostors
+    long long impostorCount = sortedImpostorScores.size();
+    long long allowed = (long long)std::floor(inFmr * impostorCount + 1e-9);
+    double t;
+    if (allowed >= impostorCount)
+        t = std::nextafter(std::max(sortedGenuineScores.back(), sortedImpostorScores.back()), HUGE_VAL);
+    else
+        t = sortedImpostorScores[allowed];
+
+    long long acceptedGenuines = std::lower_bound(sortedGenuineScores.begin(), sortedGenuineScores.end(), t) - sortedGenuineScores.begin();
+    outFnmr = double(sortedGenuineScores.size() - acceptedGenuines) / sortedGenuineScores.size();
+    outDistance = orientation() * t;
 }
 
 void Evaluation::printStats() const
 {
-    std::cout << "EER: " << eer << "; distance: " << eerScore << std::endl;
+    std::cout << "EER: " << eer << "; distance: " << eerScore;
+    if (eerErrorBound > 0) std::cout << "; error bound: " << eerErrorBound;
+    std::cout << std::endl;
 
     std::vector<double> fmrs;
     fmrs.push_back(0.01);
@@ -194,51 +447,37 @@ void Evaluation::printStats() const
 
     for (double desiredFmr : fmrs)
     {
-        double fnmr, distance;
-        fnmrAtFmr(desiredFmr, fnmr, distance);
-        std::cout << "FNMR @ FMR = " << desiredFmr << ": " << fnmr << "; distance: " << distance << std::endl;
+        double fnmr, distance, errorBound;
+        fnmrAtFmr(desiredFmr, fnmr, distance, errorBound);
+        std::cout << "FNMR @ FMR = " << desiredFmr << ": " << fnmr << "; distance: " << distance;
+        if (errorBound > 0) std::cout << "; error bound: " << errorBound;
+        std::cout << std::endl;
     }
 }
 
 void Evaluation::commonTemplatesEvaluation(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics)
 {
-    int n = templates.size();
-    for (int i = 0; i < (n-1); i++)
+    TemplateScorer scorer(templates, metrics);
+    AllPairs pairs(scorer.ids, scorer.tileSize());
+    pairs.computeBlocks([&scorer](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
     {
-        const Template &ti = templates[i];
-        if (Face::LinAlg::Common::matrixContainsNan(ti.featureVector))
-            throw FACELIB_EXCEPTION("feature vector contains NaN");
-
-        for (int j = i+1; j < n; j++)
-        {
-            const Template &tj = templates[j];
-            if (Face::LinAlg::Common::matrixContainsNan(tj.featureVector))
-                throw FACELIB_EXCEPTION("feature vector contains NaN");
-            double d = metrics.distance(ti.featureVector, tj.featureVector);
-            if (d != d)
-                throw FACELIB_EXCEPTION("NaN");
-
-            // same or different?
-            if (ti.subjectID == tj.subjectID)
-            {
-                genuineScores.push_back(d);
-                if (d > maxGenuineScore) maxGenuineScore = d;
-                if (d < minGenuineScore) minGenuineScore = d;
-            }
-            else
-            {
-                impostorScores.push_back(d);
-                if (d > maxImpostorScore) maxImpostorScore = d;
-                if (d < minImpostorScore) minImpostorScore = d;
-            }
+        scorer.block(iStart, iEnd, jStart, jEnd, scores);
+    }, genuineScores, impostorScores);
 
-            if (d > maxScore) maxScore = d;
-            if (d < minScore) minScore = d;
-        }
-    }
     commonInitOfScores();
 }
 
+void Evaluation::accumulate(const std::vector<Template> &templates, const Face::LinAlg::Metrics &metrics,
+                            ScoreHistogram &genuineHistogram, ScoreHistogram &impostorHistogram)
+{
+    TemplateScorer scorer(templates, metrics);
+    AllPairs pairs(scorer.ids, scorer.tileSize());
+    pairs.accumulateBlocks([&scorer](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+    {
+        scorer.block(iStart, iEnd, jStart, jEnd, scores);
+    }, genuineHistogram, impostorHistogram);
+}
+
 void Evaluation::outputResultsDET(const std::string &path) const
 {
     std::ofstream out(path);
@@ -294,43 +533,34 @@ void Evaluation::outputResults(const std::string &path, int histogramBins) const
     outputResultsGenuineScores(path+"-gen-scores");
 }
 
-BatchEvaluationResult Evaluation::batch(std::vector<std::vector<Template> > &templates, const Face::LinAlg::Metrics &metrics, int startIndex)
+BatchEvaluationResult Evaluation::batch(std::vector<std::vector<Template> > &templates, const Face::LinAlg::Metrics &metrics, int startIndex,
+                                        long long exactPairLimit)
 {
-    BatchEvaluationResult batchResult;
-    std::vector<double> eer;
-
+    // folds are evaluated at once, see CrossValidation
+    CrossValidation crossValidation;
     int cCount = templates.size();
     for (int i = startIndex; i < cCount; i++)
     {
-        Evaluation e(templates[i], metrics);
-        batchResult.results.push_back(e);
-        eer.push_back(e.eer);
+        cv::Ptr<TemplateScorer> scorer = new TemplateScorer(templates[i], metrics);
+        crossValidation.addFold(scorer->ids, [scorer](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+        {
+            scorer->block(iStart, iEnd, jStart, jEnd, scores);
+        }, scorer->tileSize());
     }
 
-    Face::LinAlg::Vector eerVec = Face::LinAlg::Vector(eer);
-    batchResult.meanEER = eerVec.meanValue();
-    batchResult.stdDevOfEER = eerVec.stdDeviation();
-
-    return batchResult;
+    return crossValidation.evaluate(exactPairLimit);
 }
 
 BatchEvaluationResult Evaluation::batch(std::vector<std::vector<Face::LinAlg::Vector> > &images, std::vector<std::vector<int> > &classes,
-        const Face::Biometrics::FeatureExtractor &extractor, const Face::LinAlg::Metrics &metrics, int startIndex)
+        const Face::Biometrics::FeatureExtractor &extractor, const Face::LinAlg::Metrics &metrics, int startIndex,
+        long long exactPairLimit)
 {
-    BatchEvaluationResult batchResult;
-    std::vector<double> eer;
-
     int cCount = images.size();
+    std::vector<std::vector<Template> > templates;
     for (int i = startIndex; i < cCount; i++)
     {
-        Evaluation e(images[i], classes[i], extractor, metrics);
-        batchResult.results.push_back(e);
-        eer.push_back(e.eer);
+        templates.push_back(Template::createTemplates(images[i], classes[i], extractor));
     }
 
-    Face::LinAlg::Vector eerVec = Face::LinAlg::Vector(eer);
-    batchResult.meanEER = eerVec.meanValue();
-    batchResult.stdDevOfEER = eerVec.stdDeviation();
-
-    return batchResult;
+    return batch(templates, metrics, 0, exactPairLimit);
 }
@@ -0,0 +1,893 @@
+#include "faceCommon/biometrics/gallery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <Poco/Path.h>
+#include <Poco/File.h>
+#include <Poco/SharedMemory.h>
+
+#include "faceCommon/linalg/distancekernels.h"
+
+using namespace Face::Biometrics;
+
+Gallery::Gallery(const MultiExtractor &extractor) :
+    extractor(extractor),
+    indexUnit(-1),
+    nextSerial(0),
+    capacity(0),
+    count(0),
+    version(0)
+{
+}
+
+Gallery::~Gallery()
+{
+}
+
+void Gallery::checkTemplate(const MultiTemplate &t) const
+{
+    unsigned int n = t.featureVectors.size();
+    if (n != extractor.units.size())
+    {
+        std::string str = "feature vector and units count mismatch: " + std::to_string(n) + " vs " + std::to_string(extractor.units.size());
+        throw FACELIB_EXCEPTION(str);
+    }
+
+    if (blocks.empty()) return;
+
+    if (t.version != version) throw FACELIB_EXCEPTION("template version differs from the gallery");
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (t.featureVectors[i].rows != lengths[i])
+        {
+            throw FACELIB_EXCEPTION("feature vector component " + std::to_string(i) + " length mismatch");
+        }
+    }
+}
+
+void Gallery::reserve(int newCapacity)
+{
+    if (blocks.empty() || newCapacity <= capacity) return;
+
+    for (unsigned int u = 0; u < blocks.size(); u++)
+    {
+        if (isQuantized(u))
+        {
+            cv::Mat unitCodes = cv::Mat::zeros(newCapacity, lengths[u] * quantizers[u]->valueSize(), CV_8UC1);
+            if (count > 0)
+            {
+                codes[u].rowRange(0, count).copyTo(unitCodes.rowRange(0, count));
+            }
+            codes[u] = unitCodes;
+            continue;
+        }
+
+        Matrix block = Matrix::zeros(newCapacity, strides[u]);
+        if (count > 0)
+        {
+            blocks[u].rowRange(0, count).copyTo(block.rowRange(0, count));
+        }
+        blocks[u] = block;
+    }
+    capacity = newCapacity;
+
+    // all rows are copied out of the mapped file
+    mapping.release();
+}
+
+void Gallery::detach()
+{
+    if (mapping.empty()) return;
+
+    for (unsigned int u = 0; u < blocks.size(); u++)
+    {
+        blocks[u] = blocks[u].clone();
+        codes[u] = codes[u].clone();
+    }
+    mapping.release();
+}
+
+void Gallery::add(const MultiTemplate &reference)
+{
+    checkTemplate(reference);
+
+    int unitCount = reference.featureVectors.size();
+    if (blocks.empty())
+    {
+        version = reference.version;
+        for (int u = 0; u < unitCount; u++)
+        {
+            int n = reference.featureVectors[u].rows;
+            lengths.push_back(n);
+            strides.push_back((n + 3) / 4 * 4);
+            blocks.push_back(Matrix());
+            codes.push_back(cv::Mat());
+            squaredNorms.push_back(std::vector<double>());
+
+            const Face::LinAlg::Quantizer::Ptr &q = extractor.units[u]->quantizer;
+            quantizers.push_back(!q.empty() && q->getType() != Face::LinAlg::Quantizer::None ? q : Face::LinAlg::Quantizer::Ptr());
+        }
+    }
+
+    if (capacity <= count)
+    {
+        reserve(std::max(16, count + count / 2));
+    }
+
+    std::vector<double> buffer;
+    for (int u = 0; u < unitCount; u++)
+    {
+        const Face::LinAlg::Vector &v = reference.featureVectors[u];
+        int n = lengths[u];
+        double *row;
+        if (isQuantized(u))
+        {
+            buffer.resize(n);
+            row = buffer.data();
+        }
+        else
+        {
+            row = blocks[u].ptr<double>(count);
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            row[i] = v(i);
+        }
+        extractor.units[u]->metrics->rawPrepare(row, n, row);
+        squaredNorms[u].push_back(Face::LinAlg::DistanceKernels::dot(row, row, n));
+
+        if (isQuantized(u))
+        {
+            quantizers[u]->encode(row, n, codes[u].ptr(count));
+        }
+    }
+    ids.push_back(reference.id);
+    serials.push_back(nextSerial++);
+    depthCoverages.push_back(reference.depthCoverage);
+    count++;
+
+    if (!index.empty())
+    {
+        std::vector<double> row = preparedRow(indexUnit, count - 1);
+        index->insert(serials[count - 1], row.data());
+    }
+}
+
+void Gallery::add(const std::vector<MultiTemplate> &references)
+{
+    if (references.empty()) return;
+
+    add(references[0]);
+    reserve(count + references.size() - 1);
+    for (unsigned int i = 1; i < references.size(); i++)
+    {
+        add(references[i]);
+    }
+}
+
+int Gallery::remove(int id)
+{
+    detach();
+
+    int kept = 0;
+    for (int r = 0; r < count; r++)
+    {
+        if (ids[r] == id)
+        {
+            if (!index.empty()) index->remove(serials[r]);
+            continue;
+        }
+        if (kept != r)
+        {
+            for (unsigned int u = 0; u < blocks.size(); u++)
+            {
+                if (isQuantized(u))
+                    codes[u].row(r).copyTo(codes[u].row(kept));
+                else
+                    blocks[u].row(r).copyTo(blocks[u].row(kept));
+                squaredNorms[u][kept] = squaredNorms[u][r];
+            }
+            ids[kept] = ids[r];
+            serials[kept] = serials[r];
+            depthCoverages[kept] = depthCoverages[r];
+        }
+        kept++;
+    }
+
+    // removed nodes only slow the searches down, the graph is rebuilt once they prevail
+    if (!index.empty() && index->removedCount() > index->size()) index->rebuild();
+
+    int removed = count - kept;
+    count = kept;
+    ids.resize(count);
+    serials.resize(count);
+    depthCoverages.resize(count);
+    for (unsigned int u = 0; u < squaredNorms.size(); u++)
+    {
+        squaredNorms[u].resize(count);
+    }
+    return removed;
+}
+
+void Gallery::clear()
+{
+    blocks.clear();
+    codes.clear();
+    quantizers.clear();
+    lengths.clear();
+    strides.clear();
+    squaredNorms.clear();
+    ids.clear();
+    serials.clear();
+    depthCoverages.clear();
+    mapping.release();
+    index.release();
+    indexUnit = -1;
+    capacity = 0;
+    count = 0;
+    version = 0;
+}
+
+Gallery::PreparedProbe Gallery::prepareProbe(const MultiTemplate &probe) const
+{
+    checkTemplate(probe);
+
+    PreparedProbe result;
+    result.values.resize(blocks.size());
+    result.codes.resize(blocks.size());
+    for (unsigned int u = 0; u < blocks.size(); u++)
+    {
+        int n = lengths[u];
+        std::vector<double> &p = result.values[u];
+        p.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            p[i] = probe.featureVectors[u](i);
+        }
+        extractor.units[u]->metrics->rawPrepare(p.data(), n, p.data());
+
+        // the probe is quantized as well, so both sides carry the same rounding
+        if (isQuantized(u))
+        {
+            result.codes[u].resize(n * quantizers[u]->valueSize());
+            quantizers[u]->encode(p.data(), n, result.codes[u].data());
+        }
+    }
+    return result;
+}
+
+int Gallery::maxLength() const
+{
+    int result = 0;
+    for (int n : lengths) result = std::max(result, n);
+    return result;
+}
+
+double Gallery::distance(int unit, const PreparedProbe &probe, int index, double *buffer) const
+{
+    const Face::LinAlg::Metrics &metrics = *extractor.units[unit]->metrics;
+    if (isQuantized(unit))
+    {
+        return metrics.rawQuantizedDistance(*quantizers[unit], probe.codes[unit].data(), codes[unit].ptr(index),
+                                            lengths[unit], buffer);
+    }
+    return metrics.rawPreparedDistance(probe.values[unit].data(), blocks[unit].ptr<double>(index), lengths[unit]);
+}
+
+std::vector<double> Gallery::preparedRow(int unit, int row) const
+{
+    int n = lengths[unit];
+    std::vector<double> result(n);
+    if (isQuantized(unit))
+    {
+        quantizers[unit]->decode(codes[unit].ptr(row), n, result.data());
+    }
+    else
+    {
+        const double *values = blocks[unit].ptr<double>(row);
+        std::copy(values, values + n, result.begin());
+    }
+    return result;
+}
+
+Gallery::Candidate Gallery::candidate(const PreparedProbe &preparedProbe, int index) const
+{
+    std::vector<double> buffer(2 * maxLength());
+    std::vector<double> scores(blocks.size());
+    for (unsigned int u = 0; u < blocks.size(); u++)
+    {
+        scores[u] = distance(u, preparedProbe, index, buffer.data());
+    }
+
+    Candidate c;
+    c.index = index;
+    c.id = ids[index];
+    c.result = extractor.fusion->fuse(scores);
+    return c;
+}
+
+Matrix Gallery::score(const MultiTemplate &probe) const
+{
+    return score(std::vector<MultiTemplate>(1, probe))[0];
+}
+
+std::vector<Matrix> Gallery::score(const std::vector<MultiTemplate> &probes) const
+{
+    int probeCount = probes.size();
+    std::vector<PreparedProbe> preparedProbes(probeCount);
+    for (int p = 0; p < probeCount; p++)
+    {
+        preparedProbes[p] = prepareProbe(probes[p]);
+    }
+
+    // unit-major scores, so every batch writes a contiguous range
+    int unitCount = blocks.size();
+    std::vector<Matrix> perUnit(probeCount);
+    for (int p = 0; p < probeCount; p++)
+    {
+        perUnit[p] = Matrix(unitCount, count);
+    }
+    if (count == 0)
+    {
+        return perUnit;
+    }
+
+    const int batchSize = 256;
+    int batchCount = (count + batchSize - 1) / batchSize;
+    for (int u = 0; u < unitCount; u++)
+    {
+        const Face::LinAlg::Metrics &metrics = *extractor.units[u]->metrics;
+        const Matrix &block = blocks[u];
+        int n = lengths[u];
+
+        if (isQuantized(u))
+        {
+            int tasks = probeCount * batchCount;
+            #pragma omp parallel
+            {
+                std::vector<double> buffer(2 * n);
+
+                #pragma omp for
+                for (int t = 0; t < tasks; t++)
+                {
+                    int p = t / batchCount;
+                    int begin = (t % batchCount) * batchSize;
+                    int end = std::min(count, begin + batchSize);
+                    double *out = perUnit[p].ptr<double>(u);
+                    for (int r = begin; r < end; r++)
+                    {
+                        out[r] = distance(u, preparedProbes[p], r, buffer.data());
+                    }
+                }
+            }
+        }
+        else if (metrics.isDotDecomposable())
+        {
+            // dot products of all probes with all rows by one matrix multiplication
+            Matrix probeRows(probeCount, n);
+            std::vector<double> probeNorms(probeCount);
+            for (int p = 0; p < probeCount; p++)
+            {
+                const double *pData = preparedProbes[p].values[u].data();
+                std::copy(pData, pData + n, probeRows.ptr<double>(p));
+                probeNorms[p] = Face::LinAlg::DistanceKernels::dot(pData, pData, n);
+            }
+
+            Matrix dots;
+            cv::gemm(probeRows, block(cv::Rect(0, 0, n, count)), 1.0, cv::noArray(), 0.0, dots, cv::GEMM_2_T);
+
+            const std::vector<double> &rowNorms = squaredNorms[u];
+            #pragma omp parallel for
+            for (int p = 0; p < probeCount; p++)
+            {
+                const double *dot = dots.ptr<double>(p);
+                double *out = perUnit[p].ptr<double>(u);
+                for (int r = 0; r < count; r++)
+                {
+                    out[r] = metrics.distanceFromDot(dot[r], probeNorms[p], rowNorms[r], n);
+                }
+            }
+        }
+        else
+        {
+            int tasks = probeCount * batchCount;
+            #pragma omp parallel for
+            for (int t = 0; t < tasks; t++)
+            {
+                int p = t / batchCount;
+                int begin = (t % batchCount) * batchSize;
+                int end = std::min(count, begin + batchSize);
+                metrics.batchDistance(preparedProbes[p].values[u].data(), block.ptr<double>(begin), end - begin, strides[u], n,
+                                      perUnit[p].ptr<double>(u) + begin);
+            }
+        }
+    }
+
+    std::vector<Matrix> result(probeCount);
+    for (int p = 0; p < probeCount; p++)
+    {
+        result[p] = perUnit[p].t();
+    }
+    return result;
+}
+
+std::vector<Gallery::Candidate> Gallery::identify(const MultiTemplate &probe, int topK) const
+{
+    if (count == 0) return std::vector<Candidate>();
+    return best(score(probe), topK);
+}
+
+std::vector<std::vector<Gallery::Candidate> > Gallery::identify(const std::vector<MultiTemplate> &probes, int topK) const
+{
+    std::vector<std::vector<Candidate> > result(probes.size());
+    if (count == 0) return result;
+
+    std::vector<Matrix> scores = score(probes);
+    for (unsigned int p = 0; p < probes.size(); p++)
+    {
+        result[p] = best(scores[p], topK);
+    }
+    return result;
+}
+
+std::vector<Gallery::Candidate> Gallery::best(const Matrix &scores, int topK) const
+{
+    std::vector<Candidate> candidates;
+    if (topK <= 0 || topK > count) topK = count;
+
+    const ScoreLevelFusionBase &fusion = *extractor.fusion;
+    int unitCount = scores.cols;
+
+    std::vector<double> fused = fusion.fuseBatch(scores);
+
+    std::vector<int> order(count);
+    for (int r = 0; r < count; r++) order[r] = r;
+    std::partial_sort(order.begin(), order.begin() + topK, order.end(),
+                      [&fused](int a, int b) { return fused[a] < fused[b]; });
+
+    for (int i = 0; i < topK; i++)
+    {
+        const double *row = scores.ptr<double>(order[i]);
+        Candidate c;
+        c.index = order[i];
+        c.id = ids[order[i]];
+        c.result = fusion.fuse(std::vector<double>(row, row + unitCount));
+        candidates.push_back(c);
+    }
+    return candidates;
+}
+
+std::vector<Gallery::Candidate> Gallery::identifyCascade(const MultiTemplate &probe, int topK, double threshold) const
+{
+    std::vector<Candidate> candidates;
+    if (count == 0) return candidates;
+
+    const ScoreLevelFusionBase &fusion = *extractor.fusion;
+    const ScoreNormalizerBase &normalizer = *fusion.scoreNormalizer;
+    int unitCount = blocks.size();
+    std::vector<double> weights;
+    double bias;
+    if (!fusion.linearForm(unitCount, weights, bias))
+    {
+        for (const Candidate &c : identify(probe, topK))
+        {
+            if (c.result.score > threshold) break;
+            candidates.push_back(c);
+        }
+        return candidates;
+    }
+
+    PreparedProbe preparedProbe = prepareProbe(probe);
+
+    // the lowest contribution of each unit to the fused score (normalizers are monotonic)
+    std::vector<double> minContribution(unitCount);
+    for (int u = 0; u < unitCount; u++)
+    {
+        double lower, upper;
+        extractor.units[u]->metrics->distanceRange(lower, upper);
+        double a = weights[u] * normalizer.normalizeComponent(u, lower);
+        double b = weights[u] * normalizer.normalizeComponent(u, upper);
+        minContribution[u] = weights[u] == 0.0 ? 0.0 : std::min(a, b);
+        if (minContribution[u] != minContribution[u]) minContribution[u] = -std::numeric_limits<double>::infinity();
+    }
+
+    // most discriminative units per feature vector length first
+    std::vector<int> order(unitCount);
+    for (int u = 0; u < unitCount; u++) order[u] = u;
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        return fabs(weights[a]) / lengths[a] > fabs(weights[b]) / lengths[b];
+    });
+
+    // remainingMin[k] bounds the contribution of units order[k..]
+    std::vector<double> remainingMin(unitCount + 1, 0.0);
+    for (int k = unitCount - 1; k >= 0; k--)
+    {
+        remainingMin[k] = remainingMin[k + 1] + minContribution[order[k]];
+    }
+
+    std::vector<std::pair<double, int> > accepted;
+    #pragma omp parallel
+    {
+        // max-heap of the best fused scores found by this thread
+        std::vector<std::pair<double, int> > best;
+        std::vector<double> buffer(2 * maxLength());
+
+        #pragma omp for schedule(dynamic, 64)
+        for (int r = 0; r < count; r++)
+        {
+            double partial = bias;
+            bool rejected = false;
+            for (int k = 0; k < unitCount; k++)
+            {
+                int u = order[k];
+                double d = distance(u, preparedProbe, r, buffer.data());
+                partial += weights[u] * normalizer.normalizeComponent(u, d);
+
+                double cutoff = threshold;
+                if (topK > 0 && (int)best.size() == topK && best.front().first < cutoff) cutoff = best.front().first;
+                if (partial + remainingMin[k + 1] > cutoff)
+                {
+                    rejected = true;
+                    break;
+                }
+            }
+            if (rejected) continue;
+
+            best.push_back(std::make_pair(partial, r));
+            std::push_heap(best.begin(), best.end());
+            if (topK > 0 && (int)best.size() > topK)
+            {
+                std::pop_heap(best.begin(), best.end());
+                best.pop_back();
+            }
+        }
+
+        #pragma omp critical
+        accepted.insert(accepted.end(), best.begin(), best.end());
+    }
+
+    std::sort(accepted.begin(), accepted.end());
+    if (topK > 0 && (int)accepted.size() > topK) accepted.resize(topK);
+
+    for (const auto &a : accepted)
+    {
+        candidates.push_back(candidate(preparedProbe, a.second));
+    }
+    return candidates;
+}
+
+void Gallery::buildIndex(int unit, int m, int efConstruction)
+{
+    if (unit < 0 || unit >= (int)extractor.units.size()) throw FACELIB_EXCEPTION("invalid unit index " + std::to_string(unit));
+    if (blocks.empty()) throw FACELIB_EXCEPTION("index can't be built over an empty gallery");
+
+    index = new Face::LinAlg::HnswIndex(extractor.units[unit]->metrics, lengths[unit], m, efConstruction);
+    indexUnit = unit;
+    for (int r = 0; r < count; r++)
+    {
+        std::vector<double> row = preparedRow(unit, r);
+        index->insert(serials[r], row.data());
+    }
+}
+
+void Gallery::serializeIndex(std::string directoryPath) const
+{
+    if (index.empty()) throw FACELIB_EXCEPTION("gallery has no index");
+    if (directoryPath.back() != Poco::Path::separator())
+        directoryPath.push_back(Poco::Path::separator());
+
+    cv::FileStorage storage(directoryPath + "index", cv::FileStorage::WRITE);
+    storage << "unit" << indexUnit;
+    storage << "ids" << ids;
+    storage << "serials" << serials;
+    index->serialize(storage);
+}
+
+void Gallery::deserializeIndex(std::string directoryPath)
+{
+    if (directoryPath.back() != Poco::Path::separator())
+        directoryPath.push_back(Poco::Path::separator());
+
+    cv::FileStorage storage(directoryPath + "index", cv::FileStorage::READ);
+    if (!storage.isOpened()) throw FACELIB_EXCEPTION("can't open index file in " + directoryPath);
+
+    int unit;
+    std::vector<int> indexIds;
+    std::vector<int> indexSerials;
+    storage["unit"] >> unit;
+    storage["ids"] >> indexIds;
+    storage["serials"] >> indexSerials;
+    if (unit < 0 || unit >= (int)extractor.units.size()) throw FACELIB_EXCEPTION("invalid unit index " + std::to_string(unit));
+
+    Face::LinAlg::HnswIndex::Ptr loaded = new Face::LinAlg::HnswIndex(extractor.units[unit]->metrics);
+    loaded->deserialize(storage);
+
+    // labels of the index are the serial numbers the templates had when the index was written;
+    // a gallery enrolled again from the same templates numbers them anew
+    if (loaded->size() != count || indexIds != ids || (int)indexSerials.size() != count ||
+        (!blocks.empty() && loaded->getDimension() != lengths[unit]))
+    {
+        throw FACELIB_EXCEPTION("index doesn't match the gallery");
+    }
+    if (indexSerials != serials)
+    {
+        std::map<int, int> mapping;
+        for (int r = 0; r < count; r++)
+        {
+            mapping[indexSerials[r]] = serials[r];
+        }
+        loaded->relabel(mapping);
+    }
+
+    index = loaded;
+    indexUnit = unit;
+}
+
+std::vector<Gallery::Candidate> Gallery::identifyApproximate(const MultiTemplate &probe, int topK, int shortlist) const
+{
+    if (index.empty()) return identify(probe, topK);
+
+    std::vector<Candidate> candidates;
+    if (count == 0) return candidates;
+    if (topK <= 0 || topK > count) topK = count;
+    shortlist = std::max(shortlist, topK);
+
+    PreparedProbe preparedProbe = prepareProbe(probe);
+    std::vector<Face::LinAlg::HnswIndex::Neighbour> neighbours =
+            index->search(preparedProbe.values[indexUnit].data(), shortlist, shortlist);
+
+    // serial numbers grow with the row index, the row is found by bisection
+    for (const Face::LinAlg::HnswIndex::Neighbour &n : neighbours)
+    {
+        int row = std::lower_bound(serials.begin(), serials.end(), n.second) - serials.begin();
+        candidates.push_back(candidate(preparedProbe, row));
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+    {
+        return a.result.score < b.result.score;
+    });
+    if ((int)candidates.size() > topK) candidates.resize(topK);
+    return candidates;
+}
+
+namespace {
+
+/*
+ * Binary gallery file, all numbers little-endian:
+ *
+ *   FileHeader
+ *   FileUnit[unitCount]
+ *   int32 ids[count], int32 serials[count], float32 depthCoverages[count]
+ *   per unit: float64 squaredNorms[count]
+ *   per unit, aligned to fileAlignment: count rows of rowBytes bytes (prepared doubles
+ *   padded to stride values, or quantizer codes)
+ */
+const char fileMagic[4] = { 'F', 'G', 'A', 'L' };
+const int32_t fileFormatVersion = 2;
+const int64_t fileAlignment = 64;
+
+enum FileEncoding { EncodingDouble = 0, EncodingInt8 = 1, EncodingFloat16 = 2 };
+
+struct FileHeader
+{
+    char magic[4];
+    int32_t formatVersion;
+    int32_t templateVersion;
+    int32_t unitCount;
+    int32_t count;
+    int32_t nextSerial;
+    int64_t sequence;
+};
+
+struct FileUnit
+{
+    int32_t length;
+    int32_t stride;
+    int32_t encoding;
+    int32_t rowBytes;
+    int64_t normsOffset;
+    int64_t rowsOffset;
+};
+
+void checkLittleEndian()
+{
+    uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    if (first != 1) throw FACELIB_EXCEPTION("binary gallery files are supported on little-endian machines only");
+}
+
+int64_t align(int64_t offset)
+{
+    return (offset + fileAlignment - 1) / fileAlignment * fileAlignment;
+}
+
+int32_t encoding(const Face::LinAlg::Quantizer::Ptr &quantizer)
+{
+    if (quantizer.empty()) return EncodingDouble;
+    switch (quantizer->getType())
+    {
+    case Face::LinAlg::Quantizer::Int8:
+        return EncodingInt8;
+    case Face::LinAlg::Quantizer::Float16:
+        return EncodingFloat16;
+    default:
+        return EncodingDouble;
+    }
+}
+
+}
+
+void Gallery::serialize(const std::string &path, int64_t sequence) const
+{
+    checkLittleEndian();
+
+    int unitCount = lengths.size();
+    FileHeader header;
+    std::memcpy(header.magic, fileMagic, 4);
+    header.formatVersion = fileFormatVersion;
+    header.templateVersion = version;
+    header.unitCount = unitCount;
+    header.count = count;
+    header.nextSerial = nextSerial;
+    header.sequence = sequence;
+
+    std::vector<FileUnit> units(unitCount);
+    int64_t offset = sizeof(FileHeader) + unitCount * sizeof(FileUnit) + count * (2*sizeof(int32_t) + sizeof(float));
+    for (int u = 0; u < unitCount; u++)
+    {
+        units[u].normsOffset = offset;
+        offset += count * sizeof(double);
+    }
+    for (int u = 0; u < unitCount; u++)
+    {
+        units[u].length = lengths[u];
+        units[u].stride = strides[u];
+        units[u].encoding = encoding(quantizers[u]);
+        units[u].rowBytes = isQuantized(u) ? lengths[u] * quantizers[u]->valueSize() : strides[u] * sizeof(double);
+        offset = align(offset);
+        units[u].rowsOffset = offset;
+        offset += (int64_t)count * units[u].rowBytes;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw FACELIB_EXCEPTION("can't open " + path + " for writing");
+
+    out.write((const char *)&header, sizeof(FileHeader));
+    out.write((const char *)units.data(), unitCount * sizeof(FileUnit));
+    out.write((const char *)ids.data(), count * sizeof(int32_t));
+    out.write((const char *)serials.data(), count * sizeof(int32_t));
+    out.write((const char *)depthCoverages.data(), count * sizeof(float));
+    for (int u = 0; u < unitCount; u++)
+    {
+        out.write((const char *)squaredNorms[u].data(), count * sizeof(double));
+    }
+
+    std::vector<char> padding(fileAlignment, 0);
+    for (int u = 0; u < unitCount; u++)
+    {
+        out.write(padding.data(), units[u].rowsOffset - (int64_t)out.tellp());
+        for (int r = 0; r < count; r++)
+        {
+            const uchar *row = isQuantized(u) ? codes[u].ptr(r) : blocks[u].ptr(r);
+            out.write((const char *)row, units[u].rowBytes);
+        }
+    }
+
+    if (!out) throw FACELIB_EXCEPTION("writing of " + path + " failed");
+}
+
+int64_t Gallery::deserialize(const std::string &path)
+{
+    checkLittleEndian();
+
+    Poco::File file(path);
+    if (!file.exists()) throw FACELIB_EXCEPTION("gallery file " + path + " does not exist");
+
+    // read-only mapping; rows are copied only when the gallery is modified
+    cv::Ptr<Poco::SharedMemory> fileMapping = new Poco::SharedMemory(file, Poco::SharedMemory::AM_READ);
+    const char *begin = fileMapping->begin();
+    int64_t fileSize = fileMapping->end() - begin;
+
+    FileHeader header;
+    if (fileSize < (int64_t)sizeof(FileHeader)) throw FACELIB_EXCEPTION(path + " is not a gallery file");
+    std::memcpy(&header, begin, sizeof(FileHeader));
+    if (std::memcmp(header.magic, fileMagic, 4) != 0) throw FACELIB_EXCEPTION(path + " is not a gallery file");
+    if (header.formatVersion != fileFormatVersion)
+        throw FACELIB_EXCEPTION("unsupported gallery file version " + std::to_string(header.formatVersion));
+    if (header.unitCount != (int)extractor.units.size())
+        throw FACELIB_EXCEPTION("gallery file and extractor units count mismatch");
+    if (header.count < 0) throw FACELIB_EXCEPTION("corrupted gallery file " + path);
+
+    int unitCount = header.unitCount;
+    int n = header.count;
+    int64_t tableEnd = sizeof(FileHeader) + unitCount * sizeof(FileUnit) + (int64_t)n * (2*sizeof(int32_t) + sizeof(float));
+    if (fileSize < tableEnd) throw FACELIB_EXCEPTION("corrupted gallery file " + path);
+
+    std::vector<FileUnit> units(unitCount);
+    std::memcpy(units.data(), begin + sizeof(FileHeader), unitCount * sizeof(FileUnit));
+    for (int u = 0; u < unitCount; u++)
+    {
+        const FileUnit &unit = units[u];
+        const Face::LinAlg::Quantizer::Ptr &q = extractor.units[u]->quantizer;
+        if (unit.encoding != encoding(q))
+            throw FACELIB_EXCEPTION("gallery file unit " + std::to_string(u) + " encoding differs from the extractor");
+        if (unit.length <= 0 || unit.length > std::numeric_limits<int32_t>::max() / (int32_t)sizeof(double))
+            throw FACELIB_EXCEPTION("corrupted gallery file " + path);
+
+        // the row layout follows from the length, so the rows can't reach past their block
+        int32_t stride = (unit.length + 3) / 4 * 4;
+        int32_t rowBytes = unit.encoding == EncodingDouble ? stride * (int32_t)sizeof(double) : unit.length * q->valueSize();
+        if (unit.stride != stride || unit.rowBytes != rowBytes || unit.rowsOffset % fileAlignment != 0 ||
+            unit.normsOffset < tableEnd || unit.normsOffset > fileSize || (fileSize - unit.normsOffset) / (int64_t)sizeof(double) < n ||
+            unit.rowsOffset < tableEnd || unit.rowsOffset > fileSize || (fileSize - unit.rowsOffset) / rowBytes < n)
+        {
+            throw FACELIB_EXCEPTION("corrupted gallery file " + path);
+        }
+    }
+
+    clear();
+    version = header.templateVersion;
+    nextSerial = header.nextSerial;
+    count = n;
+    capacity = n;
+
+    const char *tables = begin + sizeof(FileHeader) + unitCount * sizeof(FileUnit);
+    ids.resize(n);
+    serials.resize(n);
+    depthCoverages.resize(n);
+    std::memcpy(ids.data(), tables, n * sizeof(int32_t));
+    std::memcpy(serials.data(), tables + n * sizeof(int32_t), n * sizeof(int32_t));
+    std::memcpy(depthCoverages.data(), tables + 2 * n * sizeof(int32_t), n * sizeof(float));
+
+    for (int u = 0; u < unitCount; u++)
+    {
+        const FileUnit &unit = units[u];
+        lengths.push_back(unit.length);
+        strides.push_back(unit.stride);
+
+        // the norms follow the 4-byte tables, so they are copied rather than read in place
+        squaredNorms.push_back(std::vector<double>(n));
+        if (n > 0) std::memcpy(squaredNorms.back().data(), begin + unit.normsOffset, n * sizeof(double));
+
+        const Face::LinAlg::Quantizer::Ptr &q = extractor.units[u]->quantizer;
+        quantizers.push_back(unit.encoding != EncodingDouble ? q : Face::LinAlg::Quantizer::Ptr());
+
+        char *rows = const_cast<char *>(begin + unit.rowsOffset);
+        if (n > 0 && unit.encoding != EncodingDouble)
+        {
+            blocks.push_back(Matrix());
+            codes.push_back(cv::Mat(n, unit.rowBytes, CV_8UC1, rows));
+        }
+        else if (n > 0)
+        {
+            blocks.push_back(Matrix(n, unit.stride, (double *)rows));
+            codes.push_back(cv::Mat());
+        }
+        else
+        {
+            blocks.push_back(Matrix());
+            codes.push_back(cv::Mat());
+        }
+    }
+
+    mapping = fileMapping;
+    return header.sequence;
+}
+
+void Gallery::convertTemplates(const MultiExtractor &extractor, const std::vector<std::string> &templatePaths,
+                               const std::string &galleryPath)
+{
+    Gallery gallery(extractor);
+    for (const std::string &templatePath : templatePaths)
+    {
+        gallery.add(MultiTemplate(templatePath));
+    }
+    gallery.serialize(galleryPath);
+}
@@ -0,0 +1,403 @@
+#include "faceCommon/biometrics/gallerystore.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#if defined WIN32 || defined _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace Face::Biometrics;
+
+namespace {
+
+/*
+ * Log file, all numbers little-endian:
+ *
+ *   char magic[4], int32 formatVersion, int64 epoch
+ *   records: RecordHeader followed by size bytes of payload, numbered from epoch + 1
+ *
+ * Payload of an enrollment: int32 version, float32 depthCoverage, int32 unitCount and
+ * for every unit int32 length followed by length float64 values of the raw feature vector.
+ * Tombstones have no payload.
+ */
+const char logMagic[4] = { 'F', 'G', 'L', 'G' };
+const int32_t logFormatVersion = 2;
+const int logHeaderSize = sizeof(logMagic) + sizeof(int32_t) + sizeof(int64_t);
+
+struct RecordHeader
+{
+    int32_t type;
+    int32_t id;
+    int32_t size;
+    uint32_t checksum;
+};
+
+uint32_t checksum(const char *data, int size)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool syncFile(FILE *file)
+{
+    if (fflush(file) != 0) return false;
+#if defined WIN32 || defined _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+template <typename T>
+void put(std::vector<char> &buffer, const T &value)
+{
+    const char *p = (const char *)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+bool get(const std::vector<char> &buffer, size_t &offset, T &value)
+{
+    if (offset + sizeof(T) > buffer.size()) return false;
+    std::memcpy(&value, buffer.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+}
+
+GalleryStore::GalleryStore(const MultiExtractor &extractor, std::string directoryPath, int compactionThreshold,
+                           Durability durability) :
+    extractor(extractor),
+    compactionThreshold(compactionThreshold),
+    durability(durability),
+    records(0),
+    sequence(0),
+    gallery(extractor),
+    log(0),
+    compactionRunnable(*this, &GalleryStore::runCompaction),
+    compactionStarted(false)
+{
+    if (directoryPath.back() != Poco::Path::separator())
+        directoryPath.push_back(Poco::Path::separator());
+
+    Poco::File dir(directoryPath);
+    if (!dir.exists()) dir.createDirectories();
+
+    snapshotPath = directoryPath + "gallery";
+    logPath = directoryPath + "gallery.log";
+
+    if (Poco::File(snapshotPath).exists())
+    {
+        sequence = gallery.deserialize(snapshotPath);
+    }
+    replayLog(sequence);
+}
+
+GalleryStore::~GalleryStore()
+{
+    {
+        Poco::FastMutex::ScopedLock lock(compactionMutex);
+        joinCompaction();
+    }
+    closeLog();
+}
+
+void GalleryStore::replayLog(int64_t snapshotSequence)
+{
+    Poco::File logFile(logPath);
+    if (!logFile.exists() || logFile.getSize() < (Poco::File::FileSize)logHeaderSize)
+    {
+        openLog(true);
+        return;
+    }
+
+    std::ifstream in(logPath, std::ios::binary);
+    char magic[4];
+    int32_t formatVersion = 0;
+    int64_t epoch = 0;
+    in.read(magic, 4);
+    in.read((char *)&formatVersion, sizeof(formatVersion));
+    if (!in || std::memcmp(magic, logMagic, 4) != 0) throw FACELIB_EXCEPTION(logPath + " is not a gallery log");
+    if (formatVersion != logFormatVersion)
+        throw FACELIB_EXCEPTION("unsupported gallery log version " + std::to_string(formatVersion));
+    in.read((char *)&epoch, sizeof(epoch));
+    if (!in) throw FACELIB_EXCEPTION(logPath + " is not a gallery log");
+
+    // a log started after a newer snapshot than the one present would replay changes out of order
+    if (epoch > snapshotSequence) throw FACELIB_EXCEPTION(logPath + " doesn't follow the snapshot " + snapshotPath);
+
+    std::streamoff validEnd = in.tellg();
+    int64_t recordSequence = epoch;
+    std::vector<char> payload;
+    while (true)
+    {
+        RecordHeader header;
+        if (!in.read((char *)&header, sizeof(RecordHeader))) break;
+        if (header.size < 0) break;
+
+        payload.resize(header.size);
+        if (header.size > 0 && !in.read(payload.data(), header.size)) break;
+        if (checksum(payload.data(), header.size) != header.checksum) break;
+        if (header.type != RecordAdd && header.type != RecordRemove)
+            throw FACELIB_EXCEPTION("unknown record type in " + logPath);
+
+        recordSequence++;
+        records++;
+        validEnd = in.tellg();
+
+        // already in the snapshot
+        if (recordSequence <= snapshotSequence) continue;
+
+        if (header.type == RecordAdd)
+        {
+            MultiTemplate t;
+            t.id = header.id;
+            size_t offset = 0;
+            int32_t unitCount = 0;
+            bool ok = get(payload, offset, t.version) && get(payload, offset, t.depthCoverage) && get(payload, offset, unitCount);
+            for (int u = 0; ok && u < unitCount; u++)
+            {
+                int32_t n = 0;
+                ok = get(payload, offset, n) && n >= 0 && offset + n * sizeof(double) <= payload.size();
+                if (!ok) break;
+
+                Face::LinAlg::Vector v(n);
+                std::memcpy(v.ptr<double>(), payload.data() + offset, n * sizeof(double));
+                offset += n * sizeof(double);
+                t.featureVectors.push_back(v);
+            }
+            if (!ok) throw FACELIB_EXCEPTION("corrupted enrollment record in " + logPath);
+            gallery.add(t);
+        }
+        else
+        {
+            gallery.remove(header.id);
+        }
+        sequence = recordSequence;
+    }
+    in.close();
+
+    // the compaction was interrupted after the snapshot was written, the log has nothing new
+    if (recordSequence <= snapshotSequence)
+    {
+        records = 0;
+        openLog(true);
+        return;
+    }
+
+    // drop the torn tail of an interrupted write
+    if ((Poco::File::FileSize)validEnd != logFile.getSize())
+    {
+        std::cout << "dropping incomplete record at the end of " << logPath << std::endl;
+        logFile.setSize(validEnd);
+    }
+    openLog(false);
+}
+
+void GalleryStore::openLog(bool truncate)
+{
+    closeLog();
+
+    if (truncate)
+    {
+        // the new log continues after the current gallery state
+        log = fopen(logPath.c_str(), "wb");
+        if (!log) throw FACELIB_EXCEPTION("can't open " + logPath);
+
+        int64_t epoch = sequence;
+        bool ok = fwrite(logMagic, 4, 1, log) == 1 &&
+                  fwrite(&logFormatVersion, sizeof(logFormatVersion), 1, log) == 1 &&
+                  fwrite(&epoch, sizeof(epoch), 1, log) == 1;
+        ok = ok && (durability == Sync ? syncFile(log) : fflush(log) == 0);
+        if (!ok) throw FACELIB_EXCEPTION("writing to " + logPath + " failed");
+    }
+    else
+    {
+        log = fopen(logPath.c_str(), "ab");
+        if (!log) throw FACELIB_EXCEPTION("can't open " + logPath);
+        fseek(log, 0, SEEK_END);
+    }
+}
+
+void GalleryStore::closeLog()
+{
+    if (log) fclose(log);
+    log = 0;
+}
+
+void GalleryStore::appendRecord(int type, int id, const std::vector<char> &payload)
+{
+    RecordHeader header;
+    header.type = type;
+    header.id = id;
+    header.size = payload.size();
+    header.checksum = checksum(payload.data(), payload.size());
+
+    long end = ftell(log);
+    bool ok = fwrite(&header, sizeof(RecordHeader), 1, log) == 1 &&
+              (payload.empty() || fwrite(payload.data(), payload.size(), 1, log) == 1);
+    ok = ok && (durability == Sync ? syncFile(log) : fflush(log) == 0);
+    if (!ok)
+    {
+        // don't leave a partial record in front of the following ones
+        closeLog();
+        if (end >= 0) Poco::File(logPath).setSize(end);
+        openLog(false);
+        throw FACELIB_EXCEPTION("writing to " + logPath + " failed");
+    }
+    records++;
+    sequence++;
+}
+
+void GalleryStore::add(const MultiTemplate &reference)
+{
+    bool compactionDue;
+    {
+        Poco::FastMutex::ScopedLock writeLock(writeMutex);
+
+        // the gallery changes only under writeMutex, it can be checked without galleryLock;
+        // a checked template is logged first so the log always replays
+        gallery.checkTemplate(reference);
+
+        std::vector<char> payload;
+        put(payload, (int32_t)reference.version);
+        put(payload, (float)reference.depthCoverage);
+        put(payload, (int32_t)reference.featureVectors.size());
+        for (const Face::LinAlg::Vector &v : reference.featureVectors)
+        {
+            put(payload, (int32_t)v.rows);
+            for (int i = 0; i < v.rows; i++) put(payload, v(i));
+        }
+        appendRecord(RecordAdd, reference.id, payload);
+
+        Poco::ScopedWriteRWLock lock(galleryLock);
+        gallery.add(reference);
+        compactionDue = compactionThreshold > 0 && records >= compactionThreshold;
+    }
+
+    if (compactionDue) compactAsync();
+}
+
+int GalleryStore::remove(int id)
+{
+    int removed;
+    bool compactionDue;
+    {
+        Poco::FastMutex::ScopedLock writeLock(writeMutex);
+        appendRecord(RecordRemove, id, std::vector<char>());
+
+        Poco::ScopedWriteRWLock lock(galleryLock);
+        removed = gallery.remove(id);
+        compactionDue = compactionThreshold > 0 && records >= compactionThreshold;
+    }
+
+    if (compactionDue) compactAsync();
+    return removed;
+}
+
+int GalleryStore::size() const
+{
+    Poco::ScopedReadRWLock lock(galleryLock);
+    return gallery.size();
+}
+
+std::vector<int> GalleryStore::ids() const
+{
+    Poco::ScopedReadRWLock lock(galleryLock);
+    std::set<int> unique;
+    for (int i = 0; i < gallery.size(); i++)
+    {
+        unique.insert(gallery.id(i));
+    }
+    return std::vector<int>(unique.begin(), unique.end());
+}
+
+std::vector<Gallery::Candidate> GalleryStore::identify(const MultiTemplate &probe, int topK) const
+{
+    Poco::ScopedReadRWLock lock(galleryLock);
+    return gallery.identify(probe, topK);
+}
+
+std::vector<Gallery::Candidate> GalleryStore::identifyCascade(const MultiTemplate &probe, int topK, double threshold) const
+{
+    Poco::ScopedReadRWLock lock(galleryLock);
+    return gallery.identifyCascade(probe, topK, threshold);
+}
+
+void GalleryStore::compact()
+{
+    Poco::FastMutex::ScopedLock writeLock(writeMutex);
+
+    // readers go on while the snapshot is written, only changes wait
+    std::string tmpPath = snapshotPath + ".tmp";
+    {
+        Poco::ScopedReadRWLock lock(galleryLock);
+        gallery.serialize(tmpPath, sequence);
+    }
+    if (durability == Sync)
+    {
+        FILE *snapshot = fopen(tmpPath.c_str(), "r+b");
+        bool ok = snapshot && syncFile(snapshot);
+        if (snapshot) fclose(snapshot);
+        if (!ok) throw FACELIB_EXCEPTION("writing of " + tmpPath + " failed");
+    }
+
+    // the old snapshot may still be mapped by the gallery; its data stay valid after the rename.
+    // A crash before the log is truncated leaves records the snapshot has, replay skips them
+    Poco::File(tmpPath).renameTo(snapshotPath);
+    openLog(true);
+    records = 0;
+}
+
+void GalleryStore::runCompaction()
+{
+    try
+    {
+        compact();
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "gallery compaction failed: " << e.what() << std::endl;
+        compactionError = e.what();
+    }
+}
+
+void GalleryStore::compactAsync()
+{
+    Poco::FastMutex::ScopedLock lock(compactionMutex);
+    if (compactionThread.isRunning()) return;
+
+    // the finished run has to be joined, otherwise its thread is never released
+    joinCompaction();
+    compactionError.clear();
+    compactionThread.start(compactionRunnable);
+    compactionStarted = true;
+}
+
+void GalleryStore::waitForCompaction()
+{
+    Poco::FastMutex::ScopedLock lock(compactionMutex);
+    joinCompaction();
+    if (!compactionError.empty()) throw FACELIB_EXCEPTION("gallery compaction failed: " + compactionError);
+}
+
+void GalleryStore::joinCompaction()
+{
+    if (!compactionStarted) return;
+    compactionThread.join();
+    compactionStarted = false;
+}
@@ -0,0 +1,247 @@
+#include "faceCommon/biometrics/imagedatacache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Process.h>
+#include <Poco/Thread.h>
+
+using namespace Face::Biometrics;
+
+namespace {
+
+/*
+ * Entry file:
+ *
+ *   char magic[4], int32 formatVersion, uint64 key
+ *   int32 typeCount, for every type: int32 nameLength, name, int32 rows, int32 cols, rows*cols float64 values
+ *   largeDepth: int32 w, int32 h, w*h float64 values, w*h int8 flags
+ *   depthConverter: float64 meshStart.x, meshStart.y, meshSize.x, meshSize.y
+ */
+const char entryMagic[4] = { 'F', 'I', 'M', 'D' };
+const int32_t entryFormatVersion = 1;
+
+const uint64_t fnvOffset = 14695981039346656037ULL;
+const uint64_t fnvPrime = 1099511628211ULL;
+
+uint64_t fnv1a(const char *data, size_t size, uint64_t hash = fnvOffset)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= fnvPrime;
+    }
+    return hash;
+}
+
+template <typename T>
+void put(std::vector<char> &buffer, const T &value)
+{
+    const char *p = (const char *)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+void putBytes(std::vector<char> &buffer, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    buffer.insert(buffer.end(), p, p + size);
+}
+
+template <typename T>
+bool get(const std::vector<char> &buffer, size_t &offset, T &value)
+{
+    if (offset + sizeof(T) > buffer.size()) return false;
+    std::memcpy(&value, buffer.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+bool getBytes(const std::vector<char> &buffer, size_t &offset, void *data, size_t size)
+{
+    if (offset + size > buffer.size()) return false;
+    std::memcpy(data, buffer.data() + offset, size);
+    offset += size;
+    return true;
+}
+
+// rows of the matrix one after another; the matrix may be a non-continuous region of interest
+template <typename T>
+void putMatrix(std::vector<char> &buffer, const cv::Mat_<T> &m)
+{
+    for (int r = 0; r < m.rows; r++)
+    {
+        putBytes(buffer, m.template ptr<T>(r), m.cols * sizeof(T));
+    }
+}
+
+template <typename T>
+bool getMatrix(const std::vector<char> &buffer, size_t &offset, int rows, int cols, cv::Mat_<T> &m)
+{
+    if (rows < 0 || cols < 0) return false;
+    if (offset + (size_t)rows * cols * sizeof(T) > buffer.size()) return false;
+    m = cv::Mat_<T>(rows, cols);
+    return getBytes(buffer, offset, m.data, (size_t)rows * cols * sizeof(T));
+}
+
+bool readFile(const std::string &path, std::vector<char> &buffer)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in.good()) return false;
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+}
+
+ImageDataCache::ImageDataCache(const std::string &directory) : directory(directory)
+{
+    if (this->directory.empty()) throw FACELIB_EXCEPTION("empty cache directory");
+    if (this->directory.back() != Poco::Path::separator()) this->directory.push_back(Poco::Path::separator());
+
+    Poco::File dir(this->directory);
+    if (!dir.exists()) dir.createDirectories();
+}
+
+unsigned long long ImageDataCache::key(const std::string &meshPath)
+{
+    std::ifstream in(meshPath.c_str(), std::ios::binary);
+    if (!in.good()) throw FACELIB_EXCEPTION("can't open " + meshPath);
+
+    uint64_t hash = fnvOffset;
+    std::vector<char> chunk(1 << 16);
+    while (in)
+    {
+        in.read(chunk.data(), chunk.size());
+        hash = fnv1a(chunk.data(), in.gcount(), hash);
+    }
+    if (in.bad()) throw FACELIB_EXCEPTION("can't read " + meshPath);
+
+    std::string params = MultiExtractor::ImageData::parameters();
+    return fnv1a(params.data(), params.size(), hash);
+}
+
+std::string ImageDataCache::entryPath(unsigned long long key) const
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".imagedata";
+    return directory + name.str();
+}
+
+MultiExtractor::ImageData ImageDataCache::get(const std::string &meshPath) const
+{
+    unsigned long long k = key(meshPath);
+
+    MultiExtractor::ImageData data;
+    if (load(k, data)) return data;
+
+    data = MultiExtractor::ImageData(Face::FaceData::Mesh::fromFile(meshPath));
+    store(k, data);
+    return data;
+}
+
+bool ImageDataCache::load(unsigned long long key, MultiExtractor::ImageData &data) const
+{
+    std::vector<char> buffer;
+    if (!readFile(entryPath(key), buffer)) return false;
+
+    size_t offset = 0;
+    char magic[4];
+    int32_t version;
+    uint64_t storedKey;
+    if (!getBytes(buffer, offset, magic, 4) || std::memcmp(magic, entryMagic, 4) != 0) return false;
+    if (!get(buffer, offset, version) || version != entryFormatVersion) return false;
+    if (!get(buffer, offset, storedKey) || storedKey != key) return false;
+
+    MultiExtractor::ImageData result;
+    int32_t typeCount;
+    if (!get(buffer, offset, typeCount) || typeCount < 0) return false;
+    for (int i = 0; i < typeCount; i++)
+    {
+        int32_t nameLength, rows, cols;
+        if (!get(buffer, offset, nameLength) || nameLength < 0 || offset + nameLength > buffer.size()) return false;
+        std::string name(buffer.data() + offset, nameLength);
+        offset += nameLength;
+
+        Matrix m;
+        if (!get(buffer, offset, rows) || !get(buffer, offset, cols)) return false;
+        if (!getMatrix(buffer, offset, rows, cols, m)) return false;
+        result.typeDict[name] = m;
+    }
+
+    int32_t w, h;
+    if (!get(buffer, offset, w) || !get(buffer, offset, h)) return false;
+    result.largeDepth.w = w;
+    result.largeDepth.h = h;
+    if (!getMatrix(buffer, offset, h, w, result.largeDepth.values)) return false;
+    if (!getMatrix(buffer, offset, h, w, result.largeDepth.flags)) return false;
+
+    FaceData::MapConverter &converter = result.depthConverter;
+    if (!get(buffer, offset, converter.meshStart.x) || !get(buffer, offset, converter.meshStart.y) ||
+        !get(buffer, offset, converter.meshSize.x) || !get(buffer, offset, converter.meshSize.y)) return false;
+    if (offset != buffer.size()) return false;
+
+    data = result;
+    return true;
+}
+
+void ImageDataCache::store(unsigned long long key, const MultiExtractor::ImageData &data) const
+{
+    std::vector<char> buffer;
+    putBytes(buffer, entryMagic, 4);
+    put(buffer, entryFormatVersion);
+    put(buffer, (uint64_t)key);
+
+    put(buffer, (int32_t)data.typeDict.size());
+    for (const auto &kvp : data.typeDict)
+    {
+        put(buffer, (int32_t)kvp.first.size());
+        putBytes(buffer, kvp.first.data(), kvp.first.size());
+        put(buffer, (int32_t)kvp.second.rows);
+        put(buffer, (int32_t)kvp.second.cols);
+        putMatrix(buffer, kvp.second);
+    }
+
+    const FaceData::Map &map = data.largeDepth;
+    put(buffer, (int32_t)map.w);
+    put(buffer, (int32_t)map.h);
+    putMatrix(buffer, map.values);
+    putMatrix(buffer, map.flags);
+
+    put(buffer, data.depthConverter.meshStart.x);
+    put(buffer, data.depthConverter.meshStart.y);
+    put(buffer, data.depthConverter.meshSize.x);
+    put(buffer, data.depthConverter.meshSize.y);
+
+    // written aside and renamed, so concurrent readers never see a partial entry;
+    // a failed write just leaves the entry uncached
+    std::string path = entryPath(key);
+    std::ostringstream tmpName;
+    tmpName << path << "." << Poco::Process::id() << "." << Poco::Thread::currentTid() << ".tmp";
+    std::string tmpPath = tmpName.str();
+    {
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(buffer.data(), buffer.size());
+        out.close();
+        if (out.fail())
+        {
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+
+    try
+    {
+        Poco::File(tmpPath).renameTo(path);
+    }
+    catch (Poco::Exception &)
+    {
+        std::remove(tmpPath.c_str());
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * Preprocessing of MultiExtractor::ImageData(mesh), shared by multiextractor.cpp and the
+ * ImageDataThreadPool. All of it is written by ImageData::parameters(), the ImageDataCache key,
+ * so the cached and the freshly computed image data can't differ.
+ */
+
+#include <opencv2/core/core.hpp>
+
+namespace Face {
+namespace Biometrics {
+namespace ImageDataParams {
+
+const cv::Rect imageRoi(25, 15, 100, 90);
+const cv::Point2d depthmapTopLeft(-75, -75);
+const cv::Point2d depthmapBottomRight(75, 75);
+const double depthmapScale = 1;
+const double largeDepthScale = 2;
+const double depthMin = -70;
+const double depthMax = 10;
+const int blurSize = 7;
+const int blurTimes = 3;
+
+struct Range
+{
+    double min;
+    double max;
+};
+const Range textureRange = { 0, 255 };
+const Range meanRange = { -0.1, 0.1 };
+const Range gaussRange = { -0.01, 0.01 };
+const Range indexRange = { 0, 1 };
+const Range eigencurRange = { 0, 0.0025 };
+
+/*
+ * Increase whenever the processing changes without a change of the values above:
+ * 2 - closed form curvatures, multi-channel and tiled rasterization of the depthmaps
+ */
+const int imageDataVersion = 2;
+
+}
+}
+}
@@ -1,6 +1,9 @@
 #include "faceCommon/biometrics/imagedatathreadpool.h"
 
+#include "imagedataparams.h"
+
 using namespace Face::Biometrics;
+using namespace Face::Biometrics::ImageDataParams;
 
 void ImageDataThreadPool::TextureThread::setUp(const Face::FaceData::Mesh *mesh)
 {
@@ -9,45 +12,61 @@ void ImageDataThreadPool::TextureThread::setUp(const Face::FaceData::Mesh *mesh)
 
 void ImageDataThreadPool::TextureThread::run()
 {
-    cv::Rect roi(25, 15, 100, 90);
     FaceData::MapConverter converter;
-    FaceData::Map textureMap = Face::FaceData::SurfaceProcessor::depthmap(*mesh, converter, cv::Point2d(-75, -75),
-                                                                    cv::Point2d(75, 75), 1,
+    FaceData::Map textureMap = Face::FaceData::SurfaceProcessor::depthmap(*mesh, converter, depthmapTopLeft,
+                                                                    depthmapBottomRight, depthmapScale,
                                                                     Face::FaceData::SurfaceProcessor::Texture_I);
-    result = textureMap.toMatrix(0, 0, 255)(roi);
+    result = textureMap.toMatrix(0, textureRange.min, textureRange.max)(imageRoi);
 }
 
-void ImageDataThreadPool::DepthAndCurvatureThread::setUp(const Face::FaceData::Mesh *mesh)
+void ImageDataThreadPool::DepthAndCurvatureThread::setUp(const Face::FaceData::Mesh *mesh,
+                                                         const std::set<std::string> *types)
 {
     this->mesh = mesh;
+    this->types = types;
 }
 
 void ImageDataThreadPool::DepthAndCurvatureThread::run()
 {
-    cv::Rect roi(25, 15, 100, 90);
+    const cv::Rect &roi = imageRoi;
     Face::FaceData::MapConverter converter;
 
-    Face::FaceData::Map depthmap = FaceData::SurfaceProcessor::depthmap(*mesh, converter, cv::Point2d(-75, -75),
-                                                                  cv::Point2d(75, 75), 1,
+    Face::FaceData::Map depthmap = FaceData::SurfaceProcessor::depthmap(*mesh, converter, depthmapTopLeft,
+                                                                  depthmapBottomRight, depthmapScale,
                                                                   Face::FaceData::SurfaceProcessor::ZCoord);
-    depthmap.bandPass(-70, 10, false, false);
-    depth = depthmap.toMatrix(0, -70, 10)(roi);
-
-    Face::FaceData::Map smoothedDepthmap = depthmap;
-    smoothedDepthmap.applyCvGaussBlur(7, 3);
-    Face::FaceData::CurvatureStruct cs = Face::FaceData::SurfaceProcessor::calculateCurvatures(smoothedDepthmap);
-
-    cs.curvatureMean.bandPass(-0.1, 0.1, false, false);
-    mean = cs.meanMatrix()(roi);
+    depthmap.bandPass(depthMin, depthMax, false, false);
+    depth = depthmap.toMatrix(0, depthMin, depthMax)(roi);
 
-    cs.curvatureGauss.bandPass(-0.01, 0.01, false, false);
-    gauss = cs.gaussMatrix()(roi);
+    if (!types->count("mean") && !types->count("gauss") && !types->count("index") && !types->count("eigencur"))
+        return;
 
-    cs.curvatureIndex.bandPass(0, 1, false, false);
-    index = cs.indexMatrix()(roi);
-
-    cs.curvaturePcl.bandPass(0, 0.0025, false, false);
-    eigencur = cs.pclMatrix()(roi);
+    Face::FaceData::Map smoothedDepthmap = depthmap;
+    smoothedDepthmap.applyCvGaussBlur(blurSize, blurTimes);
+    int outputs = (types->count("mean") ? Face::FaceData::SurfaceProcessor::CurvatureMean : 0) |
+                  (types->count("gauss") ? Face::FaceData::SurfaceProcessor::CurvatureGauss : 0) |
+                  (types->count("index") ? Face::FaceData::SurfaceProcessor::CurvatureIndex : 0) |
+                  (types->count("eigencur") ? Face::FaceData::SurfaceProcessor::CurvaturePcl : 0);
+    Face::FaceData::CurvatureStruct cs = Face::FaceData::SurfaceProcessor::calculateCurvatures(smoothedDepthmap, outputs);
+    if (types->count("mean"))
+    {
+        cs.curvatureMean.bandPass(meanRange.min, meanRange.max, false, false);
+        mean = cs.meanMatrix()(roi);
+    }
+    if (types->count("gauss"))
+    {
+        cs.curvatureGauss.bandPass(gaussRange.min, gaussRange.max, false, false);
+        gauss = cs.gaussMatrix()(roi);
+    }
+    if (types->count("index"))
+    {
+        cs.curvatureIndex.bandPass(indexRange.min, indexRange.max, false, false);
+        index = cs.indexMatrix()(roi);
+    }
+    if (types->count("eigencur"))
+    {
+        cs.curvaturePcl.bandPass(eigencurRange.min, eigencurRange.max, false, false);
+        eigencur = cs.pclMatrix()(roi);
+    }
 }
 
 void ImageDataThreadPool::LargeDepthThread::setUp(const Face::FaceData::Mesh *mesh)
@@ -57,33 +76,41 @@ void ImageDataThreadPool::LargeDepthThread::setUp(const Face::FaceData::Mesh *me
 
 void ImageDataThreadPool::LargeDepthThread::run()
 {
-    result = Face::FaceData::SurfaceProcessor::depthmap(*mesh, converter, 2.0, Face::FaceData::SurfaceProcessor::ZCoord);
+    result = Face::FaceData::SurfaceProcessor::depthmap(*mesh, converter, largeDepthScale, Face::FaceData::SurfaceProcessor::ZCoord);
 }
 
-MultiExtractor::ImageData ImageDataThreadPool::process(const Face::FaceData::Mesh *mesh)
+MultiExtractor::ImageData ImageDataThreadPool::process(const Face::FaceData::Mesh *mesh,
+                                                       const std::set<std::string> &types)
 {
     MultiExtractor::ImageData result;
 
+    bool texture = types.count("texture") > 0;
+    bool largeDepth = types.count(MultiExtractor::ImageData::largeDepthType) > 0;
+
+    // the depth map is always rasterized, it is needed for the depth coverage
     textureThread.setUp(mesh);
-    depthAndCurvatureThread.setUp(mesh);
+    depthAndCurvatureThread.setUp(mesh, &types);
     largeDepthThread.setUp(mesh);
 
-    start(textureThread, "extract-texture");
+    if (texture) start(textureThread, "extract-texture");
     start(depthAndCurvatureThread, "extract-curvature");
-    start(largeDepthThread, "extract-largeDepth");
+    if (largeDepth) start(largeDepthThread, "extract-largeDepth");
 
     joinAll();
 
-    result.depthConverter = largeDepthThread.converter;
-    result.largeDepth = largeDepthThread.result;
+    if (largeDepth)
+    {
+        result.depthConverter = largeDepthThread.converter;
+        result.largeDepth = largeDepthThread.result;
+    }
 
-    result.typeDict["texture"] = textureThread.result.clone();
+    if (texture) result.typeDict["texture"] = textureThread.result.clone();
 
     result.typeDict["depth"] = depthAndCurvatureThread.depth.clone();
-    result.typeDict["mean"] = depthAndCurvatureThread.mean.clone();
-    result.typeDict["gauss"] = depthAndCurvatureThread.gauss.clone();
-    result.typeDict["index"] = depthAndCurvatureThread.index.clone();
-    result.typeDict["eigencur"] = depthAndCurvatureThread.eigencur.clone();
+    if (types.count("mean")) result.typeDict["mean"] = depthAndCurvatureThread.mean.clone();
+    if (types.count("gauss")) result.typeDict["gauss"] = depthAndCurvatureThread.gauss.clone();
+    if (types.count("index")) result.typeDict["index"] = depthAndCurvatureThread.index.clone();
+    if (types.count("eigencur")) result.typeDict["eigencur"] = depthAndCurvatureThread.eigencur.clone();
 
     return result;
 }
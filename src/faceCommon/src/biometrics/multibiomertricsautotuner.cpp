@@ -9,6 +9,8 @@
 #include "faceCommon/linalg/loader.h"
 #include "faceCommon/biometrics/scorelevelfusionwrapper.h"
 #include "faceCommon/biometrics/template.h"
+#include "faceCommon/biometrics/allpairs.h"
+#include "faceCommon/biometrics/imagedatacache.h"
 
 using namespace Face::Biometrics;
 
@@ -31,11 +33,15 @@ MultiBiomertricsAutoTuner::Input MultiBiomertricsAutoTuner::Input::fromAlignedMe
 
 MultiBiomertricsAutoTuner::Input MultiBiomertricsAutoTuner::Input::fromDirectoryWithAlignedMeshes(const std::string &path,
                                                                                                   const std::string &idAndScanSeparator,
-                                                                                                  int maxCount, int startIndex)
+                                                                                                  int maxCount, int startIndex,
+                                                                                                  const std::string &cacheDirectory)
 {
     std::string dir = path;
     if (dir.back() != Poco::Path::separator()) dir.push_back(Poco::Path::separator());
 
+    cv::Ptr<ImageDataCache> cache;
+    if (!cacheDirectory.empty()) cache = new ImageDataCache(cacheDirectory);
+
     Input result;
     std::vector<std::string> nameFilters;
     nameFilters.push_back("*.bin"); nameFilters.push_back("*.binz"); nameFilters.push_back("*.obj");
@@ -56,8 +62,15 @@ MultiBiomertricsAutoTuner::Input MultiBiomertricsAutoTuner::Input::fromDirectory
         const std::string &f = files[i];
         result.ids[i-startIndex] = Poco::NumberParser::parse(Poco::StringTokenizer(f, idAndScanSeparator)[0]);
 
-        FaceData::Mesh mesh = FaceData::Mesh::fromFile(dir + f);
-        result.imageData[i - startIndex] = MultiExtractor::ImageData(mesh);
+        if (!cache.empty())
+        {
+            result.imageData[i - startIndex] = cache->get(dir + f);
+        }
+        else
+        {
+            FaceData::Mesh mesh = FaceData::Mesh::fromFile(dir + f);
+            result.imageData[i - startIndex] = MultiExtractor::ImageData(mesh);
+        }
     }
 
     return result;
@@ -99,13 +112,13 @@ MultiBiomertricsAutoTuner::Input MultiBiomertricsAutoTuner::Input::fromDirectory
 }
 
 MultiBiomertricsAutoTuner::Settings::Settings() :
-    fusionType(ScoreWeightedSumFusion::name())
+    fusionType(ScoreWeightedSumFusion::name()), quantizerType(Face::LinAlg::Quantizer::None)
 {
 
 }
 
 MultiBiomertricsAutoTuner::Settings::Settings(const std::string &fusionType, const std::string &unitsParametersFile) :
-    fusionType(fusionType)
+    fusionType(fusionType), quantizerType(Face::LinAlg::Quantizer::None)
 {
     std::ifstream in(unitsParametersFile);
     std::string line;
@@ -151,6 +164,11 @@ MultiExtractor::Ptr MultiBiomertricsAutoTuner::trainWithWrapper(const Input &sou
                                              targetDatabaseTrainData, evaluations, selectedUnitIndex));
     }
 
+    if (settings.quantizerType != Face::LinAlg::Quantizer::None)
+    {
+        quantize(*extractor, targetDatabaseTrainData, settings.quantizerType);
+    }
+
     return extractor;
 }
 
@@ -168,6 +186,12 @@ MultiExtractor::Ptr MultiBiomertricsAutoTuner::trainAllUnits(const Input &source
         extractor->fusion->addComponent(evaluations[i]);
     }
     extractor->fusion->learn();
+
+    if (settings.quantizerType != Face::LinAlg::Quantizer::None)
+    {
+        quantize(*extractor, targetDatabaseTrainData, settings.quantizerType);
+    }
+
     return extractor;
 }
 
@@ -190,3 +214,80 @@ MultiExtractor::Unit::Ptr MultiBiomertricsAutoTuner::trainUnit(const std::string
 
     return unit;
 }
+
+std::vector<MultiBiomertricsAutoTuner::QuantizationResult> MultiBiomertricsAutoTuner::quantize(
+        MultiExtractor &extractor, const Input &trainData, Face::LinAlg::Quantizer::Type type)
+{
+    std::cout << "Quantization (" << Face::LinAlg::Quantizer::typeName(type) << ") of "
+              << extractor.units.size() << " units" << std::endl;
+
+    std::vector<QuantizationResult> results;
+    int count = trainData.ids.size();
+    AllPairs pairs(trainData.ids);
+    for (const MultiExtractor::Unit::Ptr &unit : extractor.units)
+    {
+        const Face::LinAlg::Metrics &metrics = *unit->metrics;
+        std::vector<Face::LinAlg::Vector> prepared(count);
+        #pragma omp parallel for
+        for (int i = 0; i < count; i++)
+        {
+            prepared[i] = metrics.prepare(unit->extract(trainData.imageData[i]));
+        }
+
+        std::vector<double> genuine, impostor;
+        pairs.compute([&](int i, int j) { return metrics.preparedDistance(prepared[i], prepared[j]); }, genuine, impostor);
+        Evaluation baseline(genuine, impostor);
+
+        Face::LinAlg::Quantizer::Ptr quantizer = new Face::LinAlg::Quantizer(type, prepared);
+        int n = prepared.empty() ? 0 : prepared[0].rows;
+        int rowSize = n * quantizer->valueSize();
+        std::vector<unsigned char> codes(count * rowSize);
+        for (int i = 0; i < count; i++)
+        {
+            quantizer->encode(prepared[i].ptr<double>(), n, codes.data() + i*rowSize);
+        }
+
+        pairs.computeBlocks([&](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+        {
+            std::vector<double> buffer(2 * n);
+            for (int i = iStart; i < iEnd; i++)
+            {
+                for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+                {
+                    scores(i - iStart, j - jStart) = metrics.rawQuantizedDistance(*quantizer, codes.data() + i*rowSize,
+                                                                                  codes.data() + j*rowSize, n, buffer.data());
+                }
+            }
+        }, genuine, impostor);
+        Evaluation quantized(genuine, impostor);
+
+        QuantizationResult r;
+        r.unit = unit->writeParams();
+        r.baselineEer = baseline.eer;
+        r.quantizedEer = quantized.eer;
+        r.bytes = n * sizeof(double);
+        r.quantizedBytes = rowSize;
+        results.push_back(r);
+
+        std::cout << r.unit << ": EER " << r.baselineEer << " -> " << r.quantizedEer
+                  << " (" << Face::LinAlg::Quantizer::typeName(type) << ", " << r.bytes << " -> " << r.quantizedBytes << " bytes)" << std::endl;
+
+        unit->quantizer = quantizer;
+    }
+
+    double baselineSum = 0, quantizedSum = 0;
+    int bytes = 0, quantizedBytes = 0;
+    for (const QuantizationResult &r : results)
+    {
+        baselineSum += r.baselineEer;
+        quantizedSum += r.quantizedEer;
+        bytes += r.bytes;
+        quantizedBytes += r.quantizedBytes;
+    }
+    if (!results.empty())
+    {
+        std::cout << "mean EER " << baselineSum/results.size() << " -> " << quantizedSum/results.size()
+                  << ", template " << bytes << " -> " << quantizedBytes << " bytes" << std::endl;
+    }
+    return results;
+}
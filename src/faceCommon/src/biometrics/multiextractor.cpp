@@ -5,6 +5,7 @@
 #include <Poco/Path.h>
 #include <Poco/File.h>
 #include <fstream>
+#include <sstream>
 
 #include "faceCommon/linalg/gabor.h"
 #include "faceCommon/linalg/gausslaguerre.h"
@@ -16,43 +17,91 @@
 #include "faceCommon/linalg/imagefilter.h"
 #include "faceCommon/biometrics/extractorthreadpool.h"
 #include "faceCommon/biometrics/imagedatathreadpool.h"
+#include "faceCommon/biometrics/gallery.h"
+#include "faceCommon/biometrics/allpairs.h"
+#include "faceCommon/biometrics/crossvalidation.h"
+#include "imagedataparams.h"
 
 using namespace Face::Biometrics;
+using namespace Face::Biometrics::ImageDataParams;
 
-MultiExtractor::ImageData::ImageData(const Face::FaceData::Mesh &mesh)
+MultiExtractor::ImageData::ImageData(const Face::FaceData::Mesh &mesh) : ImageData(mesh, getAllTypes())
 {
-    cv::Rect roi(25, 15, 100, 90);
-    FaceData::MapConverter converter;
-    FaceData::Map textureMap = FaceData::SurfaceProcessor::depthmap(mesh, converter, cv::Point2d(-75, -75),
-                                                                    cv::Point2d(75, 75), 1,
-                                                                    FaceData::SurfaceProcessor::Texture_I);
-    Matrix texture = textureMap.toMatrix(0, 0, 255)(roi);
-    typeDict["texture"] = texture;
 
-    FaceData::Map depthmap = FaceData::SurfaceProcessor::depthmap(mesh, converter, cv::Point2d(-75, -75),
-                                                                  cv::Point2d(75, 75), 1,
-                                                                  FaceData::SurfaceProcessor::ZCoord);
-    depthmap.bandPass(-70, 10, false, false);
-    typeDict["depth"] = depthmap.toMatrix(0, -70, 10)(roi);
-
-    FaceData::Map smoothedDepthmap = depthmap;
-    smoothedDepthmap.applyCvGaussBlur(7, 3);
-    FaceData::CurvatureStruct cs = FaceData::SurfaceProcessor::calculateCurvatures(smoothedDepthmap);
+}
 
-    cs.curvatureMean.bandPass(-0.1, 0.1, false, false);
-    typeDict["mean"] = cs.meanMatrix()(roi);
+MultiExtractor::ImageData::ImageData(const Face::FaceData::Mesh &mesh, const std::set<std::string> &types)
+{
+    const cv::Rect &roi = imageRoi;
+    bool texture = types.count("texture") > 0;
+    bool curvatures = types.count("mean") || types.count("gauss") || types.count("index") || types.count("eigencur");
+    bool depth = curvatures || types.count("depth");
+    bool large = types.count(largeDepthType) > 0;
+
+    // all maps are rasterized in one pass over the triangles
+    std::vector<FaceData::SurfaceProcessor::SurfaceDataToProcess> channels;
+    if (texture) channels.push_back(FaceData::SurfaceProcessor::Texture_I);
+    if (depth) channels.push_back(FaceData::SurfaceProcessor::ZCoord);
+    std::vector<FaceData::DepthmapTarget> targets;
+    if (!channels.empty())
+    {
+        targets.push_back(FaceData::DepthmapTarget(depthmapTopLeft, depthmapBottomRight, depthmapScale, channels));
+    }
+    if (large)
+    {
+        targets.push_back(FaceData::DepthmapTarget(mesh, largeDepthScale, std::vector<FaceData::SurfaceProcessor::SurfaceDataToProcess>(
+                                                       1, FaceData::SurfaceProcessor::ZCoord)));
+    }
+    FaceData::SurfaceProcessor::depthmaps(mesh, targets);
 
-    cs.curvatureGauss.bandPass(-0.01, 0.01, false, false);
-    typeDict["gauss"] = cs.gaussMatrix()(roi);
+    if (texture)
+    {
+        typeDict["texture"] = targets[0].map(FaceData::SurfaceProcessor::Texture_I).toMatrix(0, textureRange.min, textureRange.max)(roi);
+    }
 
-    cs.curvatureIndex.bandPass(0, 1, false, false);
-    typeDict["index"] = cs.indexMatrix()(roi);
+    if (depth)
+    {
+        FaceData::Map depthmap = targets[0].map(FaceData::SurfaceProcessor::ZCoord);
+        depthmap.bandPass(depthMin, depthMax, false, false);
+        if (types.count("depth")) typeDict["depth"] = depthmap.toMatrix(0, depthMin, depthMax)(roi);
 
-    cs.curvaturePcl.bandPass(0, 0.0025, false, false);
-    typeDict["eigencur"] = cs.pclMatrix()(roi);
+        if (curvatures)
+        {
+            FaceData::Map smoothedDepthmap = depthmap;
+            smoothedDepthmap.applyCvGaussBlur(blurSize, blurTimes);
+            int outputs = (types.count("mean") ? FaceData::SurfaceProcessor::CurvatureMean : 0) |
+                          (types.count("gauss") ? FaceData::SurfaceProcessor::CurvatureGauss : 0) |
+                          (types.count("index") ? FaceData::SurfaceProcessor::CurvatureIndex : 0) |
+                          (types.count("eigencur") ? FaceData::SurfaceProcessor::CurvaturePcl : 0);
+            FaceData::CurvatureStruct cs = FaceData::SurfaceProcessor::calculateCurvatures(smoothedDepthmap, outputs);
+            if (types.count("mean"))
+            {
+                cs.curvatureMean.bandPass(meanRange.min, meanRange.max, false, false);
+                typeDict["mean"] = cs.meanMatrix()(roi);
+            }
+            if (types.count("gauss"))
+            {
+                cs.curvatureGauss.bandPass(gaussRange.min, gaussRange.max, false, false);
+                typeDict["gauss"] = cs.gaussMatrix()(roi);
+            }
+            if (types.count("index"))
+            {
+                cs.curvatureIndex.bandPass(indexRange.min, indexRange.max, false, false);
+                typeDict["index"] = cs.indexMatrix()(roi);
+            }
+            if (types.count("eigencur"))
+            {
+                cs.curvaturePcl.bandPass(eigencurRange.min, eigencurRange.max, false, false);
+                typeDict["eigencur"] = cs.pclMatrix()(roi);
+            }
+        }
+    }
 
-    this->largeDepth = FaceData::SurfaceProcessor::depthmap(mesh, this->depthConverter, 2.0,
-                                                            FaceData::SurfaceProcessor::ZCoord);
+    if (large)
+    {
+        this->largeDepth = targets.back().maps[0];
+        this->depthConverter = targets.back().converter;
+    }
 
     /*for (const std::pair<std::string, Matrix> &kvp : typeDict)
     {
@@ -61,6 +110,25 @@ MultiExtractor::ImageData::ImageData(const Face::FaceData::Mesh &mesh)
     cv::waitKey(0);*/
 }
 
+std::string MultiExtractor::ImageData::parameters()
+{
+    std::ostringstream params;
+    params.precision(10);
+    params << "version=" << imageDataVersion
+           << ";roi=" << imageRoi.x << "," << imageRoi.y << "," << imageRoi.width << "," << imageRoi.height
+           << ";depthmap=" << depthmapTopLeft.x << "," << depthmapTopLeft.y << ","
+           << depthmapBottomRight.x << "," << depthmapBottomRight.y << "," << depthmapScale
+           << ";texture=" << textureRange.min << "," << textureRange.max
+           << ";depth=" << depthMin << "," << depthMax
+           << ";blur=" << blurSize << "," << blurTimes
+           << ";mean=" << meanRange.min << "," << meanRange.max
+           << ";gauss=" << gaussRange.min << "," << gaussRange.max
+           << ";index=" << indexRange.min << "," << indexRange.max
+           << ";eigencur=" << eigencurRange.min << "," << eigencurRange.max
+           << ";largeDepth=" << largeDepthScale;
+    return params.str();
+}
+
 MultiExtractor::ImageData::ImageData(const ImageGrayscale &textureImage)
 {
     typeDict["texture"] = LinAlg::MatrixConverter::grayscaleImageToDoubleMatrix(textureImage);
@@ -78,6 +146,16 @@ std::vector<std::string> MultiExtractor::ImageData::getTypes()
     return types;
 }
 
+std::set<std::string> MultiExtractor::ImageData::getAllTypes()
+{
+    std::vector<std::string> types = getTypes();
+    std::set<std::string> result(types.begin(), types.end());
+    result.insert(largeDepthType);
+    return result;
+}
+
+const std::string MultiExtractor::ImageData::largeDepthType = "largeDepth";
+
 MultiExtractor::Unit::Ptr MultiExtractor::Unit::parse(const std::string &params)
 {
     Poco::StringTokenizer items(params, " ");
@@ -278,6 +356,11 @@ MultiExtractor::MultiExtractor(std::string directoryPath) : extractorThreadPool(
             throw FACELIB_EXCEPTION("can't open units file " + unitsPath);
         }
         unit->featureExtractor->deserialize(storage);
+        if (!storage["quantization"].isNone())
+        {
+            unit->quantizer = new Face::LinAlg::Quantizer();
+            unit->quantizer->deserialize(storage);
+        }
 
         units.push_back(unit);
         index++;
@@ -332,9 +415,21 @@ void MultiExtractor::serialize(std::string directoryPath) const
         cv::FileStorage storage(filename, cv::FileStorage::WRITE);
 
         p->featureExtractor->serialize(storage);
+        if (!p->quantizer.empty()) p->quantizer->serialize(storage);
     }
 }
 
+std::set<std::string> MultiExtractor::requiredTypes() const
+{
+    std::set<std::string> types;
+    types.insert("depth");
+    for (const Unit::Ptr &u : units)
+    {
+        types.insert(u->requiredType());
+    }
+    return types;
+}
+
 MultiTemplate MultiExtractor::extract(const ImageData &data, int version, int id) const
 {
     MultiTemplate t; t.id = id; t.version = version;
@@ -366,14 +461,15 @@ MultiTemplate MultiExtractor::extract(const ImageData &data, int version, int id
 
 MultiTemplate MultiExtractor::extract(const Face::FaceData::Mesh &mesh, int version, int id) const
 {
+    std::set<std::string> types = requiredTypes();
     if (imageDataThreadPool)
     {
-        ImageData data = imageDataThreadPool->process(&mesh);
+        ImageData data = imageDataThreadPool->process(&mesh, types);
         return extract(data, version, id);
     }
     else
     {
-        ImageData data(mesh);
+        ImageData data(mesh, types);
         return extract(data, version, id);
     }
 }
@@ -464,23 +560,63 @@ Evaluation MultiExtractor::evaluate(const std::vector<MultiTemplate> &templates)
     std::vector<double> genScores;
     std::vector<double> impScores;
 
-    int n = templates.size();
-    for (int i = 0; i < (n-1); i++)
+    std::vector<int> ids;
+    for (const MultiTemplate &t : templates)
+        ids.push_back(t.id);
+
+    AllPairs pairs(ids);
+    pairs.compute([&](int i, int j) { return compare(templates[i], templates[j]).score; }, genScores, impScores);
+    return Evaluation(genScores, impScores);
+}
+
+BatchEvaluationResult MultiExtractor::evaluate(const std::vector<std::vector<MultiTemplate> > &folds,
+                                               long long exactPairLimit) const
+{
+    unsigned int unitCount = units.size();
+    CrossValidation crossValidation;
+    for (const std::vector<MultiTemplate> &templates : folds)
     {
-        for (int j = i+1; j < n; j++)
+        std::vector<int> ids;
+        for (const MultiTemplate &t : templates)
         {
-            double s = compare(templates[i], templates[j]).score;
-            if (templates[i].id == templates[j].id)
+            if (t.version != templates[0].version) throw FACELIB_EXCEPTION("templates have different versions");
+            if (t.featureVectors.size() != unitCount) throw FACELIB_EXCEPTION("feature vector and units count mismatch");
+            ids.push_back(t.id);
+        }
+
+        // unit distances of a tile are fused at once
+        crossValidation.addFold(ids, [this, &templates, unitCount](int iStart, int iEnd, int jStart, int jEnd, Matrix &scores)
+        {
+            std::vector<std::pair<int, int> > tilePairs;
+            for (int i = iStart; i < iEnd; i++)
             {
-                genScores.push_back(s);
+                for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+                {
+                    tilePairs.push_back(std::make_pair(i, j));
+                }
             }
-            else
+            if (tilePairs.empty()) return;
+
+            Matrix distances(tilePairs.size(), unitCount);
+            for (unsigned int p = 0; p < tilePairs.size(); p++)
             {
-                impScores.push_back(s);
+                const MultiTemplate &first = templates[tilePairs[p].first];
+                const MultiTemplate &second = templates[tilePairs[p].second];
+                for (unsigned int u = 0; u < unitCount; u++)
+                {
+                    distances(p, u) = units[u]->metrics->distance(first.featureVectors[u], second.featureVectors[u]);
+                }
             }
-        }
+
+            std::vector<double> fused = fusion->fuseBatch(distances);
+            for (unsigned int p = 0; p < tilePairs.size(); p++)
+            {
+                scores(tilePairs[p].first - iStart, tilePairs[p].second - jStart) = fused[p];
+            }
+        });
     }
-    return Evaluation(genScores, impScores);
+
+    return crossValidation.evaluate(exactPairLimit);
 }
 
 double MultiExtractor::rankOneIdentification(const std::vector<MultiTemplate> &templates) const
@@ -500,26 +636,15 @@ double MultiExtractor::rankOneIdentification(const std::vector<MultiTemplate> &t
         }
     }
 
-    std::vector<MultiTemplate> references;
+    Gallery gallery(*this);
     for (const auto &pair : referenceTemplatesDict)
-        references.push_back(pair.second);
+        gallery.add(pair.second);
 
     int matchCount = 0;
     for (const MultiTemplate &probe : probes)
     {
-        double minScore = DBL_MAX;
-        int minId = -1;
-        for (const MultiTemplate &reference : references)
-        {
-            double s = compare(reference, probe).score;
-            if (s < minScore)
-            {
-                minScore = s;
-                minId = reference.id;
-            }
-        }
-
-        if (minId == probe.id)
+        std::vector<Gallery::Candidate> candidates = gallery.identifyCascade(probe, 1);
+        if (!candidates.empty() && candidates[0].id == probe.id)
         {
             matchCount++;
         }
@@ -554,17 +679,28 @@ void MultiExtractor::createPerSubjectScoreCharts(const std::vector<MultiTemplate
         genScores[templates[i].id] = std::vector<double>();
     }
 
+    std::vector<int> ids;
+    for (const MultiTemplate &t : templates)
+        ids.push_back(t.id);
+
+    std::vector<double> genuine;
+    std::vector<double> impostor;
+    AllPairs pairs(ids);
+    pairs.compute([&](int i, int j) { return compare(templates[i], templates[j]).score; }, genuine, impostor);
+
+    long long g = 0;
+    long long imp = 0;
     for (int i = 0; i < (n-1); i++)
     {
         for (int j = (i+1); j < n; j++)
         {
-            double s = compare(templates[i], templates[j]).score;
             if (templates[i].id == templates[j].id)
             {
-                genScores[templates[i].id].push_back(s);
+                genScores[templates[i].id].push_back(genuine[g++]);
             }
             else
             {
+                double s = impostor[imp++];
                 impScores[templates[i].id].push_back(s);
                 impScores[templates[j].id].push_back(s);
             }
@@ -0,0 +1,146 @@
+#include "faceCommon/biometrics/scorehistogram.h"
+
+#include <cstring>
+#include <cstdint>
+
+#include "faceCommon/linalg/common.h"
+
+using namespace Face::Biometrics;
+
+namespace {
+
+// bits of the double mapped so that their unsigned order is the order of the values
+uint64_t orderedBits(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) ? ~bits : (bits | (1ULL << 63));
+}
+
+double fromOrderedBits(uint64_t bits)
+{
+    bits = (bits >> 63) ? (bits & ~(1ULL << 63)) : ~bits;
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const int droppedBits = 52 - ScoreHistogram::mantissaBits;
+
+}
+
+ScoreHistogram::ScoreHistogram() :
+    total(0),
+    minScore(1e300),
+    maxScore(-1e300),
+    sum(0.0)
+{
+
+}
+
+int ScoreHistogram::bucket(double score)
+{
+    return (int)(orderedBits(score) >> droppedBits);
+}
+
+double ScoreHistogram::lowerEdge(int bucket)
+{
+    return fromOrderedBits((uint64_t)bucket << droppedBits);
+}
+
+void ScoreHistogram::add(double score)
+{
+    if (score != score) throw FACELIB_EXCEPTION("NaN");
+
+    // pages are allocated lazily, so empty histograms are cheap to copy
+    if (pages.empty())
+    {
+        pages.resize(pageCount);
+        pageTotals.assign(pageCount, 0);
+    }
+
+    int b = bucket(score);
+    std::vector<long long> &page = pages[b >> mantissaBits];
+    if (page.empty()) page.assign(pageSize, 0);
+    page[b & (pageSize - 1)]++;
+    pageTotals[b >> mantissaBits]++;
+
+    total++;
+    sum += score;
+    if (score < minScore) minScore = score;
+    if (score > maxScore) maxScore = score;
+}
+
+void ScoreHistogram::merge(const ScoreHistogram &other)
+{
+    if (other.total == 0) return;
+    if (pages.empty())
+    {
+        pages.resize(pageCount);
+        pageTotals.assign(pageCount, 0);
+    }
+
+    for (int p = 0; p < pageCount; p++)
+    {
+        const std::vector<long long> &otherPage = other.pages[p];
+        if (otherPage.empty()) continue;
+
+        std::vector<long long> &page = pages[p];
+        if (page.empty()) page.assign(pageSize, 0);
+        for (int i = 0; i < pageSize; i++)
+        {
+            page[i] += otherPage[i];
+        }
+        pageTotals[p] += other.pageTotals[p];
+    }
+
+    total += other.total;
+    sum += other.sum;
+    if (other.minScore < minScore) minScore = other.minScore;
+    if (other.maxScore > maxScore) maxScore = other.maxScore;
+}
+
+long long ScoreHistogram::bucketCount(int bucket) const
+{
+    if (pages.empty()) return 0;
+    const std::vector<long long> &page = pages[bucket >> mantissaBits];
+    return page.empty() ? 0 : page[bucket & (pageSize - 1)];
+}
+
+long long ScoreHistogram::countBelow(int bucket) const
+{
+    if (pages.empty()) return 0;
+
+    int p = bucket >> mantissaBits;
+    long long result = 0;
+    for (int i = 0; i < p; i++)
+    {
+        result += pageTotals[i];
+    }
+
+    const std::vector<long long> &page = pages[p];
+    if (!page.empty())
+    {
+        for (int i = 0; i < (bucket & (pageSize - 1)); i++)
+        {
+            result += page[i];
+        }
+    }
+    return result;
+}
+
+std::vector<int> ScoreHistogram::buckets() const
+{
+    std::vector<int> result;
+    if (pages.empty()) return result;
+
+    for (int p = 0; p < pageCount; p++)
+    {
+        if (pageTotals[p] == 0) continue;
+        for (int i = 0; i < pageSize; i++)
+        {
+            if (pages[p][i] > 0) result.push_back((p << mantissaBits) | i);
+        }
+    }
+    return result;
+}
@@ -5,6 +5,7 @@
 #include "faceCommon/linalg/matrixconverter.h"
 #include "faceCommon/linalg/vector.h"
 #include "faceCommon/biometrics/template.h"
+#include "faceCommon/biometrics/allpairs.h"
 
 using namespace Face::Biometrics;
 
@@ -39,32 +40,28 @@ Evaluation ScoreLevelFusionBase::evaluate(const std::vector<Evaluation> &evaluat
     if (unitCount == 0) throw FACELIB_EXCEPTION("empty input evaluations list");
 
     // genuines
-    std::vector<double> fusedGenuineScores;
     int sameCount = evaluations[0].genuineScores.size();
-    for (int i = 0; i < sameCount; i++)
+    Matrix genuineScores(sameCount, unitCount);
+    for (int c = 0; c < unitCount; c++)
     {
-        std::vector<double> scores;
-        for (int c = 0; c < unitCount; c++)
+        for (int i = 0; i < sameCount; i++)
         {
-            scores.push_back(evaluations[c].genuineScores[i]);
+            genuineScores(i, c) = evaluations[c].genuineScores[i];
         }
-        fusedGenuineScores.push_back(fuse(scores).score);
     }
 
     // impostors
-    std::vector<double> fusedImpostorScores;
     int diffCount = evaluations[0].impostorScores.size();
-    for (int i = 0; i < diffCount; i++)
+    Matrix impostorScores(diffCount, unitCount);
+    for (int c = 0; c < unitCount; c++)
     {
-        std::vector<double> scores;
-        for (int c = 0; c < unitCount; c++)
+        for (int i = 0; i < diffCount; i++)
         {
-            scores.push_back(evaluations[c].impostorScores[i]);
+            impostorScores(i, c) = evaluations[c].impostorScores[i];
         }
-        fusedImpostorScores.push_back(fuse(scores).score);
     }
 
-    Evaluation result(fusedGenuineScores, fusedImpostorScores);
+    Evaluation result(fuseBatch(genuineScores), fuseBatch(impostorScores));
     return result;
 }
 
@@ -79,26 +76,58 @@ Evaluation ScoreLevelFusionBase::evaluate(const std::vector<std::vector<Face::Bi
 
     unsigned int n = templates[0].size();
 
-    std::map<std::pair<int, int>, std::vector<double> > distanceMatrix;
-    for (unsigned int i = 0; i < (n-1); i++)
+    // it's not a mistake, we can use index 0 here ;)
+    std::vector<int> ids(n);
+    for (unsigned int i = 0; i < n; i++)
     {
-        for (unsigned int j = i+1; j < n; j++)
+        ids[i] = templates[0][i].subjectID;
+    }
+
+    std::vector<std::vector<Face::LinAlg::Vector> > prepared(unitCount, std::vector<Face::LinAlg::Vector>(n));
+    for (unsigned int unit = 0; unit < unitCount; unit++)
+    {
+        for (unsigned int i = 0; i < n; i++)
+        {
+            prepared[unit][i] = metrics[unit]->prepare(templates[unit][i].featureVector);
+        }
+    }
+
+    std::vector<double> genuineScores;
+    std::vector<double> impostorScores;
+    AllPairs pairs(ids);
+    pairs.computeBlocks([&](int iStart, int iEnd, int jStart, int jEnd, Matrix &tile)
+    {
+        std::vector<std::pair<int, int> > tilePairs;
+        for (int i = iStart; i < iEnd; i++)
+        {
+            for (int j = std::max(jStart, i + 1); j < jEnd; j++)
+            {
+                tilePairs.push_back(std::make_pair(i, j));
+            }
+        }
+        if (tilePairs.empty()) return;
+
+        // all unit distances of the tile are fused at once
+        Matrix distances(tilePairs.size(), unitCount);
+        for (unsigned int p = 0; p < tilePairs.size(); p++)
         {
-            std::vector<double> distances;
             for (unsigned int unit = 0; unit < unitCount; unit++)
             {
-                double d = metrics[unit]->distance(templates[unit][i].featureVector, templates[unit][j].featureVector);
+                double d = metrics[unit]->preparedDistance(prepared[unit][tilePairs[p].first],
+                                                           prepared[unit][tilePairs[p].second]);
                 if (d != d) throw FACELIB_EXCEPTION("NaN");
-                distances.push_back(d);
+                distances(p, unit) = d;
             }
-            double distance = fuse(distances).score;
+        }
 
-            // it's not a mistake, we can use index 0 here ;)
-            distanceMatrix[std::make_pair(templates[0][i].subjectID, templates[0][j].subjectID)].push_back(distance);
+        std::vector<double> fused = fuseBatch(distances);
+        for (unsigned int p = 0; p < tilePairs.size(); p++)
+        {
+            tile(tilePairs[p].first - iStart, tilePairs[p].second - jStart) = fused[p];
         }
-    }
+    }, genuineScores, impostorScores);
 
-    Evaluation result(distanceMatrix);
+    Evaluation result(genuineScores, impostorScores);
     return result;
 }
 
@@ -114,31 +143,43 @@ void ScoreLevelFusionBase::prepareDataForClassification(std::vector<Face::LinAlg
     int genuineCount = components[0].genuineScores.size();
     int impostorCount = components[0].impostorScores.size();
 
-    for (int i = 0; i < genuineCount; i++)
+    // genuine rows first, then impostor rows
+    Matrix rawScores(genuineCount + impostorCount, unitsCount);
+    for (int unit = 0; unit < unitsCount; unit++)
     {
-        std::vector<double> scoreVec;
-        for (int unit = 0; unit < unitsCount; unit++)
+        for (int i = 0; i < genuineCount; i++)
         {
-            scoreVec.push_back(components[unit].genuineScores[i]);
+            rawScores(i, unit) = components[unit].genuineScores[i];
+        }
+        for (int i = 0; i < impostorCount; i++)
+        {
+            rawScores(genuineCount + i, unit) = components[unit].impostorScores[i];
         }
-
-        Face::LinAlg::Vector score(scoreNormalizer->normalize(scoreVec));
-        scores.push_back(score);
-        classes.push_back(genuineLabel);
     }
 
-    for (int i = 0; i < impostorCount; i++)
+    Matrix normalized = scoreNormalizer->normalize(rawScores);
+    for (int r = 0; r < normalized.rows; r++)
     {
-        std::vector<double> scoreVec;
-        for (int unit = 0; unit < unitsCount; unit++)
-        {
-            scoreVec.push_back(components[unit].impostorScores[i]);
-        }
+        scores.push_back(Face::LinAlg::Vector(normalized.row(r).t()));
+        classes.push_back(r < genuineCount ? genuineLabel : impostorLabel);
+    }
+}
+
+std::vector<double> ScoreLevelFusionBase::fuseLinear(const Matrix &scores) const
+{
+    std::vector<double> result(scores.rows);
+    if (scores.rows == 0) return result;
+
+    std::vector<double> weights;
+    double bias;
+    if (!linearForm(scores.cols, weights, bias)) throw FACELIB_EXCEPTION("invalid scores count");
 
-        Face::LinAlg::Vector score(scoreNormalizer->normalize(scoreVec));
-        scores.push_back(score);
-        classes.push_back(impostorLabel);
+    Matrix fused = scoreNormalizer->normalize(scores) * Matrix(weights);
+    for (int r = 0; r < scores.rows; r++)
+    {
+        result[r] = bias + fused(r);
     }
+    return result;
 }
 
 ScoreLevelFusionBase::Ptr ScoreLevelFusionFactory::create(const std::string &name)
@@ -200,6 +241,26 @@ ScoreLevelFusionBase::Result ScoreLDAFusion::fuse(const std::vector<double> &sco
     return result;
 }
 
+std::vector<double> ScoreLDAFusion::fuseBatch(const Matrix &scores) const
+{
+    return fuseLinear(scores);
+}
+
+bool ScoreLDAFusion::linearForm(unsigned int count, std::vector<double> &weights, double &bias) const
+{
+    if (lda.Wt.cols != (int)count) return false;
+
+    // Wt * (x - mean)
+    weights.resize(count);
+    bias = 0.0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        weights[i] = lda.Wt(0, i);
+        bias -= lda.Wt(0, i) * lda.mean(i);
+    }
+    return true;
+}
+
 void ScoreLDAFusion::serialize(const std::string &path) const
 {
     lda.serialize(path);
@@ -247,6 +308,16 @@ ScoreLevelFusionBase::Result ScoreLogisticRegressionFusion::fuse(const std::vect
     return result;
 }
 
+std::vector<double> ScoreLogisticRegressionFusion::fuseBatch(const Matrix &scores) const
+{
+    std::vector<double> result = logR.classify(scoreNormalizer->normalize(scores));
+    for (unsigned int i = 0; i < result.size(); i++)
+    {
+        result[i] = 1.0 - result[i];
+    }
+    return result;
+}
+
 void ScoreLogisticRegressionFusion::serialize(const std::string &path) const
 {
     logR.serialize(path);
@@ -300,6 +371,24 @@ ScoreLevelFusionBase::Result ScoreWeightedSumFusion::fuse(const std::vector<doub
     return result;
 }
 
+std::vector<double> ScoreWeightedSumFusion::fuseBatch(const Matrix &scores) const
+{
+    return fuseLinear(scores);
+}
+
+bool ScoreWeightedSumFusion::linearForm(unsigned int count, std::vector<double> &weights, double &bias) const
+{
+    if (eer.size() != count) return false;
+
+    weights.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        weights[i] = (0.5 - eer[i]) / weightDenominator;
+    }
+    bias = 0.0;
+    return true;
+}
+
 void ScoreWeightedSumFusion::serialize(const std::string &path) const
 {
     cv::FileStorage storage(path, cv::FileStorage::WRITE);
@@ -349,6 +438,18 @@ ScoreLevelFusionBase::Result ScoreSumFusion::fuse(const std::vector<double> &sco
     return result;
 }
 
+std::vector<double> ScoreSumFusion::fuseBatch(const Matrix &scores) const
+{
+    return fuseLinear(scores);
+}
+
+bool ScoreSumFusion::linearForm(unsigned int count, std::vector<double> &weights, double &bias) const
+{
+    weights.assign(count, 1.0);
+    bias = 0.0;
+    return true;
+}
+
 void ScoreSumFusion::serialize(const std::string &/*path*/) const
 {
     throw FACELIB_EXCEPTION("not implemented");
@@ -372,6 +473,7 @@ ScoreLevelFusionBase::Result ScoreProductFusion::fuse(const std::vector<double>
     result.preNormalized = scores;
     result.normalized = scoreNormalizer->normalize(scores);
 
+    result.score = 1.0;
     for (unsigned int i = 0; i < scores.size(); i++)
     {
         result.score *= result.normalized[i];
@@ -379,6 +481,21 @@ ScoreLevelFusionBase::Result ScoreProductFusion::fuse(const std::vector<double>
     return result;
 }
 
+std::vector<double> ScoreProductFusion::fuseBatch(const Matrix &scores) const
+{
+    Matrix normalized = scoreNormalizer->normalize(scores);
+    std::vector<double> result(normalized.rows, 1.0);
+    for (int r = 0; r < normalized.rows; r++)
+    {
+        const double *row = normalized.ptr<double>(r);
+        for (int c = 0; c < normalized.cols; c++)
+        {
+            result[r] *= row[c];
+        }
+    }
+    return result;
+}
+
 void ScoreProductFusion::serialize(const std::string &path) const
 {
     cv::FileStorage storage(path, cv::FileStorage::WRITE);
@@ -460,6 +577,22 @@ ScoreLevelFusionBase::Result ScoreSVMFusion::fuse(const std::vector<double> &sco
     return result;
 }
 
+std::vector<double> ScoreSVMFusion::fuseBatch(const Matrix &scores) const
+{
+    // single precision samples, one per row; predict() accepts row vectors as well
+    cv::Mat samples;
+    scoreNormalizer->normalize(scores).convertTo(samples, CV_32F);
+
+    int n = samples.rows;
+    std::vector<double> result(n);
+    #pragma omp parallel for
+    for (int r = 0; r < n; r++)
+    {
+        result[r] = svm->predict(samples.row(r), true);
+    }
+    return result;
+}
+
 cv::Mat ScoreSVMFusion::colVectorToColFPMatrix(std::vector<int> &vector) const
 {
     int r = vector.size();
@@ -580,3 +713,17 @@ ScoreLevelFusionBase::Result ScoreGMMFusion::fuse(const std::vector<double> &sco
     result.score = i - g;
     return result;
 }
+
+std::vector<double> ScoreGMMFusion::fuseBatch(const Matrix &scores) const
+{
+    // the models are trained on the raw scores, see fuse()
+    int n = scores.rows;
+    std::vector<double> result(n);
+    #pragma omp parallel for
+    for (int r = 0; r < n; r++)
+    {
+        Matrix m = scores.row(r);
+        result[r] = impostorScoresModel->predict(m)[0] - genuineScoresModel->predict(m)[0];
+    }
+    return result;
+}
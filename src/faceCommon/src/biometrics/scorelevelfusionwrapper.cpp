@@ -1,7 +1,329 @@
 #include "faceCommon/biometrics/scorelevelfusionwrapper.h"
 
+#include <Poco/StringTokenizer.h>
+
 using namespace Face::Biometrics;
 
+namespace {
+
+/**
+ * Fusion of the selected components extended by one candidate, learned incrementally.
+ *
+ * Normalizers are learned per component, so the normalized scores of every component are
+ * computed only once. They are stored in one matrix with a row per component (i.e. column-major
+ * pairs x components), genuine pairs first. Only the EER of the fused scores matters, so they
+ * may differ from ScoreLevelFusionBase::fuse() by any increasing transformation.
+ */
+class IncrementalFusion
+{
+public:
+    typedef cv::Ptr<IncrementalFusion> Ptr;
+
+    IncrementalFusion(const std::string &normalizerName, const std::vector<Evaluation> &components)
+    {
+        int n = components.size();
+        genuineCount = components[0].genuineScores.size();
+        impostorCount = components[0].impostorScores.size();
+        scores = Matrix(n, genuineCount + impostorCount);
+        eer.resize(n);
+
+        for (int c = 0; c < n; c++)
+        {
+            const Evaluation &e = components[c];
+            if ((int)e.genuineScores.size() != genuineCount || (int)e.impostorScores.size() != impostorCount)
+                throw FACELIB_EXCEPTION("components have different genuine or impostor scores count");
+        }
+
+        // only validates the name: an unknown normalizer has to throw here, an exception must
+        // not leave the parallel loop below, which creates a normalizer for every component
+        ScoreNormalizerFactory::create(normalizerName);
+
+        #pragma omp parallel for
+        for (int c = 0; c < n; c++)
+        {
+            const Evaluation &e = components[c];
+            ScoreNormalizerBase::Ptr normalizer = ScoreNormalizerFactory::create(normalizerName);
+            normalizer->learn(std::vector<Evaluation>(1, e));
+
+            Matrix raw(genuineCount + impostorCount, 1);
+            for (int i = 0; i < genuineCount; i++) raw(i) = e.genuineScores[i];
+            for (int i = 0; i < impostorCount; i++) raw(genuineCount + i) = e.impostorScores[i];
+            Matrix(normalizer->normalize(raw).t()).copyTo(scores.row(c));
+            eer[c] = e.eer;
+        }
+    }
+
+    virtual ~IncrementalFusion() {}
+
+    virtual void select(int component) = 0;
+
+    double evaluate(int candidate) const
+    {
+        std::vector<double> fused(genuineCount + impostorCount);
+        fuse(candidate, fused);
+        std::vector<double> genuine(fused.begin(), fused.begin() + genuineCount);
+        std::vector<double> impostor(fused.begin() + genuineCount, fused.end());
+        return Evaluation(genuine, impostor).eer;
+    }
+
+protected:
+    Matrix scores;
+    std::vector<double> eer;
+    int genuineCount;
+    int impostorCount;
+
+    // fused scores of the selected components and the candidate
+    virtual void fuse(int candidate, std::vector<double> &fused) const = 0;
+};
+
+class IncrementalSumFusion : public IncrementalFusion
+{
+public:
+    IncrementalSumFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalFusion(normalizerName, components), sum(genuineCount + impostorCount, 0.0) {}
+
+    void select(int component)
+    {
+        const double *column = scores.ptr<double>(component);
+        for (unsigned int i = 0; i < sum.size(); i++) sum[i] += column[i];
+    }
+
+protected:
+    void fuse(int candidate, std::vector<double> &fused) const
+    {
+        const double *column = scores.ptr<double>(candidate);
+        for (unsigned int i = 0; i < sum.size(); i++) fused[i] = sum[i] + column[i];
+    }
+
+private:
+    std::vector<double> sum;
+};
+
+class IncrementalWeightedSumFusion : public IncrementalFusion
+{
+public:
+    IncrementalWeightedSumFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalFusion(normalizerName, components), sum(genuineCount + impostorCount, 0.0), weightDenominator(0.0) {}
+
+    void select(int component)
+    {
+        // weights (0.5 - eer) / weightDenominator as in ScoreWeightedSumFusion
+        double w = 0.5 - eer[component];
+        const double *column = scores.ptr<double>(component);
+        for (unsigned int i = 0; i < sum.size(); i++) sum[i] += w * column[i];
+        weightDenominator += w;
+    }
+
+protected:
+    void fuse(int candidate, std::vector<double> &fused) const
+    {
+        double w = 0.5 - eer[candidate];
+        double denominator = weightDenominator + w;
+        const double *column = scores.ptr<double>(candidate);
+        for (unsigned int i = 0; i < sum.size(); i++) fused[i] = (sum[i] + w * column[i]) / denominator;
+    }
+
+private:
+    std::vector<double> sum;
+    double weightDenominator;
+};
+
+class IncrementalProductFusion : public IncrementalFusion
+{
+public:
+    IncrementalProductFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalFusion(normalizerName, components), product(genuineCount + impostorCount, 1.0) {}
+
+    void select(int component)
+    {
+        const double *column = scores.ptr<double>(component);
+        for (unsigned int i = 0; i < product.size(); i++) product[i] *= column[i];
+    }
+
+protected:
+    void fuse(int candidate, std::vector<double> &fused) const
+    {
+        const double *column = scores.ptr<double>(candidate);
+        for (unsigned int i = 0; i < product.size(); i++) fused[i] = product[i] * column[i];
+    }
+
+private:
+    std::vector<double> product;
+};
+
+/**
+ * Fusions projecting the scores onto a learned direction. Both classes keep the Gram matrix and
+ * sums of the selected components, a candidate only adds their dot products with its column.
+ */
+class IncrementalLinearFusion : public IncrementalFusion
+{
+public:
+    IncrementalLinearFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalFusion(normalizerName, components) {}
+
+    void select(int component)
+    {
+        Statistics extended;
+        extend(component, extended);
+        statistics = extended;
+        selected.push_back(component);
+    }
+
+protected:
+    struct Statistics
+    {
+        Matrix genuineGram;
+        Matrix impostorGram;
+        Matrix genuineSums;
+        Matrix impostorSums;
+    };
+
+    // weights of the selected components and the candidate, the last one is the bias
+    virtual Matrix learn(const Statistics &s) const = 0;
+
+    void fuse(int candidate, std::vector<double> &fused) const
+    {
+        Statistics extended;
+        extend(candidate, extended);
+        Matrix w = learn(extended);
+
+        int k = selected.size();
+        fused.assign(fused.size(), w(k + 1));
+        for (int c = 0; c <= k; c++)
+        {
+            const double *column = scores.ptr<double>(c < k ? selected[c] : candidate);
+            double weight = w(c);
+            for (unsigned int i = 0; i < fused.size(); i++) fused[i] += weight * column[i];
+        }
+    }
+
+private:
+    std::vector<int> selected;
+    Statistics statistics;
+
+    double dot(int first, int second, int start, int count) const
+    {
+        const double *a = scores.ptr<double>(first) + start;
+        const double *b = scores.ptr<double>(second) + start;
+        double result = 0.0;
+        for (int i = 0; i < count; i++) result += a[i] * b[i];
+        return result;
+    }
+
+    void extend(int candidate, Statistics &extended) const
+    {
+        int k = selected.size();
+        extended.genuineGram = Matrix::zeros(k + 1, k + 1);
+        extended.impostorGram = Matrix::zeros(k + 1, k + 1);
+        extended.genuineSums = Matrix::zeros(k + 1, 1);
+        extended.impostorSums = Matrix::zeros(k + 1, 1);
+        if (k > 0)
+        {
+            statistics.genuineGram.copyTo(extended.genuineGram(cv::Rect(0, 0, k, k)));
+            statistics.impostorGram.copyTo(extended.impostorGram(cv::Rect(0, 0, k, k)));
+            statistics.genuineSums.copyTo(extended.genuineSums.rowRange(0, k));
+            statistics.impostorSums.copyTo(extended.impostorSums.rowRange(0, k));
+        }
+
+        for (int c = 0; c <= k; c++)
+        {
+            int other = c < k ? selected[c] : candidate;
+            double g = dot(candidate, other, 0, genuineCount);
+            double i = dot(candidate, other, genuineCount, impostorCount);
+            extended.genuineGram(k, c) = extended.genuineGram(c, k) = g;
+            extended.impostorGram(k, c) = extended.impostorGram(c, k) = i;
+        }
+
+        const double *column = scores.ptr<double>(candidate);
+        for (int i = 0; i < genuineCount; i++) extended.genuineSums(k) += column[i];
+        for (int i = genuineCount; i < genuineCount + impostorCount; i++) extended.impostorSums(k) += column[i];
+    }
+};
+
+class IncrementalLDAFusion : public IncrementalLinearFusion
+{
+public:
+    IncrementalLDAFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalLinearFusion(normalizerName, components) {}
+
+protected:
+    Matrix learn(const Statistics &s) const
+    {
+        // the only LDA projection of two classes is inv(Sw) * (genuineMean - impostorMean)
+        Matrix genuineMean = s.genuineSums / genuineCount;
+        Matrix impostorMean = s.impostorSums / impostorCount;
+        Matrix genuineScatter = s.genuineGram - genuineCount * genuineMean * genuineMean.t();
+        Matrix impostorScatter = s.impostorGram - impostorCount * impostorMean * impostorMean.t();
+        Matrix withinClass = genuineScatter + impostorScatter;
+
+        Matrix direction;
+        cv::solve(withinClass, genuineMean - impostorMean, direction, cv::DECOMP_SVD);
+
+        Matrix w = Matrix::zeros(direction.rows + 1, 1);
+        direction.copyTo(w.rowRange(0, direction.rows));
+        return w;
+    }
+};
+
+class IncrementalLogisticRegressionFusion : public IncrementalLinearFusion
+{
+public:
+    IncrementalLogisticRegressionFusion(const std::string &normalizerName, const std::vector<Evaluation> &components) :
+        IncrementalLinearFusion(normalizerName, components) {}
+
+protected:
+    Matrix learn(const Statistics &s) const
+    {
+        // least squares fit of the labels (genuine 1, impostor 0) as in LogisticRegression::learn();
+        // the sigmoid of the projection is increasing, so the projection is enough for the EER
+        int k = s.genuineSums.rows;
+        Matrix phiTphi(k + 1, k + 1);
+        Matrix phiTt(k + 1, 1);
+        phiTphi(0, 0) = genuineCount + impostorCount;
+        phiTt(0) = genuineCount;
+        for (int r = 0; r < k; r++)
+        {
+            phiTphi(0, r + 1) = phiTphi(r + 1, 0) = s.genuineSums(r) + s.impostorSums(r);
+            phiTt(r + 1) = s.genuineSums(r);
+            for (int c = 0; c < k; c++)
+            {
+                phiTphi(r + 1, c + 1) = s.genuineGram(r, c) + s.impostorGram(r, c);
+            }
+        }
+
+        Matrix phiW;
+        cv::solve(phiTphi, phiTt, phiW, cv::DECOMP_SVD);
+
+        // bias goes last
+        Matrix w(k + 1, 1);
+        phiW.rowRange(1, k + 1).copyTo(w.rowRange(0, k));
+        w(k) = phiW(0);
+        return w;
+    }
+};
+
+IncrementalFusion::Ptr createIncrementalFusion(const std::string &fusionName, const std::vector<Evaluation> &components)
+{
+    Poco::StringTokenizer items(fusionName, "-");
+    if (items.count() != 2) throw FACELIB_EXCEPTION("unknown fusion " + fusionName);
+
+    if (items[0] == ScoreSumFusion::name())
+        return new IncrementalSumFusion(items[1], components);
+    if (items[0] == ScoreWeightedSumFusion::name())
+        return new IncrementalWeightedSumFusion(items[1], components);
+    if (items[0] == ScoreProductFusion::name())
+        return new IncrementalProductFusion(items[1], components);
+    if (items[0] == ScoreLDAFusion::name())
+        return new IncrementalLDAFusion(items[1], components);
+    if (items[0] == ScoreLogisticRegressionFusion::name())
+        return new IncrementalLogisticRegressionFusion(items[1], components);
+
+    // SVM and GMM have no incremental learning
+    return IncrementalFusion::Ptr();
+}
+
+}
+
 ScoreLevelFusionWrapper::Result ScoreLevelFusionWrapper::trainClassifier(const std::string &fusionName,
                                                                          const std::vector<Evaluation> &components,
                                                                          bool debugOutput)
@@ -31,6 +353,9 @@ ScoreLevelFusionWrapper::Result ScoreLevelFusionWrapper::trainClassifier(const s
     if (debugOutput)
         std::cout << "Selected " << bestIndex << " with EER " << bestEER << " as the base for the classifier" << std::endl;
 
+    IncrementalFusion::Ptr incremental = createIncrementalFusion(fusionName, components);
+    if (!incremental.empty()) incremental->select(bestIndex);
+
     // iteratively add the best remaining components while there is some improvement
     bool improvement = true;
     while (improvement)
@@ -39,12 +364,18 @@ ScoreLevelFusionWrapper::Result ScoreLevelFusionWrapper::trainClassifier(const s
         bestIndex = -1;
 
         std::vector<double> eers(n, 1.0);
-        #pragma omp parallel for
+        #pragma omp parallel for schedule(dynamic)
         for (int i = 0; i < n; i++)
         {
             // if the component was already selected skip it
             if (std::find(result.selectedComponents.begin(), result.selectedComponents.end(), i) != result.selectedComponents.end()) continue;
 
+            if (!incremental.empty())
+            {
+                eers[i] = incremental->evaluate(i);
+                continue;
+            }
+
             // relearn the classifier using all current selected components...
             ScoreLevelFusionBase::Ptr fusion = ScoreLevelFusionFactory::create(fusionName);
             for (int c : result.selectedComponents)
@@ -84,6 +415,7 @@ ScoreLevelFusionWrapper::Result ScoreLevelFusionWrapper::trainClassifier(const s
         if (improvement)
         {
             result.selectedComponents.push_back(bestIndex);
+            if (!incremental.empty()) incremental->select(bestIndex);
             if (debugOutput)
                 std::cout << "added classifier " << bestIndex << ", fusion EER: " << bestEER << std::endl;
         }
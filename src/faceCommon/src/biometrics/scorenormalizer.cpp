@@ -3,6 +3,29 @@
 
 using namespace Face::Biometrics;
 
+namespace {
+
+// (score - offsets[c]) / divisors[c] applied to every column c
+Matrix normalizeColumns(const Matrix &inputScores, const std::vector<double> &offsets, const std::vector<double> &divisors)
+{
+    int n = offsets.size();
+    if (inputScores.cols != n) throw FACELIB_EXCEPTION("invalid scores count");
+
+    Matrix result(inputScores.rows, n);
+    for (int r = 0; r < inputScores.rows; r++)
+    {
+        const double *in = inputScores.ptr<double>(r);
+        double *out = result.ptr<double>(r);
+        for (int c = 0; c < n; c++)
+        {
+            out[c] = (in[c] - offsets[c])/divisors[c];
+        }
+    }
+    return result;
+}
+
+}
+
 ScoreNormalizerBase::Ptr ScoreNormalizerFactory::create(const std::string &name)
 {
     if (name == ScoreNormalizerPass::name())
@@ -53,11 +76,26 @@ std::vector<double> ScoreNormalizerMean::normalize(const std::vector<double> &in
     std::vector<double> result(n);
     for (unsigned int i = 0; i < n; i++)
     {
-        result[i] = (inputScores[i] - genuineMeans[i])/(impostorMeans[i] - genuineMeans[i]);
+        result[i] = normalizeComponent(i, inputScores[i]);
     }
     return result;
 }
 
+Matrix ScoreNormalizerMean::normalize(const Matrix &inputScores) const
+{
+    std::vector<double> ranges(genuineMeans.size());
+    for (unsigned int i = 0; i < ranges.size(); i++)
+    {
+        ranges[i] = impostorMeans[i] - genuineMeans[i];
+    }
+    return normalizeColumns(inputScores, genuineMeans, ranges);
+}
+
+double ScoreNormalizerMean::normalizeComponent(unsigned int component, double score) const
+{
+    return (score - genuineMeans[component])/(impostorMeans[component] - genuineMeans[component]);
+}
+
 void ScoreNormalizerMean::serialize(cv::FileStorage &storage) const
 {
     storage << "genuineMeans" << Face::LinAlg::Vector(genuineMeans);
@@ -98,11 +136,26 @@ std::vector<double> ScoreNormalizerMedian::normalize(const std::vector<double> &
     std::vector<double> result(n);
     for (unsigned int i = 0; i < n; i++)
     {
-        result[i] = (inputScores[i] - genuineMedians[i])/(impostorMedians[i] - genuineMedians[i]);
+        result[i] = normalizeComponent(i, inputScores[i]);
     }
     return result;
 }
 
+Matrix ScoreNormalizerMedian::normalize(const Matrix &inputScores) const
+{
+    std::vector<double> ranges(genuineMedians.size());
+    for (unsigned int i = 0; i < ranges.size(); i++)
+    {
+        ranges[i] = impostorMedians[i] - genuineMedians[i];
+    }
+    return normalizeColumns(inputScores, genuineMedians, ranges);
+}
+
+double ScoreNormalizerMedian::normalizeComponent(unsigned int component, double score) const
+{
+    return (score - genuineMedians[component])/(impostorMedians[component] - genuineMedians[component]);
+}
+
 void ScoreNormalizerMedian::serialize(cv::FileStorage &storage) const
 {
     storage << "genuineMedians" << Face::LinAlg::Vector(genuineMedians);
@@ -152,11 +205,21 @@ std::vector<double> ScoreNormalizerZScore::normalize(const std::vector<double> &
     std::vector<double> result(n);
     for (unsigned int i = 0; i < n; i++)
     {
-        result[i] = (inputScores[i]-means[i])/stdDevs[i];
+        result[i] = normalizeComponent(i, inputScores[i]);
     }
     return result;
 }
 
+Matrix ScoreNormalizerZScore::normalize(const Matrix &inputScores) const
+{
+    return normalizeColumns(inputScores, means, stdDevs);
+}
+
+double ScoreNormalizerZScore::normalizeComponent(unsigned int component, double score) const
+{
+    return (score - means[component])/stdDevs[component];
+}
+
 void ScoreNormalizerZScore::serialize(cv::FileStorage &storage) const
 {
     storage << "means" << Face::LinAlg::Vector(means);
@@ -213,11 +276,21 @@ std::vector<double> ScoreNormalizerMAD::normalize(const std::vector<double> &inp
     std::vector<double> result(n);
     for (unsigned int i = 0; i < n; i++)
     {
-        result[i] = (inputScores[i] - medians[i])/mads[i];
+        result[i] = normalizeComponent(i, inputScores[i]);
     }
     return result;
 }
 
+Matrix ScoreNormalizerMAD::normalize(const Matrix &inputScores) const
+{
+    return normalizeColumns(inputScores, medians, mads);
+}
+
+double ScoreNormalizerMAD::normalizeComponent(unsigned int component, double score) const
+{
+    return (score - medians[component])/mads[component];
+}
+
 void ScoreNormalizerMAD::serialize(cv::FileStorage &storage) const
 {
     storage << "medians" << Face::LinAlg::Vector(medians);
@@ -267,11 +340,30 @@ std::vector<double> ScoreNormalizerTanh::normalize(const std::vector<double> &in
     std::vector<double> result(n);
     for (unsigned int i = 0; i < n; i++)
     {
-        result[i] = 0.5 * (tanh(0.01 * (inputScores[i] - means[i])/stdDevs[i]) + 1);
+        result[i] = normalizeComponent(i, inputScores[i]);
+    }
+    return result;
+}
+
+Matrix ScoreNormalizerTanh::normalize(const Matrix &inputScores) const
+{
+    Matrix result = normalizeColumns(inputScores, means, stdDevs);
+    for (int r = 0; r < result.rows; r++)
+    {
+        double *row = result.ptr<double>(r);
+        for (int c = 0; c < result.cols; c++)
+        {
+            row[c] = 0.5 * (tanh(0.01 * row[c]) + 1);
+        }
     }
     return result;
 }
 
+double ScoreNormalizerTanh::normalizeComponent(unsigned int component, double score) const
+{
+    return 0.5 * (tanh(0.01 * (score - means[component])/stdDevs[component]) + 1);
+}
+
 void ScoreNormalizerTanh::serialize(cv::FileStorage &storage) const
 {
     storage << "means" << Face::LinAlg::Vector(means);
@@ -1,5 +1,9 @@
 #include "faceCommon/facedata/facealigner.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "faceCommon/facedata/mesh.h"
 #include "faceCommon/facedata/landmarkdetector.h"
 #include "faceCommon/linalg/procrustes.h"
@@ -35,8 +39,51 @@ void FaceAlignerIcp::CVTemplateMatchingSettings::deserialize(cv::FileStorage &st
     //storage["center"] >> center;
 }
 
+namespace
+{
+    // area weighted mean of the normals of the adjacent triangles, zero for vertices without triangles
+    Matrix vertexNormals(const Mesh &mesh)
+    {
+        Mesh triangulated;
+        const Mesh *source = &mesh;
+        if (mesh.triangles.empty())
+        {
+            triangulated = mesh;
+            triangulated.calculateTriangles();
+            source = &triangulated;
+        }
+
+        const Matrix &points = source->pointsMat;
+        Matrix normals = Matrix::zeros(points.rows, 3);
+        for (const Mesh::Triangle &t : source->triangles)
+        {
+            cv::Vec3d a(points(t[0], 0), points(t[0], 1), points(t[0], 2));
+            cv::Vec3d b(points(t[1], 0), points(t[1], 1), points(t[1], 2));
+            cv::Vec3d c(points(t[2], 0), points(t[2], 1), points(t[2], 2));
+            cv::Vec3d n = (b - a).cross(c - a);
+            for (int i = 0; i < 3; i++)
+            {
+                normals(t[i], 0) += n[0];
+                normals(t[i], 1) += n[1];
+                normals(t[i], 2) += n[2];
+            }
+        }
+
+        for (int r = 0; r < normals.rows; r++)
+        {
+            double length = std::sqrt(normals(r, 0)*normals(r, 0) + normals(r, 1)*normals(r, 1) + normals(r, 2)*normals(r, 2));
+            if (length == 0) continue;
+            normals(r, 0) /= length;
+            normals(r, 1) /= length;
+            normals(r, 2) /= length;
+        }
+        return normals;
+    }
+}
+
 FaceAlignerIcp::FaceAlignerIcp(const Mesh &referenceFace, const std::string &templateMatchingFilePath) :
-	threadPool(0), referenceFace(referenceFace)
+	threadPool(0), referenceFace(referenceFace), referenceIndex(referenceFace.pointsMat),
+	matchToReference(false), metric(PointToPoint)
 {
     if (!templateMatchingFilePath.empty())
     {
@@ -50,6 +97,15 @@ FaceAlignerIcp::~FaceAlignerIcp()
     if (threadPool) delete threadPool;
 }
 
+void FaceAlignerIcp::setMetric(Metric metric)
+{
+    if (metric == PointToPlane && referenceNormals.empty())
+    {
+        referenceNormals = vertexNormals(referenceFace);
+    }
+    this->metric = metric;
+}
+
 void FaceAlignerIcp::alignCentralize(Mesh &face) const
 {
     face.centralize();
@@ -88,69 +144,149 @@ void FaceAlignerIcp::alignMaxZ(Mesh &face) const
     }
 }*/
 
-void FaceAlignerIcp::alignTemplateMatching(Mesh &face) const
+namespace
 {
-    MapConverter refConverter;
-    Map refDepth = SurfaceProcessor::depthmap(referenceFace, refConverter, 1.0, SurfaceProcessor::ZCoord);
-
-    MapConverter inputConverter;
-    //double padding = 30;
-    Map depth = SurfaceProcessor::depthmap(face, inputConverter, /*cv::Point2d(referenceFace.minx - padding, referenceFace.miny - padding),
-                                           cv::Point2d(referenceFace.maxx + padding, referenceFace.maxy + padding),*/ 1.0, SurfaceProcessor::ZCoord);
-
-    int n = refDepth.h * refDepth.w;
-    double refValuesShift = cv::sum(refDepth.values)[0] / n;
-    Matrix refValues = refDepth.values - refValuesShift;
-
-    int miny = -1;
-    int minx = -1;
-    double minSum = 1e300;
-    //double minShift;
-    for (int y = 0; y < depth.h - refDepth.h; y+=5)
+    /*
+     * Level of the template matching pyramid. Each map is shifted by its own mean (the image by
+     * imageMean, the template by templMean), so both are around zero and the float correlation stays
+     * precise. The score doesn't change: it removes the mean of every window and of the template.
+     */
+    struct TemplateMatchingLevel
     {
-        for (int x = 0; x < depth.w - refDepth.w; x+=5)
-        {
-            Matrix tmp = depth.values(cv::Rect(x, y, refDepth.w, refDepth.h)).clone();
-            double shift = cv::sum(tmp)[0] / n;
-            tmp = tmp - shift;
+        cv::Mat_<float> image;
+        cv::Mat_<double> sums;
+        cv::Mat_<double> squaredSums;
+        cv::Mat_<float> templ;
+        double templSquaredSum;
 
-            Matrix diff;
-            cv::absdiff(tmp, refValues, diff);
-            double s = cv::sum(diff)[0] / n;
+        TemplateMatchingLevel(const cv::Mat_<float> &image, const cv::Mat_<float> &templ) : image(image), templ(templ)
+        {
+            cv::integral(image, sums, squaredSums, CV_64F);
+            templSquaredSum = templ.dot(templ);
+        }
 
-            //qDebug() << s;
+        /*
+         * Sum of squared differences of the template and the window (both mean-shifted) for every
+         * window with the top left corner in the region. With zero-mean template t it is
+         * sum(w^2) - sum(w)^2/n - 2*sum(w*t) + sum(t^2); window sums come from the integral images
+         * and the correlation from cv::matchTemplate (DFT based for large templates).
+         */
+        cv::Mat_<double> score(cv::Rect region) const
+        {
+            cv::Mat_<float> correlation;
+            cv::Rect windows(region.x, region.y, region.width + templ.cols - 1, region.height + templ.rows - 1);
+            cv::matchTemplate(image(windows), templ, correlation, cv::TM_CCORR);
 
-            if (s < minSum)
+            double n = templ.rows * templ.cols;
+            cv::Mat_<double> result(region.height, region.width);
+            for (int y = 0; y < region.height; y++)
             {
-                minSum = s;
-                //minShift = shift;
-                minx = x;
-                miny = y;
+                int top = region.y + y;
+                int bottom = top + templ.rows;
+                for (int x = 0; x < region.width; x++)
+                {
+                    int left = region.x + x;
+                    int right = left + templ.cols;
+                    double sum = sums(bottom, right) - sums(top, right) - sums(bottom, left) + sums(top, left);
+                    double squaredSum = squaredSums(bottom, right) - squaredSums(top, right) -
+                            squaredSums(bottom, left) + squaredSums(top, left);
+                    result(y, x) = squaredSum - sum*sum/n - 2*correlation(y, x) + templSquaredSum;
+                }
             }
+            return result;
+        }
 
-            /*tmp = depth.values.clone();
-            double min, max; cv::minMaxIdx(tmp, &min, &max); tmp = (tmp-min)/(max-min);
-            double realx = x - referenceFace.minx;
-            double realy = y + referenceFace.maxy;
-            cv::circle(tmp, cv::Point(realx, realy), 2, 0);
-            cv::imshow("pre-align", tmp);
-            qDebug() << s;
-            cv::waitKey();*/
+        cv::Rect positions() const
+        {
+            return cv::Rect(0, 0, image.cols - templ.cols + 1, image.rows - templ.rows + 1);
         }
+    };
+
+    // offset of the minimum of the parabola through the three values, within (-0.5, 0.5)
+    double parabolaMinimum(double left, double center, double right)
+    {
+        double curvature = left - 2*center + right;
+        if (curvature <= 0) return 0;
+        return std::max(-0.5, std::min(0.5, (left - right) / (2*curvature)));
     }
 
-    if ((minx >= 0) && (miny >= 0))
+    /*
+     * Top left corner of the window of the image most similar to the template. The coarsest level
+     * of the pyramid is searched exhaustively, every finer one only around the position from the
+     * previous level. The result is refined to sub-pixel precision. Returns false if the template
+     * doesn't fit in the image.
+     */
+    bool matchTemplatePyramid(const Matrix &image, const Matrix &templ, cv::Point2d &position)
     {
-        //qDebug() << "Nosetip located at" << minx << miny << minSum;
+        const int minTemplateSize = 16;
+        const int maxLevels = 4;
+        const int searchRadius = 2;
+
+        if (image.cols < templ.cols || image.rows < templ.rows) return false;
+
+        double templMean = cv::mean(templ)[0];
+        double imageMean = cv::mean(image)[0];
+        cv::Mat_<float> levelImage;
+        cv::Mat_<float> levelTempl;
+        cv::Mat(image - imageMean).convertTo(levelImage, CV_32F);
+        cv::Mat(templ - templMean).convertTo(levelTempl, CV_32F);
+
+        std::vector<TemplateMatchingLevel> levels;
+        levels.push_back(TemplateMatchingLevel(levelImage, levelTempl));
+        while ((int)levels.size() < maxLevels &&
+               levelTempl.cols / 2 >= minTemplateSize && levelTempl.rows / 2 >= minTemplateSize)
+        {
+            cv::Mat_<float> smallerImage, smallerTempl;
+            cv::pyrDown(levelImage, smallerImage);
+            cv::pyrDown(levelTempl, smallerTempl);
+            if (smallerImage.cols < smallerTempl.cols || smallerImage.rows < smallerTempl.rows) break;
+
+            // pyrDown changes the mean slightly
+            smallerTempl -= cv::mean(smallerTempl)[0];
+            levelImage = smallerImage;
+            levelTempl = smallerTempl;
+            levels.push_back(TemplateMatchingLevel(levelImage, levelTempl));
+        }
+
+        cv::Rect region = levels.back().positions();
+        cv::Point best;
+        cv::Mat_<double> score;
+        for (int l = levels.size() - 1; l >= 0; l--)
+        {
+            score = levels[l].score(region);
+            cv::minMaxLoc(score, 0, 0, &best, 0);
+            best += region.tl();
+
+            if (l > 0)
+            {
+                cv::Rect finer = cv::Rect(2*best.x - searchRadius, 2*best.y - searchRadius,
+                                          2*searchRadius + 1, 2*searchRadius + 1);
+                region = finer & levels[l - 1].positions();
+            }
+        }
+
+        position = best;
+        int x = best.x - region.x;
+        int y = best.y - region.y;
+        if (x > 0 && x < score.cols - 1) position.x += parabolaMinimum(score(y, x - 1), score(y, x), score(y, x + 1));
+        if (y > 0 && y < score.rows - 1) position.y += parabolaMinimum(score(y - 1, x), score(y, x), score(y + 1, x));
+        return true;
+    }
+}
+
+void FaceAlignerIcp::alignTemplateMatching(Mesh &face) const
+{
+    MapConverter refConverter;
+    Map refDepth = SurfaceProcessor::depthmap(referenceFace, refConverter, 1.0, SurfaceProcessor::ZCoord);
 
-        double realx = minx - referenceFace.minx;
-        double realy = miny + referenceFace.maxy;
+    MapConverter inputConverter;
+    Map depth = SurfaceProcessor::depthmap(face, inputConverter, 1.0, SurfaceProcessor::ZCoord);
 
-        /*Matrix tmp = depth.values.clone();
-        double min, max; cv::minMaxIdx(tmp, &min, &max); tmp = (tmp-min)/(max-min);
-        cv::circle(tmp, cv::Point(realx, realy), 2, 0);
-        cv::imshow("pre-align", tmp);
-        cv::waitKey();*/
+    cv::Point2d position;
+    if (matchTemplatePyramid(depth.values, refDepth.values, position))
+    {
+        double realx = position.x - referenceFace.minx;
+        double realy = position.y + referenceFace.maxy;
 
         cv::Point3d p = inputConverter.MapToMeshCoords(depth, cv::Point2d(realx, realy));
         face.translate(-p);
@@ -257,56 +393,310 @@ void FaceAlignerIcp::setEnableThreadPool(bool enable)
     if (enable && !threadPool) threadPool = new NearestPointsThreadPool();
 }
 
-void FaceAlignerIcp::align(Mesh &face, int maxIterations, PreAlignTransform preAlignTransform) const
+void FaceAlignerIcp::getNearestPoints(const Matrix &points, const Face::LinAlg::KdTree &index,
+                                      const Matrix &query, Matrix &output, std::vector<int> *indices) const
 {
-    preAlign(face, preAlignTransform);
+    if (threadPool)
+    {
+        threadPool->getNearestPoints(&points, &query, &index, &output, indices);
+        return;
+    }
 
-    Face::LinAlg::Procrustes3DResult progress;
-    cv::flann::Index index;
-    cv::Mat features;
-    face.trainPointIndex(index, features, cv::flann::KMeansIndexParams());
+    if (indices) indices->resize(query.rows);
 
-    Matrix referencePoints = Matrix(referenceFace.pointsMat.rows, referenceFace.pointsMat.cols);
-    Matrix transformedReference = Matrix(referenceFace.pointsMat.rows, referenceFace.pointsMat.cols);
-    Matrix pointsToTransform = Matrix(referenceFace.pointsMat.rows, referenceFace.pointsMat.cols);
-    for (int iteration = 0; iteration < maxIterations; iteration++)
+    #pragma omp parallel for
+    for (int r = 0; r < query.rows; r++)
     {
-        referenceFace.pointsMat.copyTo(referencePoints);
-        referenceFace.pointsMat.copyTo(transformedReference);
-        for (int i = progress.preTranslations.size() - 1; i >= 0; i--)
+        int i = index.nearest(cv::Point3d(query(r, 0), query(r, 1), query(r, 2)));
+        if (indices) (*indices)[r] = i;
+        output(r, 0) = points(i, 0);
+        output(r, 1) = points(i, 1);
+        output(r, 2) = points(i, 2);
+    }
+}
+
+namespace
+{
+    // every step-th row
+    Matrix subsample(const Matrix &points, int step)
+    {
+        if (step <= 1) return points.clone();
+
+        Matrix result((points.rows + step - 1) / step, points.cols);
+        for (int r = 0; r < result.rows; r++)
         {
-            Face::LinAlg::Procrustes3D::translate(transformedReference, -progress.postTranslations[i]);
-            Face::LinAlg::Procrustes3D::inverseTransform(transformedReference, progress.rotations[i]);
-            Face::LinAlg::Procrustes3D::translate(transformedReference, -progress.preTranslations[i]);
+            points.row(r * step).copyTo(result.row(r));
         }
+        return result;
+    }
 
-        if (threadPool)
+    double squaredDistance(const Matrix &a, const Matrix &b, int r)
+    {
+        double dx = a(r, 0) - b(r, 0);
+        double dy = a(r, 1) - b(r, 1);
+        double dz = a(r, 2) - b(r, 2);
+        return dx*dx + dy*dy + dz*dz;
+    }
+
+    // keeps the trimRatio fraction of the closest pairs of rows, only those within maxDistance if it is positive;
+    // rows of normals (if not empty) belong to the references
+    void trimCorrespondences(Matrix &points, Matrix &references, Matrix &normals, double trimRatio, double maxDistance)
+    {
+        int n = points.rows;
+        std::vector<double> distances(n);
+        for (int r = 0; r < n; r++)
+        {
+            distances[r] = squaredDistance(points, references, r);
+        }
+
+        double threshold = maxDistance > 0 ? maxDistance*maxDistance : std::numeric_limits<double>::max();
+        int keep = std::max(3, (int)std::ceil(trimRatio * n));
+        if (keep < n)
+        {
+            std::vector<double> sorted(distances);
+            std::nth_element(sorted.begin(), sorted.begin() + keep - 1, sorted.end());
+            threshold = std::min(threshold, sorted[keep - 1]);
+        }
+
+        int count = 0;
+        for (int r = 0; r < n; r++)
+        {
+            if (distances[r] <= threshold) count++;
+        }
+        if (count == n || count < 3) return;
+
+        Matrix trimmedPoints(count, 3);
+        Matrix trimmedReferences(count, 3);
+        Matrix trimmedNormals(normals.empty() ? 0 : count, 3);
+        for (int r = 0, i = 0; r < n; r++)
+        {
+            if (distances[r] > threshold) continue;
+            points.row(r).copyTo(trimmedPoints.row(i));
+            references.row(r).copyTo(trimmedReferences.row(i));
+            if (!normals.empty()) normals.row(r).copyTo(trimmedNormals.row(i));
+            i++;
+        }
+        points = trimmedPoints;
+        references = trimmedReferences;
+        normals = trimmedNormals;
+    }
+
+    // rigid transform x -> rotation * x + translation minimizing the distances of points to references
+    void pointToPointStep(const Matrix &points, const Matrix &references, Matrix &rotation, cv::Point3d &translation)
+    {
+        Matrix from = points.clone();
+        cv::Point3d centralizeFrom = Face::LinAlg::Procrustes3D::centralizedTranslation(from);
+        Face::LinAlg::Procrustes3D::translate(from, centralizeFrom);
+
+        Matrix to = references.clone();
+        cv::Point3d centralizeTo = Face::LinAlg::Procrustes3D::centralizedTranslation(to);
+        Face::LinAlg::Procrustes3D::translate(to, centralizeTo);
+
+        // x -> rotation * (x + centralizeFrom) - centralizeTo
+        rotation = Face::LinAlg::Procrustes3D::getOptimalRotation(from, to);
+        translation = centralizeFrom;
+        Face::LinAlg::Procrustes3D::transform(translation, rotation);
+        translation -= centralizeTo;
+    }
+
+    /*
+     * Rigid transform x -> rotation * x + translation minimizing the distances of points to the
+     * planes through references perpendicular to normals. The rotation is linearized around the
+     * centroid c of the points, x -> x + w x (x - c) + t, which makes the distance
+     * (x - r).n + w.((x - c) x n) + t.n linear in (w, t).
+     */
+    void pointToPlaneStep(const Matrix &points, const Matrix &references, const Matrix &normals,
+                          Matrix &rotation, cv::Point3d &translation)
+    {
+        cv::Point3d center = -Face::LinAlg::Procrustes3D::centralizedTranslation(points);
+
+        Matrix ata = Matrix::zeros(6, 6);
+        Matrix atb = Matrix::zeros(6, 1);
+        double a[6];
+        for (int r = 0; r < points.rows; r++)
         {
-            threadPool->getNearestPoints(&face.pointsMat, &transformedReference, &index, &pointsToTransform);
+            cv::Vec3d p(points(r, 0), points(r, 1), points(r, 2));
+            cv::Vec3d n(normals(r, 0), normals(r, 1), normals(r, 2));
+            cv::Vec3d q(references(r, 0), references(r, 1), references(r, 2));
+            cv::Vec3d c = (p - cv::Vec3d(center.x, center.y, center.z)).cross(n);
+            double b = -(p - q).dot(n);
+
+            a[0] = c[0]; a[1] = c[1]; a[2] = c[2];
+            a[3] = n[0]; a[4] = n[1]; a[5] = n[2];
+            for (int i = 0; i < 6; i++)
+            {
+                for (int j = i; j < 6; j++)
+                {
+                    ata(i, j) += a[i] * a[j];
+                }
+                atb(i) += a[i] * b;
+            }
+        }
+        for (int i = 0; i < 6; i++)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                ata(i, j) = ata(j, i);
+            }
+        }
+
+        // SVD gives a least squares solution also for surfaces that don't constrain all 6 DoF
+        Matrix x;
+        cv::solve(ata, atb, x, cv::DECOMP_SVD);
+
+        Matrix w = (Matrix(3, 1) << x(0), x(1), x(2));
+        cv::Rodrigues(w, rotation);
+
+        // x -> rotation * (x - c) + c + t
+        translation = -center;
+        Face::LinAlg::Procrustes3D::transform(translation, rotation);
+        translation += center + cv::Point3d(x(3), x(4), x(5));
+    }
+}
+
+void FaceAlignerIcp::align(Mesh &face, int maxIterations, PreAlignTransform preAlignTransform) const
+{
+    IcpSettings settings;
+    settings.maxIterations = maxIterations;
+    settings.tolerance = -1;
+    settings.subsampleLevels = 1;
+    settings.trimRatio = 1;
+    settings.maxDistance = 0;
+    align(face, settings, preAlignTransform);
+}
+
+FaceAlignerIcp::IcpResult FaceAlignerIcp::align(Mesh &face, const IcpSettings &settings, PreAlignTransform preAlignTransform) const
+{
+    preAlign(face, preAlignTransform);
+
+    // The face is transformed once at the end. Iterations only compose the rigid transform
+    // current = rotation * pre-aligned + translation, so an iteration costs the same regardless
+    // of how many preceded it.
+    Matrix rotation = Matrix::eye(3, 3);
+    cv::Point3d translation(0, 0, 0);
+
+    const Matrix &facePoints = face.pointsMat;
+    Face::LinAlg::KdTree faceIndex;
+    if (!matchToReference) faceIndex = Face::LinAlg::KdTree(facePoints);
+
+    // points the correspondences are searched for
+    const Matrix &queryPoints = matchToReference ? facePoints : referenceFace.pointsMat;
+
+    IcpResult result;
+    int level = std::max(settings.subsampleLevels, 1) - 1;
+    double previousRms = -1;
+    bool pointToPlane = metric == PointToPlane;
+    Matrix referencePoints;
+    Matrix pointsToTransform;
+    Matrix normals;
+    std::vector<int> matchedReferences;
+    for (int iteration = 0; iteration < settings.maxIterations; iteration++)
+    {
+        // the last iteration always uses all points
+        if (iteration == settings.maxIterations - 1) level = 0;
+        int step = 1;
+        for (int l = 0; l < level; l++) step *= std::max(settings.subsampleStep, 1);
+
+        if (matchToReference)
+        {
+            pointsToTransform = subsample(queryPoints, step);
+            Face::LinAlg::Procrustes3D::transform(pointsToTransform, rotation);
+            Face::LinAlg::Procrustes3D::translate(pointsToTransform, translation);
+
+            referencePoints = Matrix(pointsToTransform.rows, 3);
+            getNearestPoints(referenceFace.pointsMat, referenceIndex, pointsToTransform, referencePoints,
+                             pointToPlane ? &matchedReferences : 0);
+
+            if (pointToPlane)
+            {
+                normals = Matrix(referencePoints.rows, 3);
+                for (int r = 0; r < normals.rows; r++)
+                {
+                    referenceNormals.row(matchedReferences[r]).copyTo(normals.row(r));
+                }
+            }
         }
         else
         {
-            face.getNearestPoints(transformedReference, index, pointsToTransform);
+            // reference moved to the pre-aligned face, its matches moved back to the current position
+            referencePoints = subsample(queryPoints, step);
+            if (pointToPlane) normals = subsample(referenceNormals, step);
+            Matrix query = referencePoints.clone();
+            Face::LinAlg::Procrustes3D::translate(query, -translation);
+            Face::LinAlg::Procrustes3D::inverseTransform(query, rotation);
+
+            pointsToTransform = Matrix(query.rows, 3);
+            getNearestPoints(facePoints, faceIndex, query, pointsToTransform);
+            Face::LinAlg::Procrustes3D::transform(pointsToTransform, rotation);
+            Face::LinAlg::Procrustes3D::translate(pointsToTransform, translation);
         }
 
-        // translation
-        cv::Point3d centralizeReferences = Face::LinAlg::Procrustes3D::centralizedTranslation(referencePoints);
-        Face::LinAlg::Procrustes3D::translate(referencePoints, centralizeReferences);
+        if (settings.trimRatio < 1 || settings.maxDistance > 0)
+        {
+            trimCorrespondences(pointsToTransform, referencePoints, normals, settings.trimRatio, settings.maxDistance);
+        }
 
-        cv::Point3d centralizePointsToTransform = Face::LinAlg::Procrustes3D::centralizedTranslation(pointsToTransform);
-        Face::LinAlg::Procrustes3D::translate(pointsToTransform, centralizePointsToTransform);
-        face.translate(centralizePointsToTransform);
-        progress.preTranslations.push_back(centralizePointsToTransform);
+        Matrix iterationRotation;
+        cv::Point3d iterationTranslation;
+        if (pointToPlane)
+        {
+            pointToPlaneStep(pointsToTransform, referencePoints, normals, iterationRotation, iterationTranslation);
+        }
+        else
+        {
+            pointToPointStep(pointsToTransform, referencePoints, iterationRotation, iterationTranslation);
+        }
+
+        // x -> iterationRotation * x + iterationTranslation
+        rotation = iterationRotation * rotation;
+        Face::LinAlg::Procrustes3D::transform(translation, iterationRotation);
+        translation += iterationTranslation;
+
+        // residual after this iteration (in the minimized metric) and how far it moved the correspondences
+        Matrix moved = pointsToTransform.clone();
+        Face::LinAlg::Procrustes3D::transform(moved, iterationRotation);
+        Face::LinAlg::Procrustes3D::translate(moved, iterationTranslation);
+        double residual = 0;
+        double movement = 0;
+        for (int r = 0; r < moved.rows; r++)
+        {
+            if (pointToPlane)
+            {
+                double d = (moved(r, 0) - referencePoints(r, 0)) * normals(r, 0) +
+                           (moved(r, 1) - referencePoints(r, 1)) * normals(r, 1) +
+                           (moved(r, 2) - referencePoints(r, 2)) * normals(r, 2);
+                residual += d*d;
+            }
+            else
+            {
+                residual += squaredDistance(moved, referencePoints, r);
+            }
+            movement += squaredDistance(moved, pointsToTransform, r);
+        }
+        double rms = std::sqrt(residual / moved.rows);
+        movement = std::sqrt(movement / moved.rows);
 
-        // SVD rotation
-        Matrix rotation = Face::LinAlg::Procrustes3D::getOptimalRotation(pointsToTransform, referencePoints);
-        face.transform(rotation);
-        progress.rotations.push_back(rotation);
+        result.iterations = iteration + 1;
+        result.rms = rms;
 
-        // post translation
-        face.translate(-centralizeReferences);
-        progress.postTranslations.push_back(-centralizeReferences);
+        bool levelConverged = movement <= settings.tolerance ||
+                (previousRms >= 0 && std::fabs(previousRms - rms) <= settings.tolerance);
+        previousRms = rms;
+        if (levelConverged)
+        {
+            if (level == 0)
+            {
+                result.converged = true;
+                break;
+            }
+            level--;
+            previousRms = -1;
+        }
     }
+
+    face.transform(rotation);
+    face.translate(translation);
+    return result;
 }
 
 namespace
@@ -35,6 +35,19 @@ void *MyRealloc(void *memblock, size_t size) {
     return(memblock);
 }
 
+// list in the form used by the rings: count followed by the items
+int *RingList(const int *items, int count) {
+    int *list = (int *)MyMalloc((count+1)*sizeof(int));
+    list[0] = count;
+    for (int i=0; i<count; i++)
+        list[i+1] = items[i];
+    return list;
+}
+
+bool FaceHasVertex(const NVECTOR3 face, int vertex) {
+    return face[0] == vertex || face[1] == vertex || face[2] == vertex;
+}
+
 MDenoise::MDenoise() {
     //std::cout << "MDenoise::MDenoise()" << std::endl;
 
@@ -343,13 +356,20 @@ void MDenoise::denoise(bool bNeighbourCV, float fSigma, int nIterations, int nVI
     delete []m_pf3VertexP;
     delete []m_pf3VertexNormalP;
     delete []m_pf3FaceNormalP;
-    ComputeVRing1V(); //find the neighbouring vertices of each vertex
-    ComputeVRing1T();     //find the neighbouring triangles of each vertex
+    std::vector<cv::Vec3i> faces(m_nNumFace);
+    for (k=0; k<m_nNumFace; k++)
+    {
+        faces[k] = cv::Vec3i(m_pn3Face[k][0], m_pn3Face[k][1], m_pn3Face[k][2]);
+    }
+    MeshTopology topology(m_nNumVertex, faces);
+
+    ComputeVRing1V(topology); //find the neighbouring vertices of each vertex
+    ComputeVRing1T(topology);     //find the neighbouring triangles of each vertex
 
     //find out the neighbouring triangles of each triangle
     if (bNeighbourCV)
     {
-        ComputeTRing1TCV();
+        ComputeTRing1TCV(topology);
         ttRing = m_ppnTRing1TCV;
         for (k=0; k<m_nNumFace; k++)
         {
@@ -358,7 +378,7 @@ void MDenoise::denoise(bool bNeighbourCV, float fSigma, int nIterations, int nVI
     }
     else
     {
-        ComputeTRing1TCE();
+        ComputeTRing1TCE(topology);
         ttRing = m_ppnTRing1TCE;
         for (k=0; k<m_nNumFace; k++)
         {
@@ -535,88 +555,34 @@ void MDenoise::ComputeNormal(bool bProduced) {
 }
 
 
-void MDenoise::ComputeVRing1V(void) {
-    int i,j,k;
-    int tmp0, tmp1, tmp2;
+void MDenoise::ComputeVRing1V(const MeshTopology& topology) {
+    int i;
 
     if(m_ppnVRing1V != NULL)
         return;
 
     m_ppnVRing1V=(int **)MyMalloc(m_nNumVertex*sizeof(int *));
-
     for (i=0;i<m_nNumVertex;i++) {
-        m_ppnVRing1V[i]=(int *)MyMalloc(6*sizeof(int));
-        m_ppnVRing1V[i][0]=0; // m_ppnVRing1V[i][0] stores the number of vertex neighbours
-    }
-
-    for (k=0; k<m_nNumFace; k++)
-    {
-        for (i=0;i<3;i++)
-        {
-            tmp0=m_pn3Face[k][i];
-            tmp2=m_pn3Face[k][(i+2)%3];
-            for (j=1;j<m_ppnVRing1V[tmp0][0]+1;j++)
-                if (m_ppnVRing1V[tmp0][j] == tmp2)
-                    break;
-            if (j==m_ppnVRing1V[tmp0][0]+1)
-            {
-                m_ppnVRing1V[tmp0][j]=tmp2;
-                m_ppnVRing1V[tmp0][0] += 1;
-                if (!(m_ppnVRing1V[tmp0][0]%5))
-                    m_ppnVRing1V[tmp0] = (int *)MyRealloc(m_ppnVRing1V[tmp0],(m_ppnVRing1V[tmp0][0]+6)*sizeof(int));
-            }
-            tmp1=m_pn3Face[k][(i+1)%3];
-            for (j=1;j<m_ppnVRing1V[tmp0][0]+1;j++)
-                if (m_ppnVRing1V[tmp0][j] == tmp1)
-                    break;
-            if (j==m_ppnVRing1V[tmp0][0]+1)
-            {
-                m_ppnVRing1V[tmp0][j]=tmp1;
-                m_ppnVRing1V[tmp0][0] += 1;
-                if (!(m_ppnVRing1V[tmp0][0]%5))
-                    m_ppnVRing1V[tmp0] = (int *)MyRealloc(m_ppnVRing1V[tmp0],(m_ppnVRing1V[tmp0][0]+6)*sizeof(int));
-            }
-        }
-    }
-    for (i=0;i<m_nNumVertex;i++) {
-        m_ppnVRing1V[i]=(int *)MyRealloc(m_ppnVRing1V[i],(m_ppnVRing1V[i][0]+1)*sizeof(int));
+        m_ppnVRing1V[i] = RingList(topology.neighbours(i), topology.neighbourCount(i));
     }
 }
 
-void MDenoise::ComputeVRing1T(void) {
-    int i,k;
-    int tmp;
+void MDenoise::ComputeVRing1T(const MeshTopology& topology) {
+    int i;
 
     if(m_ppnVRing1T != NULL)
         return;
 
     m_ppnVRing1T=(int **)MyMalloc(m_nNumVertex*sizeof(int *));
     for (i=0;i<m_nNumVertex;i++) {
-        m_ppnVRing1T[i]=(int *)MyMalloc(6*sizeof(int));
-        m_ppnVRing1T[i][0]=0; // m_ppnVRing1T[i][0] stores the number of triangle neighbours
-    }
-
-    for (k=0; k<m_nNumFace; k++)
-    {
-        for (i=0;i<3;i++)
-        {
-            tmp = m_pn3Face[k][i]; //the vertex incident to the k-th triangle
-            m_ppnVRing1T[tmp][0] += 1;
-            m_ppnVRing1T[tmp][m_ppnVRing1T[tmp][0]]=k;
-            if (!(m_ppnVRing1T[tmp][0]%5))
-            {
-                m_ppnVRing1T[tmp] = (int *)MyRealloc(m_ppnVRing1T[tmp],(m_ppnVRing1T[tmp][0]+6)*sizeof(int));
-            }
-        }
-    }
-    for (i=0;i<m_nNumVertex;i++) {
-        m_ppnVRing1T[i]=(int *)MyRealloc(m_ppnVRing1T[i],(m_ppnVRing1T[i][0]+1)*sizeof(int));
+        m_ppnVRing1T[i] = RingList(topology.vertexTriangles(i), topology.vertexTriangleCount(i));
     }
 }
 
-void MDenoise::ComputeTRing1TCV(void) {
-    int i,j,k;
-    int tmp,tmp0,tmp1,tmp2;
+void MDenoise::ComputeTRing1TCV(const MeshTopology& topology) {
+    int i,k,t;
+    int tmp0,tmp1,tmp2;
+    std::vector<int> ring;
 
     if(m_ppnTRing1TCV != NULL)
         return;
@@ -627,64 +593,29 @@ void MDenoise::ComputeTRing1TCV(void) {
         tmp0 = m_pn3Face[k][0];
         tmp1 = m_pn3Face[k][1];
         tmp2 = m_pn3Face[k][2];
-        tmp = m_ppnVRing1T[tmp0][0] + m_ppnVRing1T[tmp1][0] +  m_ppnVRing1T[tmp2][0];
-        m_ppnTRing1TCV[k] =(int *)MyMalloc(tmp*sizeof(int));
 
-        m_ppnTRing1TCV[k][0] = m_ppnVRing1T[tmp0][0];
-        for (i=1; i<m_ppnVRing1T[tmp0][0]+1; i++)
+        // triangles of tmp0, then those of tmp1 without tmp0, then those of tmp2 without tmp0 and tmp1
+        ring.assign(topology.vertexTriangles(tmp0), topology.vertexTriangles(tmp0) + topology.vertexTriangleCount(tmp0));
+        for (i=0; i<topology.vertexTriangleCount(tmp1); i++)
         {
-            m_ppnTRing1TCV[k][i] = m_ppnVRing1T[tmp0][i];
+            t = topology.vertexTriangles(tmp1)[i];
+            if (!FaceHasVertex(m_pn3Face[t], tmp0))
+                ring.push_back(t);
         }
-
-        for (i=1; i<m_ppnVRing1T[tmp1][0]+1; i++)
+        for (i=0; i<topology.vertexTriangleCount(tmp2); i++)
         {
-            if((m_pn3Face[m_ppnVRing1T[tmp1][i]][0] != tmp0) && (m_pn3Face[m_ppnVRing1T[tmp1][i]][1] != tmp0)\
-                    && (m_pn3Face[m_ppnVRing1T[tmp1][i]][2] != tmp0))
-            {
-                ++m_ppnTRing1TCV[k][0];
-                m_ppnTRing1TCV[k][m_ppnTRing1TCV[k][0]]= m_ppnVRing1T[tmp1][i];
-            }
-            else
-            {
-                for(j=1; j<m_ppnTRing1TCV[k][0]+1; j++)
-                {
-                    if(m_ppnTRing1TCV[k][j]==m_ppnVRing1T[tmp1][i])
-                    {
-                        break;
-                    }
-                }
-            }
-        }
-
-        for (i=1; i<m_ppnVRing1T[tmp2][0]+1; i++)
-        {
-            if((m_pn3Face[m_ppnVRing1T[tmp2][i]][0] != tmp0) && (m_pn3Face[m_ppnVRing1T[tmp2][i]][1] != tmp0)\
-                    && (m_pn3Face[m_ppnVRing1T[tmp2][i]][2] != tmp0) && (m_pn3Face[m_ppnVRing1T[tmp2][i]][0] != tmp1)\
-                    && (m_pn3Face[m_ppnVRing1T[tmp2][i]][1] != tmp1) && (m_pn3Face[m_ppnVRing1T[tmp2][i]][2] != tmp1))
-            {
-                ++m_ppnTRing1TCV[k][0];
-                m_ppnTRing1TCV[k][m_ppnTRing1TCV[k][0]]= m_ppnVRing1T[tmp2][i];
-            }
-            else
-            {
-                for(j=1; j<m_ppnTRing1TCV[k][0]+1; j++)
-                {
-                    if(m_ppnTRing1TCV[k][j]==m_ppnVRing1T[tmp2][i])
-                    {
-                        break;
-                    }
-                }
-            }
+            t = topology.vertexTriangles(tmp2)[i];
+            if (!FaceHasVertex(m_pn3Face[t], tmp0) && !FaceHasVertex(m_pn3Face[t], tmp1))
+                ring.push_back(t);
         }
-    }
-    for (i=0;i<m_nNumFace;i++) {
-        m_ppnTRing1TCV[i]=(int *)MyRealloc(m_ppnTRing1TCV[i],(m_ppnTRing1TCV[i][0]+1)*sizeof(int));
+        m_ppnTRing1TCV[k] = RingList(ring.data(), ring.size());
     }
 }
 
-void MDenoise::ComputeTRing1TCE(void) {
-    int i,k;
+void MDenoise::ComputeTRing1TCE(const MeshTopology& topology) {
+    int i,k,t,e;
     int tmp,tmp0,tmp1,tmp2;
+    int ring[4];
 
     if(m_ppnTRing1TCE != NULL)
         return;
@@ -696,76 +627,26 @@ void MDenoise::ComputeTRing1TCE(void) {
         tmp1 = m_pn3Face[k][1];
         tmp2 = m_pn3Face[k][2];
 
-        m_ppnTRing1TCE[k] = (int *)MyMalloc(5*sizeof(int));
-
+        // triangles of tmp0 sharing an edge with k (k included), at most 4
         tmp = 0;
-        for (i=1; i<m_ppnVRing1T[tmp0][0]+1; i++)
+        for (i=0; i<topology.vertexTriangleCount(tmp0) && tmp<4; i++)
         {
-            if ((m_pn3Face[m_ppnVRing1T[tmp0][i]][0] == tmp1)||(m_pn3Face[m_ppnVRing1T[tmp0][i]][0] == tmp2)||\
-                    (m_pn3Face[m_ppnVRing1T[tmp0][i]][1] == tmp1)||(m_pn3Face[m_ppnVRing1T[tmp0][i]][1] == tmp2)||\
-                    (m_pn3Face[m_ppnVRing1T[tmp0][i]][2] == tmp1)||(m_pn3Face[m_ppnVRing1T[tmp0][i]][2] == tmp2))
-            {
-                tmp++;
-                if (tmp>4)
-                {
-                    tmp--;
-                    break;
-                }
-                m_ppnTRing1TCE[k][tmp] = m_ppnVRing1T[tmp0][i];
-            }
+            t = topology.vertexTriangles(tmp0)[i];
+            if (FaceHasVertex(m_pn3Face[t], tmp1) || FaceHasVertex(m_pn3Face[t], tmp2))
+                ring[tmp++] = t;
         }
 
-        for (i=1; i<m_ppnVRing1T[tmp1][0]+1; i++)
+        // and the triangle across the edge tmp1-tmp2
+        e = topology.edgeIndex(tmp1, tmp2);
+        if (e >= 0 && tmp < 4)
         {
-            if ((m_pn3Face[m_ppnVRing1T[tmp1][i]][0] == tmp1)&&\
-                    ((m_pn3Face[m_ppnVRing1T[tmp1][i]][1] == tmp2)||(m_pn3Face[m_ppnVRing1T[tmp1][i]][2] == tmp2)))
-            {
-                tmp++;
-                if (tmp>4)
-                {
-                    tmp--;
-                    break;
-                }
-                m_ppnTRing1TCE[k][tmp] = m_ppnVRing1T[tmp1][i];
-                break;
-            }
-            else if((m_pn3Face[m_ppnVRing1T[tmp1][i]][0] == tmp2)&&\
-                    ((m_pn3Face[m_ppnVRing1T[tmp1][i]][1] == tmp1)||(m_pn3Face[m_ppnVRing1T[tmp1][i]][2] == tmp1)))
-            {
-                tmp++;
-                if (tmp>4)
-                {
-                    tmp--;
-                    break;
-                }
-                m_ppnTRing1TCE[k][tmp] = m_ppnVRing1T[tmp1][i];
-                break;
-            }
-            else if((m_pn3Face[m_ppnVRing1T[tmp1][i]][1] == tmp2)&&(m_pn3Face[m_ppnVRing1T[tmp1][i]][2] == tmp1))
-            {
-                tmp++;
-                if (tmp>4)
-                {
-                    tmp--;
-                    break;
-                }
-                m_ppnTRing1TCE[k][tmp] = m_ppnVRing1T[tmp1][i];
-                break;
-            }
-            else if((m_pn3Face[m_ppnVRing1T[tmp1][i]][1] == tmp1)&&\
-                    (m_pn3Face[m_ppnVRing1T[tmp1][i]][2] == tmp2)&&(m_pn3Face[m_ppnVRing1T[tmp1][i]][0] != tmp0))
-            {
-                tmp++;
-                if (tmp>4)
-                {
-                    tmp--;
-                    break;
-                }
-                m_ppnTRing1TCE[k][tmp] = m_ppnVRing1T[tmp1][i];
-                break;
-            }
+            const MeshTopology::Edge& edge = topology.edge(e);
+            t = edge.triangles[0] == k ? edge.triangles[1] : edge.triangles[0];
+            if (t >= 0 && t != k)
+                ring[tmp++] = t;
         }
-        m_ppnTRing1TCE[k][0] = tmp;
+
+        m_ppnTRing1TCE[k] = RingList(ring, tmp);
     }
 }
 
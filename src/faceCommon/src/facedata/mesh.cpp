@@ -31,6 +31,7 @@ void Mesh::clear()
 	pointsMat = Matrix::zeros(0, 3);
 	colors.clear();
 	triangles.clear();
+	invalidateTopology();
 }
 
 void Mesh::recalculateMinMax()
@@ -118,6 +119,22 @@ void Mesh::calculateTriangles()
     }
 
     triangles = Face::LinAlg::Delaunay::process(points2d);
+    invalidateTopology();
+}
+
+const MeshTopology &Mesh::topology()
+{
+    if (cachedTopology.empty() || cachedTopology->vertexCount() != pointsMat.rows ||
+        cachedTopology->triangleCount() != (int)triangles.size())
+    {
+        cachedTopology = new MeshTopology(pointsMat.rows, triangles);
+    }
+    return *cachedTopology;
+}
+
+void Mesh::invalidateTopology()
+{
+    cachedTopology.release();
 }
 
 Mesh Mesh::fromFile(const std::string &filename, bool centralizeLoadedMesh)
@@ -368,6 +385,7 @@ Mesh::Mesh(const Mesh &src)
 
     pointsMat = src.pointsMat.clone();
     triangles = src.triangles;
+    cachedTopology = src.cachedTopology;
     colors = src.colors;
 	uvmap = src.uvmap;
 }
@@ -385,6 +403,7 @@ Mesh & Mesh::operator =(const Mesh &src)
 
         pointsMat = src.pointsMat.clone();
         triangles = src.triangles;
+        cachedTopology = src.cachedTopology;
         colors = src.colors;
         uvmap = src.uvmap;
     }
@@ -0,0 +1,108 @@
+#include "faceCommon/facedata/meshtopology.h"
+
+#include <algorithm>
+
+#include "faceCommon/linalg/common.h"
+
+using namespace Face::FaceData;
+
+MeshTopology::MeshTopology(int vertexCount, const std::vector<cv::Vec3i> &triangles)
+{
+    int tc = triangles.size();
+
+    // triangles of every vertex, counted first and then filled in the order of triangles
+    triangleOffsets.assign(vertexCount + 1, 0);
+    for (int t = 0; t < tc; t++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int v = triangles[t][i];
+            if (v < 0 || v >= vertexCount) throw FACELIB_EXCEPTION("triangle vertex index out of range");
+            triangleOffsets[v + 1]++;
+        }
+    }
+    for (int v = 0; v < vertexCount; v++)
+    {
+        triangleOffsets[v + 1] += triangleOffsets[v];
+    }
+    triangleIndices.resize(triangleOffsets[vertexCount]);
+    std::vector<int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (int t = 0; t < tc; t++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            triangleIndices[fill[triangles[t][i]]++] = t;
+        }
+    }
+
+    // neighbours are the other vertices of those triangles
+    neighbourOffsets.assign(vertexCount + 1, 0);
+    neighbourIndices.reserve(triangleIndices.size());
+    edgeOffsets.assign(vertexCount + 1, 0);
+    std::vector<int> candidates;
+    for (int v = 0; v < vertexCount; v++)
+    {
+        candidates.clear();
+        for (int i = triangleOffsets[v]; i < triangleOffsets[v + 1]; i++)
+        {
+            const cv::Vec3i &t = triangles[triangleIndices[i]];
+            for (int j = 0; j < 3; j++)
+            {
+                if (t[j] != v) candidates.push_back(t[j]);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        neighbourIndices.insert(neighbourIndices.end(), candidates.begin(), candidates.end());
+        neighbourOffsets[v + 1] = neighbourIndices.size();
+
+        int upper = candidates.end() - std::upper_bound(candidates.begin(), candidates.end(), v);
+        edgeOffsets[v + 1] = edgeOffsets[v] + upper;
+    }
+
+    edges.resize(edgeOffsets[vertexCount]);
+    for (int a = 0; a < vertexCount; a++)
+    {
+        const int *begin = neighbours(a);
+        const int *end = begin + neighbourCount(a);
+        int e = edgeOffsets[a];
+        for (const int *b = std::upper_bound(begin, end, a); b != end; ++b, ++e)
+        {
+            edges[e].a = a;
+            edges[e].b = *b;
+            edges[e].triangles[0] = -1;
+            edges[e].triangles[1] = -1;
+        }
+    }
+
+    // edges of non-manifold meshes keep only their first two triangles
+    edgesOfTriangles.resize(tc);
+    for (int t = 0; t < tc; t++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int e = edgeIndex(triangles[t][(i + 1) % 3], triangles[t][(i + 2) % 3]);
+            edgesOfTriangles[t][i] = e;
+            if (e < 0) continue;
+
+            Edge &edge = edges[e];
+            if (edge.triangles[0] < 0) edge.triangles[0] = t;
+            else if (edge.triangles[1] < 0 && edge.triangles[0] != t) edge.triangles[1] = t;
+        }
+    }
+}
+
+int MeshTopology::edgeIndex(int a, int b) const
+{
+    if (a == b) return -1;
+    if (a > b) std::swap(a, b);
+
+    const int *begin = neighbours(a);
+    const int *end = begin + neighbourCount(a);
+    const int *upper = std::upper_bound(begin, end, a);
+    const int *found = std::lower_bound(upper, end, b);
+    if (found == end || *found != b) return -1;
+
+    return edgeOffsets[a] + (found - upper);
+}
@@ -5,7 +5,8 @@
 using namespace Face::FaceData;
 
 void NearestPointsThreadPool::Thread::setUp(int startRow, int endRow, const Matrix *pointsMat,
-                                            const Matrix *input, cv::flann::Index *index, Matrix *output)
+                                            const Matrix *input, const Face::LinAlg::KdTree *index, Matrix *output,
+                                            std::vector<int> *indices)
 {
     this->startRow = startRow;
     this->endRow = endRow;
@@ -13,6 +14,7 @@ void NearestPointsThreadPool::Thread::setUp(int startRow, int endRow, const Matr
     this->input = input;
     this->pointsMat = pointsMat;
     this->output = output;
+    this->indices = indices;
 }
 
 void NearestPointsThreadPool::Thread::run()
@@ -20,17 +22,11 @@ void NearestPointsThreadPool::Thread::run()
     //std::cout << "in thread " << startRow << ".." << endRow << "; " << pointsMat->rows << " " << output->rows << " " << input->rows << std::endl;
     for (int r = startRow; r < endRow; r++)
     {
-        cv::Mat query;
-        input->row(r).convertTo(query, CV_32F);
-
-        std::vector<int> resultIndicies;
-        std::vector<float> resultDistances;
-        index->knnSearch(query, resultIndicies, resultDistances, 1);
-
-        int pIndex = resultIndicies[0];
+        int pIndex = index->nearest(cv::Point3d((*input)(r, 0), (*input)(r, 1), (*input)(r, 2)));
         (*output)(r, 0) = (*pointsMat)(pIndex, 0);
         (*output)(r, 1) = (*pointsMat)(pIndex, 1);
         (*output)(r, 2) = (*pointsMat)(pIndex, 2);
+        if (indices) (*indices)[r] = pIndex;
     }
 }
 
@@ -39,15 +35,19 @@ NearestPointsThreadPool::NearestPointsThreadPool()
     threads = std::vector<NearestPointsThreadPool::Thread>(Poco::Environment::processorCount());
 }
 
-void NearestPointsThreadPool::getNearestPoints(const Matrix *pointsMat, const Matrix *input, cv::flann::Index *index, Matrix *output)
+void NearestPointsThreadPool::getNearestPoints(const Matrix *pointsMat, const Matrix *input,
+                                               const Face::LinAlg::KdTree *index, Matrix *output,
+                                               std::vector<int> *indices)
 {
+    if (indices) indices->resize(input->rows);
+
     for (unsigned int i = 0; i < threads.size(); i++)
     {
         int startRow = i * input->rows / threads.size();
         int endRow = (i+1) * input->rows / threads.size();
 
         //std::cout << i << " " << pointsMat->rows << " startRow: " << startRow << " endRow: " << endRow << std::endl;
-        threads[i].setUp(startRow, endRow, pointsMat, input, index, output);
+        threads[i].setUp(startRow, endRow, pointsMat, input, index, output, indices);
         start(threads[i], "align-"+std::to_string(i));
     }
     joinAll();
@@ -2,6 +2,7 @@
 
 #include <math.h>
 #include <limits>
+#include <algorithm>
 
 #include "faceCommon/facedata/util.h"
 #include "faceCommon/linalg/pca.h"
@@ -11,40 +12,31 @@ using namespace Face::FaceData;
 
 void SurfaceProcessor::smooth(Mesh &mesh, double alpha, int steps)
 {
-    std::map<int, std::set<int>> neighbours;
+    const MeshTopology &topology = mesh.topology();
     int pc = mesh.pointsMat.rows;
-    int tc = mesh.triangles.size();
-    for (int i = 0; i < tc; i++)
-    {
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][1]);
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][1]);
-    }
 
-    double * newx = new double[pc];
-    double * newy = new double[pc];
-    double * newz = new double[pc];
+    std::vector<double> newx(pc);
+    std::vector<double> newy(pc);
+    std::vector<double> newz(pc);
     for (int i = 0; i < steps; i++)
     {
+        #pragma omp parallel for
         for (int j = 0; j < pc; j++)
         {
+            int count = topology.neighbourCount(j);
+            const int *neighbours = topology.neighbours(j);
             double sumx = 0.0;
             double sumy = 0.0;
             double sumz = 0.0;
-            for (int neighbour : neighbours[j])
+            for (int n = 0; n < count; n++)
             {
-                sumx += (mesh.pointsMat(neighbour, 0) - mesh.pointsMat(j, 0));
-                sumy += (mesh.pointsMat(neighbour, 1) - mesh.pointsMat(j, 1));
-                sumz += (mesh.pointsMat(neighbour, 2) - mesh.pointsMat(j, 2));
+                sumx += (mesh.pointsMat(neighbours[n], 0) - mesh.pointsMat(j, 0));
+                sumy += (mesh.pointsMat(neighbours[n], 1) - mesh.pointsMat(j, 1));
+                sumz += (mesh.pointsMat(neighbours[n], 2) - mesh.pointsMat(j, 2));
             }
-            newx[j] = sumx/neighbours[j].size();
-            newy[j] = sumy/neighbours[j].size();
-            newz[j] = sumz/neighbours[j].size();
+            newx[j] = count ? sumx/count : 0.0;
+            newy[j] = count ? sumy/count : 0.0;
+            newz[j] = count ? sumz/count : 0.0;
         }
 
         for (int j = 0; j < pc; j++)
@@ -54,39 +46,27 @@ void SurfaceProcessor::smooth(Mesh &mesh, double alpha, int steps)
             mesh.pointsMat(j, 2) += alpha * newz[j];
         }
     }
-    delete [] newx;
-    delete [] newy;
-    delete [] newz;
 }
 
 void SurfaceProcessor::zsmooth(Mesh &mesh, double alpha, int steps)
 {
-    std::map<int, std::set<int>> neighbours;
+    const MeshTopology &topology = mesh.topology();
     int pc = mesh.pointsMat.rows;
-    int tc = mesh.triangles.size();
-    for (int i = 0; i < tc; i++)
-    {
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][1]);
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][1]);
-    }
 
     std::vector<double> newz(pc);
     for (int i = 0; i < steps; i++)
     {
+        #pragma omp parallel for
         for (int j = 0; j < pc; j++)
         {
+            int count = topology.neighbourCount(j);
+            const int *neighbours = topology.neighbours(j);
             double sumz = 0.0;
-            for (int neighbour : neighbours[j])
+            for (int n = 0; n < count; n++)
             {
-                sumz += (mesh.pointsMat(neighbour, 2) - mesh.pointsMat(j, 2));
+                sumz += (mesh.pointsMat(neighbours[n], 2) - mesh.pointsMat(j, 2));
             }
-            newz[j] = sumz/neighbours[j].size();
+            newz[j] = count ? sumz/count : 0.0;
         }
 
         for (int j = 0; j < pc; j++)
@@ -97,43 +77,36 @@ void SurfaceProcessor::zsmooth(Mesh &mesh, double alpha, int steps)
 }
 
 void SurfaceProcessor::anisotropicDiffusionSmooth(Mesh &mesh, AnisotropicDiffusionType type, double edgeThresh, int steps, double dt) {
-    std::map<int, std::set<int>> neighbours;
+    const MeshTopology &topology = mesh.topology();
     int pc = mesh.pointsMat.rows;
-    int tc = mesh.triangles.size();
-    for (int i = 0; i < tc; i++)
-    {
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][1]);
-        neighbours[mesh.triangles[i][0]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][1]].insert(mesh.triangles[i][2]);
-
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][0]);
-        neighbours[mesh.triangles[i][2]].insert(mesh.triangles[i][1]);
-    }
 
+    Matrix points0;
+    Matrix blurred;
     for (int i = 0; i < steps; i++)
     {
-        Mesh mesh0(mesh);
-        Mesh tmpMesh(mesh);
-        cv::GaussianBlur(mesh.pointsMat, tmpMesh.pointsMat, cv::Size(5, 5), 0.5);
+        mesh.pointsMat.copyTo(points0);
+        cv::GaussianBlur(mesh.pointsMat, blurred, cv::Size(5, 5), 0.5);
+
+        #pragma omp parallel for
         for (int j = 0; j < pc; j++)
         {
+            int count = topology.neighbourCount(j);
+            const int *neighbours = topology.neighbours(j);
             double gradient;
             double diffusionCoef;
             double rawGradient;
             double stepCoef = 0.0;
-            for (int neighbour : neighbours[j])
+            for (int n = 0; n < count; n++)
             {
-                gradient = tmpMesh.pointsMat(neighbour, 2) - tmpMesh.pointsMat(j, 2);
-                rawGradient = mesh0.pointsMat(neighbour, 2) - mesh0.pointsMat(j, 2);
+                gradient = blurred(neighbours[n], 2) - blurred(j, 2);
+                rawGradient = points0(neighbours[n], 2) - points0(j, 2);
                 diffusionCoef = edgeThresh;
                 if (type == PeronaMalic) {
                     diffusionCoef = 1.0 / (1.0 + (gradient*gradient) / (edgeThresh*edgeThresh));
                 }
                 stepCoef += rawGradient * diffusionCoef;
             }
-            mesh.pointsMat(j, 2) = mesh0.pointsMat(j, 2) + dt * stepCoef;
+            mesh.pointsMat(j, 2) = points0(j, 2) + dt * stepCoef;
         }
     }
 }
@@ -164,157 +137,258 @@ inline int convert3DmodelToMap(double value, double minVal, double maxVal, doubl
     return (value-minVal)/(maxVal-minVal) * resultSize;
 }
 
-inline double linearInterpolation(double x1, double y1, double z1,
-                                  double x2, double y2, double z2,
-                                  double x3, double y3, double z3,
-                                  double x, double y)
+// per-vertex data of the channel
+inline double vertexValue(const Mesh &mesh, int index, SurfaceProcessor::SurfaceDataToProcess channel)
 {
-    if (x1 == x2 && y1 == y2 && x1 == x3 && y1 == y3)
+    switch (channel)
     {
-        return (z1+z2+z3)/3;
+    case SurfaceProcessor::ZCoord:
+        return mesh.pointsMat(index, 2);
+    case SurfaceProcessor::Texture_I:
+        return 0.299*mesh.colors[index][2] + 0.587*mesh.colors[index][1] + 0.114*mesh.colors[index][0];
+    case SurfaceProcessor::Texture_R:
+        return mesh.colors[index][2];
+    case SurfaceProcessor::Texture_G:
+        return mesh.colors[index][1];
+    case SurfaceProcessor::Texture_B:
+    default:
+        return mesh.colors[index][0];
     }
+}
 
-    // Ax + By + Cz + D = 0
-    double A = y1*(z2 - z3) + y2*(z3 - z1) + y3*(z1 - z2);
-    double B = z1*(x2 - x3) + z2*(x3 - x1) + z3*(x1 - x2);
-    double C = x1*(y2 - y3) + x2*(y3 - y1) + x3*(y1 - y2);
-    double D = -A*x1 - B*y1 - C*z1;
+/*
+ * Plane v = a*x + b*y + d through (x1, y1, v1), (x2, y2, v2), (x3, y3, v3); c is the doubled signed area of
+ * the triangle in map coordinates, shared by all channels. Degenerated triangles give the mean value.
+ */
+struct PlaneEquation
+{
+    double a, b, d;
 
-    double result = -(A/C)*x - (B/C)*y - D/C;
-    if (result != result)
+    PlaneEquation(int x1, int y1, double v1, int x2, int y2, double v2, int x3, int y3, double v3, double c)
     {
-        return (z1+z2+z3)/3;
+        if (c == 0)
+        {
+            a = 0; b = 0; d = (v1 + v2 + v3)/3;
+            return;
+        }
+
+        // Ax + By + Cv + D = 0
+        double A = y1*(v2 - v3) + y2*(v3 - v1) + y3*(v1 - v2);
+        double B = v1*(x2 - x3) + v2*(x3 - x1) + v3*(x1 - x2);
+        double D = -A*x1 - B*y1 - c*v1;
+        a = -A/c;
+        b = -B/c;
+        d = -D/c;
+    }
+
+    double at(int x, int y) const
+    {
+        return a*x + b*y + d;
+    }
+};
+
+struct ProjectedTriangle
+{
+    int x[3];
+    int y[3];
+};
+
+// part of the triangle within the clip rectangle drawn to the maps of the target
+void rasterizeTriangle(const Mesh &mesh, int index, const ProjectedTriangle &p, const cv::Rect &clip,
+                       DepthmapTarget &target, Map &zmap, std::vector<PlaneEquation> &planes)
+{
+    int x1 = p.x[0]; int y1 = p.y[0];
+    int x2 = p.x[1]; int y2 = p.y[1];
+    int x3 = p.x[2]; int y3 = p.y[2];
+
+    int startX = std::max((int)min(x1, x2, x3), clip.x);
+    int endX = std::min((int)max(x1, x2, x3), clip.x + clip.width - 1);
+    int startY = std::max((int)min(y1, y2, y3), clip.y);
+    int endY = std::min((int)max(y1, y2, y3), clip.y + clip.height - 1);
+    if (startX > endX || startY > endY) return;
+
+    const cv::Vec3i &t = mesh.triangles[index];
+    double area = x1*(y2 - y3) + x2*(y3 - y1) + x3*(y1 - y2);
+    PlaneEquation zPlane(x1, y1, mesh.pointsMat(t[0], 2), x2, y2, mesh.pointsMat(t[1], 2),
+                         x3, y3, mesh.pointsMat(t[2], 2), area);
+    int channelCount = target.channels.size();
+    planes.clear();
+    for (int ch = 0; ch < channelCount; ch++)
+    {
+        SurfaceProcessor::SurfaceDataToProcess channel = target.channels[ch];
+        planes.push_back(PlaneEquation(x1, y1, vertexValue(mesh, t[0], channel),
+                                       x2, y2, vertexValue(mesh, t[1], channel),
+                                       x3, y3, vertexValue(mesh, t[2], channel), area));
+    }
+
+    int dx1 = x2-x1; int dy1 = y2-y1;
+    int dx2 = x3-x2; int dy2 = y3-y2;
+    int dx3 = x1-x3; int dy3 = y1-y3;
+
+    for (int y = startY; y <= endY; ++y)
+    {
+        // edge functions at [startX, y]
+        int e1 = (startX-x1)*dy1 - (y-y1)*dx1;
+        int e2 = (startX-x2)*dy2 - (y-y2)*dx2;
+        int e3 = (startX-x3)*dy3 - (y-y3)*dx3;
+
+        // the y-terms of the planes are constant along the scanline; values are evaluated from x rather
+        // than accumulated, so they don't depend on where the scanline is clipped
+        double zRowTerm = zPlane.b*y + zPlane.d;
+        int mapY = (zmap.h-1)-y;
+        double *zRow = zmap.values.ptr<double>(mapY);
+        char *zFlags = zmap.flags.ptr<char>(mapY);
+        for (int x = startX; x <= endX; ++x)
+        {
+            double z = zPlane.a*x + zRowTerm;
+            if (e1 <= 0 && e2 <= 0 && e3 <= 0 && (!zFlags[x] || zRow[x] < z))
+            {
+                zFlags[x] = 1;
+                zRow[x] = z;
+                for (int ch = 0; ch < channelCount; ch++)
+                {
+                    target.maps[ch].set(x, mapY, planes[ch].at(x, y));
+                }
+            }
+
+            e1 += dy1;
+            e2 += dy2;
+            e3 += dy3;
+        }
     }
-    return result;
 }
 
 }
 
-void SurfaceProcessor::depthmap(const Mesh &mesh, Map &map, cv::Point2d meshStart, cv::Point2d meshEnd, SurfaceDataToProcess dataToProcess)
+DepthmapTarget::DepthmapTarget(cv::Point2d meshStart, cv::Point2d meshEnd, double scaleCoef,
+                               const std::vector<SurfaceProcessor::SurfaceDataToProcess> &channels) :
+    channels(channels)
 {
-    Map zmap(map.w, map.h);
-    int c = mesh.triangles.size();
-    for (int i = 0; i < c; i++)
+    converter.meshStart = meshStart;
+    converter.meshSize = meshEnd - meshStart;
+    for (unsigned int i = 0; i < channels.size(); i++)
     {
-        const cv::Vec3i &t = mesh.triangles[i];
-        double x1d = mesh.pointsMat(t[0], 0);
-        double y1d = mesh.pointsMat(t[0], 1);
-        double x2d = mesh.pointsMat(t[1], 0);
-        double y2d = mesh.pointsMat(t[1], 1);
-        double x3d = mesh.pointsMat(t[2], 0);
-        double y3d = mesh.pointsMat(t[2], 1);
-
-        double v1d, v2d, v3d;
-        switch (dataToProcess)
+        maps.push_back(Map(converter.meshSize.x * scaleCoef , converter.meshSize.y * scaleCoef));
+    }
+}
+
+DepthmapTarget::DepthmapTarget(const Mesh &mesh, double scaleCoef,
+                               const std::vector<SurfaceProcessor::SurfaceDataToProcess> &channels) :
+    DepthmapTarget(cv::Point2d(mesh.minx, mesh.miny), cv::Point2d(mesh.maxx, mesh.maxy), scaleCoef, channels)
+{
+
+}
+
+const Map &DepthmapTarget::map(SurfaceProcessor::SurfaceDataToProcess channel) const
+{
+    for (unsigned int i = 0; i < channels.size(); i++)
+    {
+        if (channels[i] == channel) return maps[i];
+    }
+    throw FACELIB_EXCEPTION("channel is not rasterized");
+}
+
+void SurfaceProcessor::depthmaps(const Mesh &mesh, std::vector<DepthmapTarget> &targets)
+{
+    // Triangles are binned into tiles of the maps and the tiles are rasterized in parallel. A tile owns
+    // its pixels of the maps and of the z-buffer and keeps the order of the triangles, so the result
+    // doesn't depend on the tiling or on the count of threads.
+    const int tileSize = 64;
+
+    int targetCount = targets.size();
+    int triangleCount = mesh.triangles.size();
+    std::vector<Map> zmaps;
+    std::vector<std::vector<ProjectedTriangle> > projected(targetCount);
+    std::vector<std::pair<int, cv::Rect> > tiles;
+    std::vector<std::vector<int> > tileTriangles;
+    for (int ti = 0; ti < targetCount; ti++)
+    {
+        const DepthmapTarget &target = targets[ti];
+        if (target.maps.empty()) throw FACELIB_EXCEPTION("no channels to rasterize");
+        int w = target.maps[0].w;
+        int h = target.maps[0].h;
+        zmaps.push_back(Map(w, h));
+
+        cv::Point2d meshStart = target.converter.meshStart;
+        cv::Point2d meshEnd = meshStart + target.converter.meshSize;
+        std::vector<ProjectedTriangle> &p = projected[ti];
+        p.resize(triangleCount);
+        #pragma omp parallel for
+        for (int i = 0; i < triangleCount; i++)
         {
-        case ZCoord:
-            v1d = mesh.pointsMat(t[0], 2);
-            v2d = mesh.pointsMat(t[1], 2);
-            v3d = mesh.pointsMat(t[2], 2);
-            break;
-        case Texture_I:
-            v1d = 0.299*mesh.colors[t[0]][2] + 0.587*mesh.colors[t[0]][1] + 0.114*mesh.colors[t[0]][0];
-            v2d = 0.299*mesh.colors[t[1]][2] + 0.587*mesh.colors[t[1]][1] + 0.114*mesh.colors[t[1]][0];
-            v3d = 0.299*mesh.colors[t[2]][2] + 0.587*mesh.colors[t[2]][1] + 0.114*mesh.colors[t[2]][0];
-            break;
-        case Texture_R:
-            v1d = mesh.colors[t[0]][2];
-            v2d = mesh.colors[t[1]][2];
-            v3d = mesh.colors[t[2]][2];
-            break;
-        case Texture_G:
-            v1d = mesh.colors[t[0]][1];
-            v2d = mesh.colors[t[1]][1];
-            v3d = mesh.colors[t[2]][1];
-            break;
-        case Texture_B:
-        default:
-            v1d = mesh.colors[t[0]][0];
-            v2d = mesh.colors[t[1]][0];
-            v3d = mesh.colors[t[2]][0];
-            break;
+            const cv::Vec3i &t = mesh.triangles[i];
+            for (int v = 0; v < 3; v++)
+            {
+                p[i].x[v] = convert3DmodelToMap(mesh.pointsMat(t[v], 0), meshStart.x, meshEnd.x, w);
+                p[i].y[v] = convert3DmodelToMap(mesh.pointsMat(t[v], 1), meshStart.y, meshEnd.y, h);
+            }
         }
-        double z1d = mesh.pointsMat(t[0], 2);
-        double z2d = mesh.pointsMat(t[1], 2);
-        double z3d = mesh.pointsMat(t[2], 2);
-
-        int x1 = convert3DmodelToMap(x1d, meshStart.x, meshEnd.x, map.w);
-        int y1 = convert3DmodelToMap(y1d, meshStart.y, meshEnd.y, map.h);
-        int x2 = convert3DmodelToMap(x2d, meshStart.x, meshEnd.x, map.w);
-        int y2 = convert3DmodelToMap(y2d, meshStart.y, meshEnd.y, map.h);
-        int x3 = convert3DmodelToMap(x3d, meshStart.x, meshEnd.x, map.w);
-        int y3 = convert3DmodelToMap(y3d, meshStart.y, meshEnd.y, map.h);
-
-        int triangleMinX = min(x1, x2, x3);
-        int triangleMinY = min(y1, y2, y3);
-        int triangleMaxX = max(x1, x2, x3);
-        int triangleMaxY = max(y1, y2, y3);
-
-        int dx1 = x2-x1; int dy1 = y2-y1;
-        int dx2 = x3-x2; int dy2 = y3-y2;
-        int dx3 = x1-x3; int dy3 = y1-y3;
-
-        // vyplnovani...
-        for (int y = triangleMinY; y <= triangleMaxY; ++y)
+
+        // map rows are flipped, tiles are in the coordinates of the triangles
+        int tilesX = (w + tileSize - 1) / tileSize;
+        int tilesY = (h + tileSize - 1) / tileSize;
+        int firstTile = tiles.size();
+        for (int ty = 0; ty < tilesY; ty++)
         {
-            // inicilizace hranove fce v bode [minx, y]
-            int e1 = (triangleMinX-x1)*dy1 - (y-y1)*dx1;
-            int e2 = (triangleMinX-x2)*dy2 - (y-y2)*dx2;
-            int e3 = (triangleMinX-x3)*dy3 - (y-y3)*dx3;
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                int x = tx * tileSize;
+                int y = ty * tileSize;
+                tiles.push_back(std::make_pair(ti, cv::Rect(x, y, std::min(tileSize, w - x), std::min(tileSize, h - y))));
+            }
+        }
+        tileTriangles.resize(tiles.size());
 
-            for (int x = triangleMinX; x <= triangleMaxX; ++x)
+        for (int i = 0; i < triangleCount; i++)
+        {
+            const ProjectedTriangle &t = p[i];
+            int startX = std::max((int)min(t.x[0], t.x[1], t.x[2]), 0);
+            int endX = std::min((int)max(t.x[0], t.x[1], t.x[2]), w - 1);
+            int startY = std::max((int)min(t.y[0], t.y[1], t.y[2]), 0);
+            int endY = std::min((int)max(t.y[0], t.y[1], t.y[2]), h - 1);
+            if (startX > endX || startY > endY) continue;
+
+            for (int ty = startY / tileSize; ty <= endY / tileSize; ty++)
             {
-                if( e1 <= 0 && e2 <= 0 && e3 <= 0 )
+                for (int tx = startX / tileSize; tx <= endX / tileSize; tx++)
                 {
-                    if (x >= 0 && x < map.w && y >= 0 && y < map.h)
-                    {
-                        double v = linearInterpolation(x1, y1, v1d,
-                                                       x2, y2, v2d,
-                                                       x3, y3, v3d,
-                                                       x, y);
-                        double z = linearInterpolation(x1, y1, z1d,
-                                                       x2, y2, z2d,
-                                                       x3, y3, z3d,
-                                                       x, y);
-
-                        int y2 = (map.h-1)-y;
-                        if (!zmap.flags(y2, x) || (zmap.flags(y2, x) && zmap.values(y2, x) < z))
-                        {
-                            zmap.set(x, y2, z);
-                            map.set(x, y2, v);
-                        }
-                    }
+                    tileTriangles[firstTile + ty*tilesX + tx].push_back(i);
                 }
-
-                // hranova fce o pixel vedle
-                e1 += dy1;
-                e2 += dy2;
-                e3 += dy3;
             }
         }
     }
+
+    int tileCount = tiles.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < tileCount; i++)
+    {
+        int ti = tiles[i].first;
+        std::vector<PlaneEquation> planes;
+        for (int triangle : tileTriangles[i])
+        {
+            rasterizeTriangle(mesh, triangle, projected[ti][triangle], tiles[i].second, targets[ti], zmaps[ti], planes);
+        }
+    }
 }
 
 Map SurfaceProcessor::depthmap(const Mesh &mesh, MapConverter &converter,
                                cv::Point2d meshStart, cv::Point2d meshEnd,
                                double scaleCoef, SurfaceDataToProcess dataToProcess)
 {
-    converter.meshStart = meshStart;
-    converter.meshSize = meshEnd - meshStart;
-
-    Map map(converter.meshSize.x * scaleCoef , converter.meshSize.y * scaleCoef);
-    depthmap(mesh, map, converter.meshStart, meshEnd, dataToProcess);
-    return map;
+    std::vector<DepthmapTarget> targets(1, DepthmapTarget(meshStart, meshEnd, scaleCoef,
+                                                          std::vector<SurfaceDataToProcess>(1, dataToProcess)));
+    depthmaps(mesh, targets);
+    converter = targets[0].converter;
+    return targets[0].maps[0];
 }
 
 Map SurfaceProcessor::depthmap(const Mesh &mesh, MapConverter &converter, double scaleCoef, SurfaceDataToProcess dataToProcess)
 {
-    converter.meshStart = cv::Point2d(mesh.minx, mesh.miny);
-    converter.meshSize = cv::Point2d(mesh.maxx - mesh.minx, mesh.maxy - mesh.miny);
-
-    Map map(converter.meshSize.x * scaleCoef , converter.meshSize.y * scaleCoef);
-    depthmap(mesh, map, converter.meshStart, cv::Point2d(mesh.maxx, mesh.maxy), dataToProcess);
-    return map;
+    std::vector<DepthmapTarget> targets(1, DepthmapTarget(mesh, scaleCoef,
+                                                          std::vector<SurfaceDataToProcess>(1, dataToProcess)));
+    depthmaps(mesh, targets);
+    converter = targets[0].converter;
+    return targets[0].maps[0];
 }
 
 double dist(double x1, double y1, double x2, double y2)
@@ -322,7 +396,127 @@ double dist(double x1, double y1, double x2, double y2)
     return sqrt(pow(x1-y1, 2) + pow(x2-y2, 2));
 }
 
-CurvatureStruct SurfaceProcessor::calculateCurvatures(Map &depthmap, bool pcl)
+namespace {
+
+// pi minus the angle between (-1, zPrev - z) and (1, zNext - z), negative if the point lies below the
+// mean of its neighbours; the same as the angle of the 3D vectors used by calculateCurvaturesReference()
+inline double profileCurvature(double zPrev, double z, double zNext)
+{
+    double d1 = zPrev - z;
+    double d2 = zNext - z;
+    double cosAngle = (d1*d2 - 1.0) / sqrt((1.0 + d1*d1) * (1.0 + d2*d2));
+    if (cosAngle < -1.0) cosAngle = -1.0;
+    if (cosAngle > 1.0) cosAngle = 1.0;
+    double k = M_PI - acos(cosAngle);
+    return (z < (zPrev + zNext)/2) ? -k : k;
+}
+
+}
+
+CurvatureStruct SurfaceProcessor::calculateCurvatures(const Map &depthmap, bool pcl)
+{
+    CurvatureStruct c = calculateCurvatures(depthmap, pcl ? (int)AllCurvatures : (AllCurvatures & ~CurvaturePcl));
+    if (!pcl) c.curvaturePcl.init(depthmap.w, depthmap.h);
+    return c;
+}
+
+CurvatureStruct SurfaceProcessor::calculateCurvatures(const Map &depthmap, int outputs)
+{
+    int w = depthmap.w;
+    int h = depthmap.h;
+
+    CurvatureStruct c;
+    if (outputs & CurvatureK) { c.curvatureK1.init(w, h); c.curvatureK2.init(w, h); }
+    if (outputs & CurvatureMean) c.curvatureMean.init(w, h);
+    if (outputs & CurvatureGauss) c.curvatureGauss.init(w, h);
+    if (outputs & CurvatureIndex) c.curvatureIndex.init(w, h);
+    if (outputs & CurvaturePcl) c.curvaturePcl.init(w, h);
+    if (outputs & CurvatureFeatures)
+    {
+        c.peaks.init(w, h);
+        c.pits.init(w, h);
+        c.saddles.init(w, h);
+        c.valleys.init(w, h);
+    }
+
+    // pixels without all 8 neighbours stay unset; the maps are row-major, so the loop goes row by row
+    #pragma omp parallel for schedule(static)
+    for (int y = 1; y < h - 1; y++)
+    {
+        const double *zUp = depthmap.values.ptr<double>(y - 1);
+        const double *z = depthmap.values.ptr<double>(y);
+        const double *zDown = depthmap.values.ptr<double>(y + 1);
+        const char *fUp = depthmap.flags.ptr<char>(y - 1);
+        const char *f = depthmap.flags.ptr<char>(y);
+        const char *fDown = depthmap.flags.ptr<char>(y + 1);
+
+        for (int x = 1; x < w - 1; x++)
+        {
+            if (!(fUp[x-1] && fUp[x] && fUp[x+1] && f[x-1] && f[x] && f[x+1] && fDown[x-1] && fDown[x] && fDown[x+1]))
+                continue;
+
+            double k1 = profileCurvature(z[x-1], z[x], z[x+1]);
+            double k2 = profileCurvature(zDown[x], z[x], zUp[x]);
+            if (k1 < k2) std::swap(k1, k2);
+            k1 = -k1;
+            k2 = -k2;
+
+            if (outputs & CurvatureK)
+            {
+                c.curvatureK1.set(x, y, k1);
+                c.curvatureK2.set(x, y, k2);
+            }
+
+            double mean = (k1 + k2)/2;
+            double gauss = k1 * k2;
+            if (outputs & CurvatureMean) c.curvatureMean.set(x, y, mean);
+            if (outputs & CurvatureGauss) c.curvatureGauss.set(x, y, gauss);
+            if ((outputs & CurvatureIndex) && k1 != k2)
+            {
+                c.curvatureIndex.set(x, y, 0.5 - M_1_PI*atan((k1+k2)/(k2-k1)));
+            }
+
+            if (outputs & CurvatureFeatures)
+            {
+                if (gauss > 0.004 && mean < -0.005)
+                    c.peaks.set(x, y, 1);
+                if (gauss > 0.001 && mean > 0.001)
+                    c.pits.set(x, y, 1);
+                if (gauss < -0.002)
+                    c.saddles.set(x, y, 1);
+                if (fabs(gauss) < 0.001 && mean > 0.006)
+                    c.valleys.set(x, y, 1);
+            }
+
+            if (outputs & CurvaturePcl)
+            {
+                // Covariance of the 3x3 neighbourhood has the form [a 0 p; 0 a q; p q cz] with a = 2/3, since
+                // the x and y coordinates are a regular grid. Its eigenvalues are a and the roots of
+                // (l - a)(l - cz) = p^2 + q^2, the smaller root is the smallest eigenvalue.
+                const double a = 2.0/3.0;
+                double n[9] = { zUp[x-1], zUp[x], zUp[x+1], z[x-1], z[x], z[x+1], zDown[x-1], zDown[x], zDown[x+1] };
+                double sum = 0, sumSq = 0;
+                for (int i = 0; i < 9; i++)
+                {
+                    n[i] -= z[x]; // shifted for the numerical stability of the variance
+                    sum += n[i];
+                    sumSq += n[i]*n[i];
+                }
+                double cz = sumSq/9 - (sum/9)*(sum/9);
+                if (cz < 0) cz = 0;
+                double p = ((n[2] + n[5] + n[8]) - (n[0] + n[3] + n[6])) / 9;
+                double q = ((n[6] + n[7] + n[8]) - (n[0] + n[1] + n[2])) / 9;
+                double halfDiff = (a - cz)/2;
+                double l0 = (a + cz)/2 - sqrt(halfDiff*halfDiff + p*p + q*q);
+                c.curvaturePcl.set(x, y, l0 / (2*a + cz));
+            }
+        }
+    }
+
+    return c;
+}
+
+CurvatureStruct SurfaceProcessor::calculateCurvaturesReference(Map &depthmap, bool pcl)
 {
     CurvatureStruct c;
 
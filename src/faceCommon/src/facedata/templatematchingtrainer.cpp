@@ -25,7 +25,7 @@ void TemplateMatchingTrainer::evaluate(const std::vector<Mesh> &alignedMeshes, c
     #pragma omp parallel for
     for (int i = 0; i < n; i++)
     {
-        Face::Biometrics::MultiExtractor::ImageData d(alignedMeshes[i]);
+        Face::Biometrics::MultiExtractor::ImageData d(alignedMeshes[i], std::set<std::string>({ "depth" }));
         templates[i] = Face::Biometrics::Template(ids[i], unit->extract(d));
         depthMaps[i] = d.typeDict["depth"].clone();
     }
@@ -1,5 +1,6 @@
 #include "faceCommon/linalg/common.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <cmath>
@@ -152,3 +153,40 @@ double Common::median(std::vector<double> &values)
     std::sort(values.begin(), values.end());
     return n % 2 == 1 ? values[n/2] : (values[n/2 - 1] + values[n/2])/2.0;
 }
+
+void Common::parallelSort(std::vector<double> &values)
+{
+    const int chunks = 16;
+    int n = values.size();
+    if (n < 100000)
+    {
+        std::sort(values.begin(), values.end());
+        return;
+    }
+
+    std::vector<int> bounds(chunks + 1);
+    for (int c = 0; c <= chunks; c++)
+    {
+        bounds[c] = (long long)n * c / chunks;
+    }
+
+    #pragma omp parallel for
+    for (int c = 0; c < chunks; c++)
+    {
+        std::sort(values.begin() + bounds[c], values.begin() + bounds[c + 1]);
+    }
+
+    // merge neighbouring sorted runs, doubling their width
+    for (int width = 1; width < chunks; width *= 2)
+    {
+        int merges = (chunks + 2 * width - 1) / (2 * width);
+        #pragma omp parallel for
+        for (int m = 0; m < merges; m++)
+        {
+            int first = m * 2 * width;
+            int middle = std::min(chunks, first + width);
+            int last = std::min(chunks, first + 2 * width);
+            std::inplace_merge(values.begin() + bounds[first], values.begin() + bounds[middle], values.begin() + bounds[last]);
+        }
+    }
+}
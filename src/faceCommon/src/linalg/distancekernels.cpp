@@ -0,0 +1,282 @@
+#include "faceCommon/linalg/distancekernels.h"
+
+#include <cmath>
+
+#include "distancekernelsimpl.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FACELIB_SSE2
+    #include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+#endif
+
+using namespace Face::LinAlg;
+using namespace Face::LinAlg::DistanceKernelsImpl;
+
+namespace {
+
+// fallback for other architectures; accumulates in double also for float input
+template <typename T>
+struct Scalar
+{
+    typedef double Reg;
+    enum { width = 1 };
+
+    static inline Reg zero() { return 0.0; }
+    static inline Reg load(const T *p) { return *p; }
+    static inline Reg set1(double v) { return v; }
+    static inline Reg add(Reg a, Reg b) { return a + b; }
+    static inline Reg sub(Reg a, Reg b) { return a - b; }
+    static inline Reg mul(Reg a, Reg b) { return a * b; }
+    static inline Reg fma(Reg a, Reg b, Reg c) { return a * b + c; }
+    static inline Reg abs(Reg a) { return a < 0 ? -a : a; }
+    static inline double reduce(Reg a) { return a; }
+};
+
+#ifdef FACELIB_SSE2
+
+struct Sse2Double
+{
+    typedef __m128d Reg;
+    enum { width = 2 };
+
+    static inline Reg zero() { return _mm_setzero_pd(); }
+    static inline Reg load(const double *p) { return _mm_loadu_pd(p); }
+    static inline Reg set1(double v) { return _mm_set1_pd(v); }
+    static inline Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+    static inline Reg fma(Reg a, Reg b, Reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static inline Reg abs(Reg a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+    static inline double reduce(Reg a) { return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a))); }
+};
+
+struct Sse2Float
+{
+    typedef __m128 Reg;
+    enum { width = 4 };
+
+    static inline Reg zero() { return _mm_setzero_ps(); }
+    static inline Reg load(const float *p) { return _mm_loadu_ps(p); }
+    static inline Reg set1(double v) { return _mm_set1_ps((float)v); }
+    static inline Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+    static inline Reg fma(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static inline Reg abs(Reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static inline double reduce(Reg a)
+    {
+        // widen to double before the horizontal sum
+        return Sse2Double::reduce(_mm_add_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(_mm_movehl_ps(a, a))));
+    }
+};
+
+#endif
+
+bool cpuSupportsAvx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!fma || !osxsave) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+struct Dispatch
+{
+    Table<double> doubleTable;
+    Table<float> floatTable;
+    std::string name;
+
+    Dispatch()
+    {
+        if (cpuSupportsAvx2() && avx2Tables(doubleTable, floatTable))
+        {
+            name = "avx2";
+            return;
+        }
+
+#ifdef FACELIB_SSE2
+        doubleTable = table<Sse2Double, double>();
+        floatTable = table<Sse2Float, float>();
+        name = "sse2";
+#else
+        doubleTable = table<Scalar<double>, double>();
+        floatTable = table<Scalar<float>, float>();
+        name = "scalar";
+#endif
+    }
+};
+
+const Dispatch &dispatch()
+{
+    static const Dispatch d;
+    return d;
+}
+
+}
+
+double DistanceKernels::sum(const double *x, const double *w, int n)
+{
+    return dispatch().doubleTable.sum(x, w, n);
+}
+
+double DistanceKernels::sum(const float *x, const float *w, int n)
+{
+    return dispatch().floatTable.sum(x, w, n);
+}
+
+double DistanceKernels::dot(const double *x, const double *y, int n)
+{
+    return dispatch().doubleTable.dot(x, y, n);
+}
+
+double DistanceKernels::dot(const float *x, const float *y, int n)
+{
+    return dispatch().floatTable.dot(x, y, n);
+}
+
+double DistanceKernels::ssd(const double *x, const double *y, const double *w, int n)
+{
+    return dispatch().doubleTable.ssd(x, y, w, n);
+}
+
+double DistanceKernels::ssd(const float *x, const float *y, const float *w, int n)
+{
+    return dispatch().floatTable.ssd(x, y, w, n);
+}
+
+double DistanceKernels::cityblock(const double *x, const double *y, const double *w, int n)
+{
+    return dispatch().doubleTable.cityblock(x, y, w, n);
+}
+
+double DistanceKernels::cityblock(const float *x, const float *y, const float *w, int n)
+{
+    return dispatch().floatTable.cityblock(x, y, w, n);
+}
+
+DistanceKernels::Products DistanceKernels::products(const double *x, const double *y, const double *w,
+                                                    double meanX, double meanY, int n)
+{
+    double out[3];
+    dispatch().doubleTable.products(x, y, w, meanX, meanY, n, out);
+    Products p;
+    p.xy = out[0];
+    p.xx = out[1];
+    p.yy = out[2];
+    return p;
+}
+
+DistanceKernels::Products DistanceKernels::products(const float *x, const float *y, const float *w,
+                                                    double meanX, double meanY, int n)
+{
+    double out[3];
+    dispatch().floatTable.products(x, y, w, meanX, meanY, n, out);
+    Products p;
+    p.xy = out[0];
+    p.xx = out[1];
+    p.yy = out[2];
+    return p;
+}
+
+#ifdef FACELIB_SSE2
+
+namespace {
+
+// differences x-y of 16 int8 codes as four vectors of 4 floats
+inline void int8Differences(const signed char *x, const signed char *y, __m128 d[4])
+{
+    __m128i vx = _mm_loadu_si128((const __m128i *)x);
+    __m128i vy = _mm_loadu_si128((const __m128i *)y);
+    __m128i lo = _mm_sub_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(vx, vx), 8), _mm_srai_epi16(_mm_unpacklo_epi8(vy, vy), 8));
+    __m128i hi = _mm_sub_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(vx, vx), 8), _mm_srai_epi16(_mm_unpackhi_epi8(vy, vy), 8));
+    d[0] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16));
+    d[1] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16));
+    d[2] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16));
+    d[3] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16));
+}
+
+}
+
+#endif
+
+double DistanceKernels::ssd(const signed char *x, const signed char *y, const float *w, int n)
+{
+    int i = 0;
+    double result = 0.0;
+#ifdef FACELIB_SSE2
+    if (w)
+    {
+        __m128 acc = _mm_setzero_ps();
+        __m128 d[4];
+        for (; i + 16 <= n; i += 16)
+        {
+            int8Differences(x + i, y + i, d);
+            for (int k = 0; k < 4; k++)
+            {
+                __m128 v = _mm_mul_ps(d[k], _mm_loadu_ps(w + i + 4*k));
+                acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+            }
+        }
+        result = Sse2Float::reduce(acc);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        double d = (double)x[i] - y[i];
+        if (w) d *= w[i];
+        result += d*d;
+    }
+    return result;
+}
+
+double DistanceKernels::cityblock(const signed char *x, const signed char *y, const float *w, int n)
+{
+    int i = 0;
+    double result = 0.0;
+#ifdef FACELIB_SSE2
+    if (w)
+    {
+        __m128 acc = _mm_setzero_ps();
+        __m128 d[4];
+        for (; i + 16 <= n; i += 16)
+        {
+            int8Differences(x + i, y + i, d);
+            for (int k = 0; k < 4; k++)
+            {
+                acc = _mm_add_ps(acc, _mm_mul_ps(Sse2Float::abs(d[k]), _mm_loadu_ps(w + i + 4*k)));
+            }
+        }
+        result = Sse2Float::reduce(acc);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        double d = fabs((double)x[i] - y[i]);
+        result += w ? w[i] * d : d;
+    }
+    return result;
+}
+
+std::string DistanceKernels::implementation()
+{
+    return dispatch().name;
+}
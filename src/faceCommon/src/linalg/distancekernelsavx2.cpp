@@ -0,0 +1,71 @@
+// Compiled with AVX2 and FMA enabled (see CMakeLists.txt), used only when the CPU supports it.
+// Do not include library headers here, see distancekernelsimpl.h
+
+#include "distancekernelsimpl.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+using namespace Face::LinAlg::DistanceKernelsImpl;
+
+namespace {
+
+struct Avx2Double
+{
+    typedef __m256d Reg;
+    enum { width = 4 };
+
+    static inline Reg zero() { return _mm256_setzero_pd(); }
+    static inline Reg load(const double *p) { return _mm256_loadu_pd(p); }
+    static inline Reg set1(double v) { return _mm256_set1_pd(v); }
+    static inline Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+    static inline Reg fma(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static inline Reg abs(Reg a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    static inline double reduce(Reg a)
+    {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+};
+
+struct Avx2Float
+{
+    typedef __m256 Reg;
+    enum { width = 8 };
+
+    static inline Reg zero() { return _mm256_setzero_ps(); }
+    static inline Reg load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline Reg set1(double v) { return _mm256_set1_ps((float)v); }
+    static inline Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static inline Reg fma(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static inline Reg abs(Reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static inline double reduce(Reg a)
+    {
+        // widen to double before the horizontal sum
+        __m256d s = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)), _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+        return Avx2Double::reduce(s);
+    }
+};
+
+}
+
+bool Face::LinAlg::DistanceKernelsImpl::avx2Tables(Table<double> &doubleTable, Table<float> &floatTable)
+{
+    doubleTable = table<Avx2Double, double>();
+    floatTable = table<Avx2Float, float>();
+    return true;
+}
+
+#else
+
+bool Face::LinAlg::DistanceKernelsImpl::avx2Tables(Table<double> &, Table<float> &)
+{
+    return false;
+}
+
+#endif
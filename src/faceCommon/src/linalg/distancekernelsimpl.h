@@ -0,0 +1,218 @@
+#pragma once
+
+/*
+ * Kernel templates shared by distancekernels.cpp and distancekernelsavx2.cpp.
+ *
+ * The AVX2 translation unit is compiled with its own instruction set flags, so this
+ * header must stay free of library and standard headers: any inline function
+ * instantiated there could otherwise end up with AVX2 code in the common binary.
+ */
+
+namespace Face {
+namespace LinAlg {
+namespace DistanceKernelsImpl {
+
+template <typename T>
+struct Table
+{
+    double (*sum)(const T *x, const T *w, int n);
+    double (*dot)(const T *x, const T *y, int n);
+    double (*ssd)(const T *x, const T *y, const T *w, int n);
+    double (*cityblock)(const T *x, const T *y, const T *w, int n);
+    void (*products)(const T *x, const T *y, const T *w, double meanX, double meanY, int n, double *out);
+};
+
+bool avx2Tables(Table<double> &doubleTable, Table<float> &floatTable);
+
+/*
+ * V provides a SIMD register abstraction: Reg, width, zero, load, set1, add, sub,
+ * mul, fma (a*b + c), abs and reduce (horizontal sum to double). The main loops are
+ * unrolled twice to hide the latency of the accumulating additions.
+ */
+
+template <class V, typename T>
+double sum(const T *x, const T *w, int n)
+{
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    int i = 0;
+    if (w)
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            acc1 = V::fma(V::load(w + i), V::load(x + i), acc1);
+            acc2 = V::fma(V::load(w + i + V::width), V::load(x + i + V::width), acc2);
+        }
+    }
+    else
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            acc1 = V::add(acc1, V::load(x + i));
+            acc2 = V::add(acc2, V::load(x + i + V::width));
+        }
+    }
+
+    double result = V::reduce(V::add(acc1, acc2));
+    for (; i < n; i++)
+    {
+        result += w ? (double)w[i]*x[i] : (double)x[i];
+    }
+    return result;
+}
+
+template <class V, typename T>
+double dot(const T *x, const T *y, int n)
+{
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    int i = 0;
+    for (; i + 2*V::width <= n; i += 2*V::width)
+    {
+        acc1 = V::fma(V::load(x + i), V::load(y + i), acc1);
+        acc2 = V::fma(V::load(x + i + V::width), V::load(y + i + V::width), acc2);
+    }
+
+    double result = V::reduce(V::add(acc1, acc2));
+    for (; i < n; i++)
+    {
+        result += (double)x[i]*y[i];
+    }
+    return result;
+}
+
+template <class V, typename T>
+double ssd(const T *x, const T *y, const T *w, int n)
+{
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    int i = 0;
+    if (w)
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            typename V::Reg d1 = V::mul(V::load(w + i), V::sub(V::load(x + i), V::load(y + i)));
+            typename V::Reg d2 = V::mul(V::load(w + i + V::width), V::sub(V::load(x + i + V::width), V::load(y + i + V::width)));
+            acc1 = V::fma(d1, d1, acc1);
+            acc2 = V::fma(d2, d2, acc2);
+        }
+    }
+    else
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            typename V::Reg d1 = V::sub(V::load(x + i), V::load(y + i));
+            typename V::Reg d2 = V::sub(V::load(x + i + V::width), V::load(y + i + V::width));
+            acc1 = V::fma(d1, d1, acc1);
+            acc2 = V::fma(d2, d2, acc2);
+        }
+    }
+
+    double result = V::reduce(V::add(acc1, acc2));
+    for (; i < n; i++)
+    {
+        double d = (double)x[i] - y[i];
+        if (w) d *= w[i];
+        result += d*d;
+    }
+    return result;
+}
+
+template <class V, typename T>
+double cityblock(const T *x, const T *y, const T *w, int n)
+{
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    int i = 0;
+    if (w)
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            acc1 = V::fma(V::load(w + i), V::abs(V::sub(V::load(x + i), V::load(y + i))), acc1);
+            acc2 = V::fma(V::load(w + i + V::width), V::abs(V::sub(V::load(x + i + V::width), V::load(y + i + V::width))), acc2);
+        }
+    }
+    else
+    {
+        for (; i + 2*V::width <= n; i += 2*V::width)
+        {
+            acc1 = V::add(acc1, V::abs(V::sub(V::load(x + i), V::load(y + i))));
+            acc2 = V::add(acc2, V::abs(V::sub(V::load(x + i + V::width), V::load(y + i + V::width))));
+        }
+    }
+
+    double result = V::reduce(V::add(acc1, acc2));
+    for (; i < n; i++)
+    {
+        double d = (double)x[i] - y[i];
+        if (d < 0) d = -d;
+        result += w ? w[i]*d : d;
+    }
+    return result;
+}
+
+/*
+ * out[0] = sum (x'*y'), out[1] = sum (x'*x'), out[2] = sum (y'*y'),
+ * where x' = w*x - meanX and y' = w*y - meanY
+ */
+template <class V, typename T>
+void products(const T *x, const T *y, const T *w, double meanX, double meanY, int n, double *out)
+{
+    typename V::Reg xy = V::zero();
+    typename V::Reg xx = V::zero();
+    typename V::Reg yy = V::zero();
+    typename V::Reg mx = V::set1(meanX);
+    typename V::Reg my = V::set1(meanY);
+    int i = 0;
+    if (w)
+    {
+        for (; i + V::width <= n; i += V::width)
+        {
+            typename V::Reg wi = V::load(w + i);
+            typename V::Reg dx = V::sub(V::mul(wi, V::load(x + i)), mx);
+            typename V::Reg dy = V::sub(V::mul(wi, V::load(y + i)), my);
+            xy = V::fma(dx, dy, xy);
+            xx = V::fma(dx, dx, xx);
+            yy = V::fma(dy, dy, yy);
+        }
+    }
+    else
+    {
+        for (; i + V::width <= n; i += V::width)
+        {
+            typename V::Reg dx = V::sub(V::load(x + i), mx);
+            typename V::Reg dy = V::sub(V::load(y + i), my);
+            xy = V::fma(dx, dy, xy);
+            xx = V::fma(dx, dx, xx);
+            yy = V::fma(dy, dy, yy);
+        }
+    }
+
+    out[0] = V::reduce(xy);
+    out[1] = V::reduce(xx);
+    out[2] = V::reduce(yy);
+    for (; i < n; i++)
+    {
+        double dx = (w ? (double)w[i]*x[i] : (double)x[i]) - meanX;
+        double dy = (w ? (double)w[i]*y[i] : (double)y[i]) - meanY;
+        out[0] += dx*dy;
+        out[1] += dx*dx;
+        out[2] += dy*dy;
+    }
+}
+
+template <class V, typename T>
+Table<T> table()
+{
+    Table<T> t;
+    t.sum = &sum<V, T>;
+    t.dot = &dot<V, T>;
+    t.ssd = &ssd<V, T>;
+    t.cityblock = &cityblock<V, T>;
+    t.products = &products<V, T>;
+    return t;
+}
+
+}
+}
+}
@@ -0,0 +1,80 @@
+#include "faceCommon/linalg/distancematrix.h"
+
+#include "faceCommon/linalg/distancekernels.h"
+
+using namespace Face::LinAlg;
+
+Matrix DistanceMatrix::prepareRows(const Metrics &metrics, const std::vector<Vector> &vectors)
+{
+    if (vectors.empty()) return Matrix();
+
+    int n = vectors[0].rows;
+    int count = vectors.size();
+    Matrix result(count, n);
+    for (int i = 0; i < count; i++)
+    {
+        if (vectors[i].rows != n) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+        Matrix row = metrics.prepare(vectors[i]).t();
+        row.copyTo(result.row(i));
+    }
+    return result;
+}
+
+std::vector<double> DistanceMatrix::squaredNorms(const Matrix &rows)
+{
+    std::vector<double> result(rows.rows);
+    for (int i = 0; i < rows.rows; i++)
+    {
+        const double *row = rows.ptr<double>(i);
+        result[i] = DistanceKernels::dot(row, row, rows.cols);
+    }
+    return result;
+}
+
+Matrix DistanceMatrix::compute(const Metrics &metrics, const Matrix &a, const Matrix &b)
+{
+    if (!metrics.isDotDecomposable())
+    {
+        return compute(metrics, a, std::vector<double>(), b, std::vector<double>());
+    }
+    return compute(metrics, a, squaredNorms(a), b, squaredNorms(b));
+}
+
+Matrix DistanceMatrix::compute(const Metrics &metrics, const Matrix &a, const std::vector<double> &aSquaredNorms,
+                               const Matrix &b, const std::vector<double> &bSquaredNorms)
+{
+    if (a.cols != b.cols) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+
+    int n = a.cols;
+    Matrix result(a.rows, b.rows);
+    if (result.empty()) return result;
+
+    if (metrics.isDotDecomposable())
+    {
+        if ((int)aSquaredNorms.size() != a.rows || (int)bSquaredNorms.size() != b.rows)
+            throw FACELIB_EXCEPTION("squared norms count mismatch");
+
+        cv::gemm(a, b, 1.0, cv::noArray(), 0.0, result, cv::GEMM_2_T);
+        for (int i = 0; i < a.rows; i++)
+        {
+            double *row = result.ptr<double>(i);
+            for (int j = 0; j < b.rows; j++)
+            {
+                row[j] = metrics.distanceFromDot(row[j], aSquaredNorms[i], bSquaredNorms[j], n);
+            }
+        }
+    }
+    else
+    {
+        #pragma omp parallel for
+        for (int i = 0; i < a.rows; i++)
+        {
+            double *row = result.ptr<double>(i);
+            for (int j = 0; j < b.rows; j++)
+            {
+                row[j] = metrics.rawPreparedDistance(a.ptr<double>(i), b.ptr<double>(j), n);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,405 @@
+#include "faceCommon/linalg/hnswindex.h"
+
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <cmath>
+
+using namespace Face::LinAlg;
+
+HnswIndex::HnswIndex(const Metrics::Ptr &metrics, int dimension, int m, int efConstruction) :
+    metrics(metrics),
+    dimension(dimension),
+    m(m),
+    efConstruction(efConstruction),
+    levelFactor(1.0 / log((double)m)),
+    rng(0x1234567),
+    entryPoint(-1),
+    maxLevel(-1),
+    liveCount(0)
+{
+    if (metrics.empty()) throw FACELIB_EXCEPTION("metrics is not set");
+    if (m < 2) throw FACELIB_EXCEPTION("m should be at least 2");
+}
+
+double HnswIndex::distance(const double *query, int node) const
+{
+    return metrics->rawPreparedDistance(query, nodeVector(node), dimension);
+}
+
+int HnswIndex::randomLevel()
+{
+    return (int)(-log(1.0 - rng.uniform(0.0, 1.0)) * levelFactor);
+}
+
+bool HnswIndex::contains(int label) const
+{
+    return nodes.find(label) != nodes.end();
+}
+
+int HnswIndex::greedySearch(const double *query, int node, int level) const
+{
+    double best = distance(query, node);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int neighbour : links[node][level])
+        {
+            double d = distance(query, neighbour);
+            if (d < best)
+            {
+                best = d;
+                node = neighbour;
+                changed = true;
+            }
+        }
+    }
+    return node;
+}
+
+cv::Ptr<HnswIndex::VisitedList> HnswIndex::acquireVisited() const
+{
+    cv::Ptr<VisitedList> visited;
+    {
+        Poco::FastMutex::ScopedLock lock(visitedMutex);
+        if (!visitedPool.empty())
+        {
+            visited = visitedPool.back();
+            visitedPool.pop_back();
+        }
+    }
+    if (visited.empty())
+    {
+        visited = new VisitedList();
+        visited->epoch = 0;
+    }
+
+    visited->epoch++;
+    if (visited->epoch == 0)
+    {
+        std::fill(visited->marks.begin(), visited->marks.end(), 0);
+        visited->epoch = 1;
+    }
+    if (visited->marks.size() < labels.size()) visited->marks.resize(labels.size(), 0);
+    return visited;
+}
+
+void HnswIndex::releaseVisited(const cv::Ptr<VisitedList> &visited) const
+{
+    Poco::FastMutex::ScopedLock lock(visitedMutex);
+    visitedPool.push_back(visited);
+}
+
+std::vector<HnswIndex::Neighbour> HnswIndex::searchLevel(const double *query, int entry, int ef, int level) const
+{
+    cv::Ptr<VisitedList> visitedList = acquireVisited();
+    std::vector<unsigned int> &visited = visitedList->marks;
+    const unsigned int epoch = visitedList->epoch;
+    std::priority_queue<Neighbour, std::vector<Neighbour>, std::greater<Neighbour> > candidates;
+    std::priority_queue<Neighbour> found;
+
+    Neighbour start(distance(query, entry), entry);
+    visited[entry] = epoch;
+    candidates.push(start);
+    found.push(start);
+
+    while (!candidates.empty())
+    {
+        Neighbour current = candidates.top();
+        if (current.first > found.top().first && (int)found.size() >= ef) break;
+        candidates.pop();
+
+        for (int neighbour : links[current.second][level])
+        {
+            if (visited[neighbour] == epoch) continue;
+            visited[neighbour] = epoch;
+
+            double d = distance(query, neighbour);
+            if ((int)found.size() < ef || d < found.top().first)
+            {
+                candidates.push(Neighbour(d, neighbour));
+                found.push(Neighbour(d, neighbour));
+                if ((int)found.size() > ef) found.pop();
+            }
+        }
+    }
+
+    releaseVisited(visitedList);
+
+    std::vector<Neighbour> result(found.size());
+    for (int i = result.size() - 1; i >= 0; i--)
+    {
+        result[i] = found.top();
+        found.pop();
+    }
+    return result;
+}
+
+std::vector<int> HnswIndex::selectNeighbours(const std::vector<Neighbour> &candidates, int count) const
+{
+    // prefer candidates closer to the base than to any already selected neighbour, so the
+    // links point to different directions; the rest is used only if there are too few of them
+    std::vector<int> result;
+    std::vector<int> skipped;
+    for (const Neighbour &c : candidates)
+    {
+        if ((int)result.size() >= count) break;
+
+        bool diverse = true;
+        for (int r : result)
+        {
+            if (distance(nodeVector(c.second), r) < c.first)
+            {
+                diverse = false;
+                break;
+            }
+        }
+
+        if (diverse)
+            result.push_back(c.second);
+        else
+            skipped.push_back(c.second);
+    }
+
+    for (unsigned int i = 0; i < skipped.size() && (int)result.size() < count; i++)
+    {
+        result.push_back(skipped[i]);
+    }
+    return result;
+}
+
+void HnswIndex::connect(int node, int neighbour, int level)
+{
+    std::vector<int> &nodeLinks = links[node][level];
+    nodeLinks.push_back(neighbour);
+    if ((int)nodeLinks.size() <= maxLinks(level)) return;
+
+    std::vector<Neighbour> candidates;
+    for (int n : nodeLinks)
+    {
+        candidates.push_back(Neighbour(distance(nodeVector(node), n), n));
+    }
+    std::sort(candidates.begin(), candidates.end());
+    nodeLinks = selectNeighbours(candidates, maxLinks(level));
+}
+
+void HnswIndex::insert(int label, const double *v)
+{
+    if (dimension <= 0) throw FACELIB_EXCEPTION("index dimension is not set");
+    if (contains(label)) throw FACELIB_EXCEPTION("label " + std::to_string(label) + " is already in the index");
+
+    int node = labels.size();
+    int level = randomLevel();
+
+    data.insert(data.end(), v, v + dimension);
+    labels.push_back(label);
+    levels.push_back(level);
+    links.push_back(std::vector<std::vector<int> >(level + 1));
+    removed.push_back(0);
+    nodes[label] = node;
+    liveCount++;
+
+    if (entryPoint < 0)
+    {
+        entryPoint = node;
+        maxLevel = level;
+        return;
+    }
+
+    const double *query = nodeVector(node);
+    int entry = entryPoint;
+    for (int l = maxLevel; l > level; l--)
+    {
+        entry = greedySearch(query, entry, l);
+    }
+
+    for (int l = std::min(level, maxLevel); l >= 0; l--)
+    {
+        std::vector<Neighbour> candidates = searchLevel(query, entry, efConstruction, l);
+        links[node][l] = selectNeighbours(candidates, m);
+        for (int neighbour : links[node][l])
+        {
+            connect(neighbour, node, l);
+        }
+        entry = candidates[0].second;
+    }
+
+    if (level > maxLevel)
+    {
+        maxLevel = level;
+        entryPoint = node;
+    }
+}
+
+bool HnswIndex::remove(int label)
+{
+    std::map<int, int>::iterator it = nodes.find(label);
+    if (it == nodes.end()) return false;
+
+    removed[it->second] = 1;
+    nodes.erase(it);
+    liveCount--;
+    return true;
+}
+
+void HnswIndex::rebuild()
+{
+    std::vector<double> oldData;
+    std::vector<int> oldLabels;
+    oldData.swap(data);
+    oldLabels.swap(labels);
+    std::vector<unsigned char> oldRemoved;
+    oldRemoved.swap(removed);
+
+    levels.clear();
+    links.clear();
+    nodes.clear();
+    entryPoint = -1;
+    maxLevel = -1;
+    liveCount = 0;
+
+    for (unsigned int node = 0; node < oldLabels.size(); node++)
+    {
+        if (oldRemoved[node]) continue;
+        insert(oldLabels[node], oldData.data() + (size_t)node * dimension);
+    }
+}
+
+void HnswIndex::relabel(const std::map<int, int> &mapping)
+{
+    std::map<int, int> relabeled;
+    for (const std::pair<const int, int> &n : nodes)
+    {
+        std::map<int, int>::const_iterator it = mapping.find(n.first);
+        if (it == mapping.end()) throw FACELIB_EXCEPTION("label " + std::to_string(n.first) + " is missing in the mapping");
+        if (!relabeled.insert(std::make_pair(it->second, n.second)).second)
+            throw FACELIB_EXCEPTION("label " + std::to_string(it->second) + " is mapped more than once");
+    }
+
+    // removed nodes keep their old labels, they are never returned
+    for (const std::pair<const int, int> &n : relabeled)
+    {
+        labels[n.second] = n.first;
+    }
+    nodes.swap(relabeled);
+}
+
+std::vector<HnswIndex::Neighbour> HnswIndex::search(const double *query, int k, int ef) const
+{
+    std::vector<Neighbour> result;
+    if (liveCount == 0 || k <= 0) return result;
+    k = std::min(k, liveCount);
+
+    int entry = entryPoint;
+    for (int l = maxLevel; l > 0; l--)
+    {
+        entry = greedySearch(query, entry, l);
+    }
+
+    // removed nodes take places in the candidate list, it is doubled until k live ones are found
+    int nodeCount = labels.size();
+    for (ef = std::max(ef, k); ; ef = std::min(2*ef, nodeCount))
+    {
+        result.clear();
+        std::vector<Neighbour> candidates = searchLevel(query, entry, ef, 0);
+        for (const Neighbour &c : candidates)
+        {
+            if (removed[c.second]) continue;
+            result.push_back(Neighbour(c.first, labels[c.second]));
+            if ((int)result.size() == k) break;
+        }
+        if ((int)result.size() == k || ef >= nodeCount) break;
+    }
+    return result;
+}
+
+void HnswIndex::serialize(cv::FileStorage &storage) const
+{
+    if (!storage.isOpened())
+    {
+        throw FACELIB_EXCEPTION("HnswIndex::serialize - cv::FileStorage is not opened");
+    }
+
+    std::vector<int> linkCounts;
+    std::vector<int> linkData;
+    for (unsigned int node = 0; node < links.size(); node++)
+    {
+        for (const std::vector<int> &levelLinks : links[node])
+        {
+            linkCounts.push_back(levelLinks.size());
+            linkData.insert(linkData.end(), levelLinks.begin(), levelLinks.end());
+        }
+    }
+
+    storage << "dimension" << dimension;
+    storage << "m" << m;
+    storage << "efConstruction" << efConstruction;
+    storage << "entryPoint" << entryPoint;
+    storage << "maxLevel" << maxLevel;
+    storage << "labels" << labels;
+    storage << "levels" << levels;
+    storage << "removed" << std::vector<int>(removed.begin(), removed.end());
+    storage << "linkCounts" << linkCounts;
+    storage << "links" << linkData;
+    storage << "data" << data;
+}
+
+void HnswIndex::deserialize(cv::FileStorage &storage)
+{
+    if (!storage.isOpened())
+    {
+        throw FACELIB_EXCEPTION("HnswIndex::deserialize - cv::FileStorage is not opened");
+    }
+
+    std::vector<int> removedFlags;
+    std::vector<int> linkCounts;
+    std::vector<int> linkData;
+
+    storage["dimension"] >> dimension;
+    storage["m"] >> m;
+    storage["efConstruction"] >> efConstruction;
+    storage["entryPoint"] >> entryPoint;
+    storage["maxLevel"] >> maxLevel;
+    storage["labels"] >> labels;
+    storage["levels"] >> levels;
+    storage["removed"] >> removedFlags;
+    storage["linkCounts"] >> linkCounts;
+    storage["links"] >> linkData;
+    storage["data"] >> data;
+
+    int nodeCount = labels.size();
+    if ((int)levels.size() != nodeCount || (int)removedFlags.size() != nodeCount || data.size() != (size_t)nodeCount * dimension)
+    {
+        throw FACELIB_EXCEPTION("corrupted index");
+    }
+
+    levelFactor = 1.0 / log((double)m);
+    removed.assign(removedFlags.begin(), removedFlags.end());
+    links.assign(nodeCount, std::vector<std::vector<int> >());
+    nodes.clear();
+    liveCount = 0;
+
+    unsigned int countIndex = 0;
+    unsigned int linkIndex = 0;
+    for (int node = 0; node < nodeCount; node++)
+    {
+        links[node].resize(levels[node] + 1);
+        for (int l = 0; l <= levels[node]; l++)
+        {
+            if (countIndex >= linkCounts.size() || linkIndex + linkCounts[countIndex] > linkData.size())
+            {
+                throw FACELIB_EXCEPTION("corrupted index");
+            }
+            links[node][l].assign(linkData.begin() + linkIndex, linkData.begin() + linkIndex + linkCounts[countIndex]);
+            linkIndex += linkCounts[countIndex];
+            countIndex++;
+        }
+
+        if (!removed[node])
+        {
+            nodes[labels[node]] = node;
+            liveCount++;
+        }
+    }
+}
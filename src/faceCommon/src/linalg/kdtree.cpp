@@ -0,0 +1,126 @@
+#include "faceCommon/linalg/kdtree.h"
+
+#include <algorithm>
+
+using namespace Face::LinAlg;
+
+namespace {
+
+inline double coordinate(const cv::Point3d &p, int axis)
+{
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+inline double squaredDistance(const cv::Point3d &a, const cv::Point3d &b)
+{
+    cv::Point3d d = a - b;
+    return d.x*d.x + d.y*d.y + d.z*d.z;
+}
+
+}
+
+KdTree::KdTree(const Matrix &points)
+{
+    if (points.cols != 3) throw FACELIB_EXCEPTION("3D points expected");
+
+    int n = points.rows;
+    this->points.resize(n);
+    indices.resize(n);
+    axes.assign(n, 0);
+    for (int r = 0; r < n; r++)
+    {
+        this->points[r] = cv::Point3d(points(r, 0), points(r, 1), points(r, 2));
+        indices[r] = r;
+    }
+
+    build(0, n);
+}
+
+void KdTree::build(int begin, int end)
+{
+    if (end - begin <= leafSize) return;
+
+    // split along the axis with the largest extent
+    cv::Point3d min = points[begin], max = points[begin];
+    for (int i = begin + 1; i < end; i++)
+    {
+        const cv::Point3d &p = points[i];
+        min.x = std::min(min.x, p.x); min.y = std::min(min.y, p.y); min.z = std::min(min.z, p.z);
+        max.x = std::max(max.x, p.x); max.y = std::max(max.y, p.y); max.z = std::max(max.z, p.z);
+    }
+    cv::Point3d extent = max - min;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    // median by nth_element on (point, index) pairs kept in sync
+    int middle = (begin + end) / 2;
+    std::vector<int> order(end - begin);
+    for (int i = begin; i < end; i++) order[i - begin] = i;
+    std::nth_element(order.begin(), order.begin() + (middle - begin), order.end(), [&](int a, int b)
+    {
+        return coordinate(points[a], axis) < coordinate(points[b], axis);
+    });
+
+    std::vector<cv::Point3d> sortedPoints(end - begin);
+    std::vector<int> sortedIndices(end - begin);
+    for (int i = 0; i < end - begin; i++)
+    {
+        sortedPoints[i] = points[order[i]];
+        sortedIndices[i] = indices[order[i]];
+    }
+    std::copy(sortedPoints.begin(), sortedPoints.end(), points.begin() + begin);
+    std::copy(sortedIndices.begin(), sortedIndices.end(), indices.begin() + begin);
+    axes[middle] = axis;
+
+    build(begin, middle);
+    build(middle + 1, end);
+}
+
+void KdTree::search(int begin, int end, const cv::Point3d &p, int &best, double &bestDistance) const
+{
+    if (end - begin <= leafSize)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            double d = squaredDistance(p, points[i]);
+            if (d < bestDistance)
+            {
+                bestDistance = d;
+                best = i;
+            }
+        }
+        return;
+    }
+
+    int middle = (begin + end) / 2;
+    double d = squaredDistance(p, points[middle]);
+    if (d < bestDistance)
+    {
+        bestDistance = d;
+        best = middle;
+    }
+
+    double diff = coordinate(p, axes[middle]) - coordinate(points[middle], axes[middle]);
+    if (diff < 0)
+    {
+        search(begin, middle, p, best, bestDistance);
+        if (diff*diff < bestDistance) search(middle + 1, end, p, best, bestDistance);
+    }
+    else
+    {
+        search(middle + 1, end, p, best, bestDistance);
+        if (diff*diff < bestDistance) search(begin, middle, p, best, bestDistance);
+    }
+}
+
+int KdTree::nearest(const cv::Point3d &p, double *squaredDistance) const
+{
+    if (points.empty()) throw FACELIB_EXCEPTION("empty k-d tree");
+
+    int best = -1;
+    double bestDistance = 1e300;
+    search(0, points.size(), p, best, bestDistance);
+    if (best < 0) throw FACELIB_EXCEPTION("invalid query point");
+
+    if (squaredDistance) *squaredDistance = bestDistance;
+    return indices[best];
+}
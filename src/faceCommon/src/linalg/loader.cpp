@@ -1,5 +1,8 @@
 #include "faceCommon/linalg/loader.h"
 
+#include <iostream>
+#include <algorithm>
+
 #include <Poco/File.h>
 #include <Poco/String.h>
 #include <Poco/Glob.h>
@@ -250,10 +253,25 @@ void Loader::loadMeshes(const std::string &dir, std::vector<int> &ids, std::vect
 void Loader::loadMeshes(const std::string &dir, const Face::FaceData::FaceAlignerIcp &aligner, std::vector<int> &ids,
                         std::vector<Face::FaceData::Mesh> &meshes, int icpIterations, int smoothIterations,
                         float smoothCoef, const std::string &idSeparator)
+{
+    // fixed number of iterations, the same settings as FaceAlignerIcp::align(face, maxIterations, preAlign)
+    Face::FaceData::FaceAlignerIcp::IcpSettings icpSettings;
+    icpSettings.maxIterations = icpIterations;
+    icpSettings.tolerance = -1;
+    icpSettings.subsampleLevels = 1;
+    icpSettings.trimRatio = 1;
+    icpSettings.maxDistance = 0;
+    loadMeshes(dir, aligner, ids, meshes, icpSettings, smoothIterations, smoothCoef, idSeparator);
+}
+
+void Loader::loadMeshes(const std::string &dir, const Face::FaceData::FaceAlignerIcp &aligner, std::vector<int> &ids,
+                        std::vector<Face::FaceData::Mesh> &meshes, const Face::FaceData::FaceAlignerIcp::IcpSettings &icpSettings,
+                        int smoothIterations, float smoothCoef, const std::string &idSeparator)
 {
     std::vector<std::string> fileNames;
     loadMeshesAllocate(dir, ids, meshes, fileNames);
     int n = fileNames.size();
+    std::vector<Face::FaceData::FaceAlignerIcp::IcpResult> icpResults(n);
 
     #pragma omp parallel for
     for (int i = 0; i < n; i++)
@@ -265,14 +283,36 @@ void Loader::loadMeshes(const std::string &dir, const Face::FaceData::FaceAligne
             Face::FaceData::SurfaceProcessor::mdenoising(m, smoothCoef, smoothIterations, smoothIterations);
         }
 
-        if (icpIterations > 0)
+        if (icpSettings.maxIterations > 0)
         {
-			aligner.align(m, icpIterations, Face::FaceData::FaceAlignerIcp::CVTemplateMatching);
+            icpResults[i] = aligner.align(m, icpSettings, Face::FaceData::FaceAlignerIcp::CVTemplateMatching);
         }
 
         ids[i] = Poco::NumberParser::parse(Poco::StringTokenizer(fileNames[i], idSeparator)[0]);
         meshes[i] = m;
     }
+
+    if (icpSettings.maxIterations <= 0 || n == 0) return;
+
+    double meanIterations = 0;
+    int maxIterations = 0;
+    double meanRms = 0;
+    int notConverged = 0;
+    for (int i = 0; i < n; i++)
+    {
+        meanIterations += icpResults[i].iterations;
+        maxIterations = std::max(maxIterations, icpResults[i].iterations);
+        meanRms += icpResults[i].rms;
+        if (!icpResults[i].converged) notConverged++;
+    }
+    meanIterations /= n;
+    meanRms /= n;
+
+    std::cout << "ICP of " << n << " meshes: iterations mean " << meanIterations << ", max " << maxIterations
+              << "; rms mean " << meanRms;
+    // a negative tolerance runs a fixed number of iterations, nothing converges
+    if (icpSettings.tolerance >= 0) std::cout << "; not converged " << notConverged;
+    std::cout << std::endl;
 }
 
 void Loader::loadMeshes(const std::string &dir, const Face::FaceData::FaceAlignerLandmark &aligner,
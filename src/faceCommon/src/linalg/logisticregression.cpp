@@ -84,6 +84,20 @@ double LogisticRegression::classify(const Vector &x) const
     return sigma(product(0));
 }
 
+std::vector<double> LogisticRegression::classify(const Matrix &data) const
+{
+    std::vector<double> result(data.rows);
+    if (data.rows == 0) return result;
+    if (data.cols + 1 != w.rows) throw FACELIB_EXCEPTION("invalid input size");
+
+    Matrix product = data * w.rowRange(1, w.rows);
+    for (int r = 0; r < data.rows; r++)
+    {
+        result[r] = sigma(w(0) + product(r));
+    }
+    return result;
+}
+
 Vector LogisticRegression::prependOne(const Vector &in) const
 {
     int M = in.rows;
@@ -42,12 +42,15 @@ MahalanobisWeightedMetric::MahalanobisWeightedMetric(std::vector<Vector> &sample
 
 double HammingMetric::distance(const Vector &v1, const Vector &v2) const
 {
-    int n = v1.rows;
+    return rawDistance(values(v1), values(v2), v1.rows);
+}
 
+double HammingMetric::rawDistance(const double *v1, const double *v2, int n) const
+{
     double sum = 0.0;
     for (int i = 0; i < n; i++)
     {
-        if (v1(i) != v2(i))
+        if (v1[i] != v2[i])
         {
             sum += 1;
         }
@@ -58,22 +61,30 @@ double HammingMetric::distance(const Vector &v1, const Vector &v2) const
 
 double IntersectionMetric::distance(const Vector &v1, const Vector &v2) const
 {
-    int n = v1.rows;
+    return rawDistance(values(v1), values(v2), v1.rows);
+}
+
+double IntersectionMetric::rawDistance(const double *v1, const double *v2, int n) const
+{
     double sum = 0.0;
     for (int i = 0; i < n; i++)
     {
-        sum += v1(i) < v2(i) ? v1(i) : v2(i);
+        sum += v1[i] < v2[i] ? v1[i] : v2[i];
     }
     return sum/n;
 }
 
 double ChiSquareMetric::distance(const Vector &v1, const Vector &v2) const
 {
-    int n = v1.rows;
+    return rawDistance(values(v1), values(v2), v1.rows);
+}
+
+double ChiSquareMetric::rawDistance(const double *v1, const double *v2, int n) const
+{
     double sum = 0.0;
     for (int i = 0; i < n; i++)
     {
-        sum += pow(v1(i) - v2(i), 2) / (v1(i) + v2(i));
+        sum += pow(v1[i] - v2[i], 2) / (v1[i] + v2[i]);
     }
     return sum/n;
 }
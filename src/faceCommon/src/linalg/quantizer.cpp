@@ -0,0 +1,265 @@
+#include "faceCommon/linalg/quantizer.h"
+
+#include <cstring>
+#include <cmath>
+
+using namespace Face::LinAlg;
+
+Quantizer::Quantizer(Type type, const std::vector<Vector> &vectors) : type(type)
+{
+    learn(vectors);
+}
+
+int Quantizer::valueSize() const
+{
+    switch (type)
+    {
+    case Int8:
+        return 1;
+    case Float16:
+        return 2;
+    default:
+        return sizeof(double);
+    }
+}
+
+void Quantizer::learn(const std::vector<Vector> &vectors)
+{
+    scale.clear();
+    offset.clear();
+    if (type != Int8) return;
+    if (vectors.empty()) throw FACELIB_EXCEPTION("no training vectors");
+
+    int n = vectors[0].rows;
+    std::vector<double> minValues(n, 1e300);
+    std::vector<double> maxValues(n, -1e300);
+    for (const Vector &v : vectors)
+    {
+        if (v.rows != n) throw FACELIB_EXCEPTION("input vector sizes mismatch");
+        for (int i = 0; i < n; i++)
+        {
+            double value = v(i);
+            if (value != value) continue;
+            if (value < minValues[i]) minValues[i] = value;
+            if (value > maxValues[i]) maxValues[i] = value;
+        }
+    }
+
+    // [min, max] is mapped to [-127, 127]
+    scale.resize(n);
+    offset.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        if (minValues[i] > maxValues[i])
+        {
+            minValues[i] = maxValues[i] = 0.0;
+        }
+        double range = maxValues[i] - minValues[i];
+        scale[i] = range > 0.0 ? (float)(range / 254.0) : 1.0f;
+        offset[i] = (minValues[i] + maxValues[i]) / 2.0;
+    }
+}
+
+void Quantizer::encode(const double *v, int n, void *out) const
+{
+    switch (type)
+    {
+    case Int8:
+    {
+        if ((int)scale.size() != n) throw FACELIB_EXCEPTION("quantizer is not learned for vectors of this size");
+        signed char *q = (signed char *)out;
+        for (int i = 0; i < n; i++)
+        {
+            double value = std::floor((v[i] - offset[i]) / scale[i] + 0.5);
+            if (value < -127.0) value = -127.0;
+            if (value > 127.0) value = 127.0;
+            q[i] = (signed char)value;
+        }
+        break;
+    }
+    case Float16:
+    {
+        unsigned short *h = (unsigned short *)out;
+        for (int i = 0; i < n; i++)
+        {
+            h[i] = toHalf((float)v[i]);
+        }
+        break;
+    }
+    default:
+        std::memcpy(out, v, n * sizeof(double));
+    }
+}
+
+void Quantizer::decode(const void *in, int n, double *out) const
+{
+    switch (type)
+    {
+    case Int8:
+    {
+        if ((int)scale.size() != n) throw FACELIB_EXCEPTION("quantizer is not learned for vectors of this size");
+        const signed char *q = (const signed char *)in;
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = offset[i] + scale[i] * q[i];
+        }
+        break;
+    }
+    case Float16:
+    {
+        const unsigned short *h = (const unsigned short *)in;
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = fromHalf(h[i]);
+        }
+        break;
+    }
+    default:
+        std::memcpy(out, in, n * sizeof(double));
+    }
+}
+
+Vector Quantizer::roundTrip(const Vector &v) const
+{
+    int n = v.rows;
+    Vector values = v.isContinuous() ? v : Vector(v.clone());
+    std::vector<unsigned char> codes(n * valueSize());
+    Vector result(n);
+    encode(values.ptr<double>(), n, codes.data());
+    decode(codes.data(), n, result.ptr<double>());
+    return result;
+}
+
+unsigned short Quantizer::toHalf(float value)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    unsigned int sign = (bits >> 16) & 0x8000;
+    unsigned int mantissa = bits & 0x007fffff;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+    {
+        // infinity or NaN
+        return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31)
+    {
+        // overflow
+        return (unsigned short)(sign | 0x7c00);
+    }
+    if (exponent <= 0)
+    {
+        // subnormal or zero
+        if (exponent < -10) return (unsigned short)sign;
+        mantissa |= 0x00800000;
+        int shift = 14 - exponent;
+        unsigned int half = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return (unsigned short)(sign | half);
+    }
+
+    // round to nearest even; a carry into the exponent is handled by the addition
+    unsigned int half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return (unsigned short)(sign | half);
+}
+
+float Quantizer::fromHalf(unsigned short value)
+{
+    unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+    unsigned int exponent = (value >> 10) & 0x1f;
+    unsigned int mantissa = value & 0x3ff;
+
+    unsigned int bits;
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // subnormal, normalize it
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+std::string Quantizer::typeName(Type type)
+{
+    switch (type)
+    {
+    case Int8:
+        return "int8";
+    case Float16:
+        return "float16";
+    default:
+        return "none";
+    }
+}
+
+Quantizer::Type Quantizer::parseType(const std::string &name)
+{
+    if (name.compare("int8") == 0) return Int8;
+    if (name.compare("float16") == 0) return Float16;
+    if (name.compare("none") == 0) return None;
+    throw FACELIB_EXCEPTION("unknown quantization type: " + name);
+}
+
+void Quantizer::serialize(cv::FileStorage &storage) const
+{
+    if (!storage.isOpened())
+    {
+        throw FACELIB_EXCEPTION("Quantizer::serialize - cv::FileStorage is not opened");
+    }
+
+    storage << "quantization" << typeName(type);
+    if (type == Int8)
+    {
+        storage << "quantizationScale" << scale;
+        storage << "quantizationOffset" << offset;
+    }
+}
+
+void Quantizer::deserialize(cv::FileStorage &storage)
+{
+    if (!storage.isOpened())
+    {
+        throw FACELIB_EXCEPTION("Quantizer::deserialize - cv::FileStorage is not opened");
+    }
+
+    std::string name;
+    storage["quantization"] >> name;
+    type = parseType(name);
+    scale.clear();
+    offset.clear();
+    if (type == Int8)
+    {
+        storage["quantizationScale"] >> scale;
+        storage["quantizationOffset"] >> offset;
+    }
+}
@@ -16,6 +16,7 @@ namespace Face {
     const std::string Settings::MeanFaceModelLandmarksPathKey = "MeanFaceModelLandmarksPath";
     const std::string Settings::PreAlignTemplatePathKey = "PreAlignTemplatePath";
     const std::string Settings::MultiExtractorPathKey = "MultiExtractorPath";
+    const std::string Settings::GalleryPathKey = "GalleryPath";
 
 
 	Poco::Mutex Settings::m;
@@ -43,6 +44,7 @@ namespace Face {
         settingsMap[MeanFaceModelLandmarksPathKey] = "meanForAlign.yml";
         settingsMap[PreAlignTemplatePathKey] = "preAlignTemplate.yml";
         settingsMap[MultiExtractorPathKey] = "softKinetic/scaled-trained";
+        settingsMap[GalleryPathKey] = "gallery";
     }
 }
 